@@ -0,0 +1,132 @@
+/*
+implement a per-event arena with a standard allocator on top, optionally backed by huge pages
+author: Gaoxian Song
+*/
+#ifndef Arena_HPP
+#define Arena_HPP
+
+#include <vector>
+#include <new>
+#include <cstddef>
+#include <stdint.h>
+#include <sys/mman.h>
+
+using namespace std;
+
+//default size of an arena block
+const size_t ARENA_BLOCK_BYTES=64*1024;
+//size of a huge page, blocks on huge pages are rounded up to it
+const size_t ARENA_HUGE_PAGE_BYTES=2*1024*1024;
+
+/**
+ * Bump allocator for the scratch memory of one event or batch. Allocation moves a pointer
+ * forward through blocks mapped from the system; nothing is freed on its own, Reset hands
+ * every block back for reuse at once. After the first few events the arena owns as many blocks
+ * as the largest event needs and no longer asks the system for memory.
+ * Blocks come from anonymous mappings, on huge pages when asked and the system has them,
+ * otherwise on normal pages. Only one thread uses an arena.
+ */
+class EventArena
+{
+private:
+  struct Block
+  {
+    char* data;
+    size_t size;
+  };
+  vector<Block> blocks;//in the order they were mapped
+  size_t current;//block being allocated from
+  size_t used;//bytes taken from the current block
+  size_t blockSize;
+  bool hugePages;
+  size_t systemAllocations;//blocks mapped so far
+  //map a block of at least minSize bytes after the last one
+  void AddBlock(size_t minSize);
+  EventArena(const EventArena&);
+  EventArena& operator=(const EventArena&);
+public:
+  EventArena(size_t blockSize_=ARENA_BLOCK_BYTES, bool hugePages_=false);
+  ~EventArena();
+  //bytes aligned to align, a power of two; throws bad_alloc if the system is out of memory
+  void* Allocate(size_t bytes, size_t align);
+  //take back everything allocated, the blocks stay mapped for the next event
+  void Reset(){current=0; used=0;}
+  //number of times the arena asked the system for memory, flat once the arena is warm
+  size_t GetSystemAllocations() const{return systemAllocations;}
+  //bytes mapped over all blocks
+  size_t GetCapacity() const;
+};
+
+/**
+ * Standard allocator drawing from an EventArena, for containers that live within one event.
+ * Deallocation does nothing; the memory comes back when the arena is reset, so a container
+ * using it must be gone or cleared by then.
+ * Type T is the element type.
+ */
+template<typename T>
+class ArenaAllocator
+{
+private:
+  EventArena* arena;
+  template<typename U> friend class ArenaAllocator;
+public:
+  typedef T value_type;
+  template<typename U> struct rebind{typedef ArenaAllocator<U> other;};
+  explicit ArenaAllocator(EventArena* arena_):arena(arena_){}
+  template<typename U> ArenaAllocator(const ArenaAllocator<U>& other):arena(other.arena){}
+  T* allocate(size_t n){return static_cast<T*>(arena->Allocate(n*sizeof(T),alignof(T)));}
+  void deallocate(T*, size_t){}
+  template<typename U> bool operator==(const ArenaAllocator<U>& other) const{return arena==other.arena;}
+  template<typename U> bool operator!=(const ArenaAllocator<U>& other) const{return arena!=other.arena;}
+};
+
+EventArena::EventArena(size_t blockSize_, bool hugePages_):
+  current(0),used(0),blockSize(blockSize_),hugePages(hugePages_),systemAllocations(0)
+{
+  AddBlock(blockSize);
+}
+
+EventArena::~EventArena(){
+  for(size_t i=0;i<blocks.size();++i) munmap(blocks[i].data,blocks[i].size);
+}
+
+void EventArena::AddBlock(size_t minSize){
+  size_t size=max(blockSize,minSize);
+  void* m=MAP_FAILED;
+  if(hugePages){
+    size_t huge=(size+ARENA_HUGE_PAGE_BYTES-1)/ARENA_HUGE_PAGE_BYTES*ARENA_HUGE_PAGE_BYTES;
+    m=mmap(nullptr,huge,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB,-1,0);
+    if(m!=MAP_FAILED) size=huge;
+  }
+  //no huge pages reserved, or none asked for
+  if(m==MAP_FAILED) m=mmap(nullptr,size,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+  if(m==MAP_FAILED) throw bad_alloc();
+  Block b;
+  b.data=static_cast<char*>(m);
+  b.size=size;
+  blocks.push_back(b);
+  ++systemAllocations;
+}
+
+void* EventArena::Allocate(size_t bytes, size_t align){
+  for(;;){
+    const Block& b=blocks[current];
+    size_t start=(used+align-1)&~(align-1);
+    if(start+bytes<=b.size){
+      used=start+bytes;
+      return b.data+start;
+    }
+    //move on to the next block, mapping one if this event has gone past every block so far
+    if(current+1==blocks.size()) AddBlock(bytes+align);
+    ++current;
+    used=0;
+  }
+}
+
+size_t EventArena::GetCapacity() const{
+  size_t total=0;
+  for(size_t i=0;i<blocks.size();++i) total+=blocks[i].size;
+  return total;
+}
+
+#endif
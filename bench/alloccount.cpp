@@ -0,0 +1,94 @@
+/*
+count the calls to the global heap per event on each path of main.cpp once the services are warm
+author: Gaoxian Song
+*/
+#include <iostream>
+#include <cstdlib>
+#include <new>
+#include "benchpaths.hpp"
+
+using namespace std;
+
+//heap calls seen while counting is on, every operator new and delete of the program goes through these
+static bool counting=false;
+static long allocations=0;
+static long frees=0;
+
+void* operator new(size_t size){
+  if(counting) ++allocations;
+  void* p=malloc(size?size:1);
+  if(!p) throw bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept{
+  if(counting && p) ++frees;
+  free(p);
+}
+
+void* operator new[](size_t size){return operator new(size);}
+void operator delete[](void* p) noexcept{operator delete(p);}
+void operator delete(void* p, size_t) noexcept{operator delete(p);}
+void operator delete[](void* p, size_t) noexcept{operator delete(p);}
+
+//heap calls a warm path may make per event on average: the historical logs rotate to a new segment
+//every megabyte, which names, opens and indexes the segment on the heap, and nothing else should
+const double ALLOWED_PER_EVENT=0.01;
+
+//run events warm and then counted through one path, the message is built before counting starts;
+//false if the path allocates more than ALLOWED_PER_EVENT
+template<typename Path, typename Make>
+bool Count(const char* name, Path& path, const BondReferenceDataService& refData, Make make, int warm, int events){
+  for(int i=0;i<warm;++i){
+    auto m=make(refData,i);
+    path.OnMessage(std::move(m));
+  }
+  long a=0, f=0, most=0;
+  for(int i=warm;i<warm+events;++i){
+    auto m=make(refData,i);
+    allocations=0; frees=0;
+    counting=true;
+    path.OnMessage(std::move(m));
+    counting=false;
+    a+=allocations; f+=frees;
+    most=max(most,allocations);
+  }
+  bool flat=double(a)/events<=ALLOWED_PER_EVENT;
+  cout<<name<<": "<<double(a)/events<<" allocations and "<<double(f)/events<<" frees per event, at most "<<most<<" in one"
+      <<(flat?"":" FAILED")<<"\n";
+  return flat;
+}
+
+//the trade and price paths take an lvalue, give them one
+template<typename Path>
+struct LvalueFeed
+{
+  Path& path;
+  template<typename V> void OnMessage(V&& data){path.OnMessage(data);}
+};
+
+int main(int argc, char* argv[]){
+  //run from the repository root; the services' files go to the directory given, or a new one under /tmp
+  BondReferenceDataService refData(ReadBenchBonds("./Input/bonds.txt"),date(2016,Dec,1));
+  if(refData.Size()==0){cerr<<"no bonds in ./Input/bonds.txt, run from the repository root\n"; return 1;}
+  string dir=EnterBenchDirectory(argc>1?argv[1]:nullptr);
+  //warm past the first trade spill so the trade store has every buffer it reuses
+  const int warm=1<<17, events=10000;
+  bool flat=true;
+  {
+    BenchTradePath trades(refData,true);
+    LvalueFeed<BenchTradePath> feed={trades};
+    flat&=Count("trade",feed,refData,MakeBenchTrade,warm,events);
+  }
+  {
+    BenchPricePath prices(true);
+    LvalueFeed<BenchPricePath> feed={prices};
+    flat&=Count("price",feed,refData,MakeBenchPrice,warm,events);
+  }
+  {
+    BenchMarketDataPath books;
+    flat&=Count("market data",books,refData,MakeBenchBook,warm,events);
+  }
+  cout<<"service output in "<<dir<<"\n";
+  return flat?0:1;
+}
@@ -0,0 +1,204 @@
+/*
+implement the trade, price and market data paths of main.cpp for the benchmarks and harnesses in bench/
+author: Gaoxian Song
+*/
+#ifndef BenchPaths_HPP
+#define BenchPaths_HPP
+
+#include <iostream>
+#include <fstream>
+#include <memory>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../tradebookingservice.hpp"
+#include "../positionservice.hpp"
+#include "../pricingservice.hpp"
+#include "../riskservice.hpp"
+#include "../bondanalytics.hpp"
+#include "../marketdataservice.hpp"
+#include "../executionservice.hpp"
+#include "../streamingservice.hpp"
+#include "../historicaldataposition.hpp"
+#include "../historicaldatarisk.hpp"
+#include "../historicalexecutionservice.hpp"
+#include "../historicalstreamingservice.hpp"
+#include "../bondpipelines.hpp"
+
+using namespace std;
+
+/**
+ * Each path holds the services and listeners main.cpp puts on it, wired the same way, and takes
+ * events as built messages rather than input lines so a harness can time or count the services
+ * alone. Services main.cpp hangs off a path for other purposes (limits, pnl, rfq, curve) are left out.
+ * The services write their files under ./Output as in main.cpp, so a harness moves into a scratch
+ * directory with EnterBenchDirectory before building a path.
+ */
+
+//bond universe of a bonds.txt, read the way main.cpp reads Input/bonds.txt
+map<string, Bond> ReadBenchBonds(const string& path);
+
+//move into dir, or a new directory under /tmp if dir is null, after creating the Output tree the services write to
+string EnterBenchDirectory(const char* dir);
+
+//trade booking -> positions -> risk and historical positions, with risk's historical listeners
+class BenchTradePath
+{
+private:
+  BondAnalyticsEngine analytics;
+  map<string, double> pv01;
+  BucketedSectorRegistry sectors;
+  BondRiskService risk;
+  BondRiskHistoricalConnector riskConnector;
+  BondRiskHistoricalData riskData;
+  BondRiskRecordListener riskRecord;
+  PV01<Bond> pv01Seed;
+  BondPV01HistoricalListener pv01Listener;
+  BondSectorsRiskListener sectorListener;
+  BondPositionHistoricalConnector positionConnector;
+  BondPositionHistoricalData positionData;
+  BondPositionHistoricalListener positionHistory;
+  BondPositionServiceListener positionRisk;
+  BondPositionService positions;
+  BondTradeBookService trades;
+  unique_ptr<ServiceListener<Trade<Bond> > > tradeListener;
+public:
+  //staticPipeline wires trades to positions through bondpipelines.hpp, as main.cpp does with staticPipelines set
+  BenchTradePath(BondReferenceDataService& refData, bool staticPipeline);
+  void OnMessage(Trade<Bond>& trade){trades.OnMessage(trade);}
+  //rotation of the historical logs, main.cpp sets the same policy on every log
+  void SetRotationPolicy(const SegmentRotationPolicy& policy){
+    riskConnector.SetRotationPolicy(policy);
+    positionConnector.SetRotationPolicy(policy);
+  }
+};
+
+//price -> algo stream -> price stream -> historical price streams
+class BenchPricePath
+{
+private:
+  BondAlgoStreamingService algoStreams;
+  BondStreamingService streams;
+  BondStreamHistoricalConnector streamConnector;
+  BondStreamHistoricalData streamData;
+  BondStreamHistoricalListener streamHistory;
+  BondAlgoStreamListener algoStreamListener;
+  BondPriceService prices;
+  unique_ptr<ServiceListener<Price<Bond> > > priceListener;
+public:
+  //staticPipeline wires prices to streams through bondpipelines.hpp, as main.cpp does with staticPipelines set
+  explicit BenchPricePath(bool staticPipeline);
+  void OnMessage(Price<Bond>& price){prices.OnMessage(price);}
+  void SetRotationPolicy(const SegmentRotationPolicy& policy){streamConnector.SetRotationPolicy(policy);}
+};
+
+//market data -> algo execution -> execution and historical executions
+class BenchMarketDataPath
+{
+private:
+  BondExecutionService executions;
+  BondExecutionHistoricalConnector executionConnector;
+  BondExecutionHistoricalData executionData;
+  BondExecutionHistoricalListener executionHistory;
+  BondAlgoExecutionListener algoListener;
+  BondAlgoExecutionService algoExecutions;
+  BondMarketDataListeners bookListener;
+  BondMarketDataService books;
+public:
+  BenchMarketDataPath();
+  void OnMessage(OrderBook<Bond>&& book){books.OnMessage(std::move(book));}
+};
+
+//the i-th event of each feed, cycling through the bonds of refData; every trade has a new id
+Trade<Bond> MakeBenchTrade(const BondReferenceDataService& refData, int i);
+Price<Bond> MakeBenchPrice(const BondReferenceDataService& refData, int i);
+OrderBook<Bond> MakeBenchBook(const BondReferenceDataService& refData, int i);
+
+map<string, Bond> ReadBenchBonds(const string& path){
+  map<string, Bond> m_bond;
+  ifstream file(path.c_str());
+  string line;
+  getline(file,line);//header line
+  while(getline(file,line)){
+    vector<string> bondlines;
+    boost::split(bondlines,line,boost::is_any_of(","));
+    date maturity(from_simple_string(bondlines[3]));
+    Bond thebond(bondlines[0],CUSIP,bondlines[2],stof(bondlines[1],nullptr),maturity);
+    m_bond.insert(make_pair(bondlines[0],thebond));
+  }
+  return m_bond;
+}
+
+string EnterBenchDirectory(const char* dir){
+  string path;
+  if(dir) path=dir;
+  else{
+    char scratch[]="/tmp/soa-bench-XXXXXX";
+    if(!mkdtemp(scratch)){cerr<<"cannot create a scratch directory\n"; exit(1);}
+    path=scratch;
+  }
+  mkdir(path.c_str(),0755);
+  mkdir((path+"/Output").c_str(),0755);
+  mkdir((path+"/Output/Historical").c_str(),0755);
+  if(chdir(path.c_str())!=0){cerr<<"cannot enter "<<path<<"\n"; exit(1);}
+  return path;
+}
+
+BenchTradePath::BenchTradePath(BondReferenceDataService& refData, bool staticPipeline):
+  analytics(refData),pv01(analytics.GetPV01Map()),sectors(refData),risk(pv01,refData,sectors),
+  riskData(riskConnector),riskRecord(riskData),pv01Seed(refData.GetHandle(0),0,0),pv01Listener(pv01Seed),
+  sectorListener(pv01Listener,riskRecord),positionData(positionConnector),positionHistory(positionData),
+  positionRisk(risk),trades(refData,"./Output/trades.spill")
+{
+  risk.AddListener(&pv01Listener);
+  risk.AddListener(&sectorListener);
+  if(staticPipeline) tradeListener.reset(MakeTradePipeline(positions,positionRisk,positionHistory));
+  else{
+    positions.AddListener(&positionRisk);
+    positions.AddListener(&positionHistory);
+    tradeListener.reset(new BondTradeListener(positions));
+  }
+  trades.AddListener(tradeListener.get());
+}
+
+BenchPricePath::BenchPricePath(bool staticPipeline):
+  streamData(streamConnector),streamHistory(streamData),algoStreamListener(streams)
+{
+  if(staticPipeline) priceListener.reset(MakePricePipeline(algoStreams,streams,streamHistory));
+  else{
+    streams.AddListener(&streamHistory);
+    algoStreams.AddListener(&algoStreamListener);
+    priceListener.reset(new BondPriceListener(algoStreams));
+  }
+  prices.AddListener(priceListener.get());
+}
+
+BenchMarketDataPath::BenchMarketDataPath():
+  executionData(executionConnector),executionHistory(executionData),algoListener(executions),bookListener(algoExecutions)
+{
+  executions.AddListener(&executionHistory);
+  algoExecutions.AddListener(&algoListener);
+  books.AddListener(&bookListener);
+}
+
+Trade<Bond> MakeBenchTrade(const BondReferenceDataService& refData, int i){
+  const char* books[]={"TRSY1","TRSY2","TRSY3"};
+  return Trade<Bond>(refData.GetHandle(i%refData.Size()),"BT"+to_string(i),books[i%3],1000000*(1+i%5),i%2?SELL:BUY);
+}
+
+Price<Bond> MakeBenchPrice(const BondReferenceDataService& refData, int i){
+  return Price<Bond>(refData.GetHandle(i%refData.Size()),99.0+(i%256)/256.0,(1+i%4)/128.0);
+}
+
+OrderBook<Bond> MakeBenchBook(const BondReferenceDataService& refData, int i){
+  //five levels a side around a mid that moves with i, sizes growing away from the top as in marketdata.txt
+  double mid=99.0+(i%256)/256.0, spread=(1+i%4)/128.0;
+  vector<Order> bids, offers;
+  for(int level=0;level<5;++level){
+    bids.push_back(Order(mid-spread/2-level/256.0,10000000*(level+1),BID));
+    offers.push_back(Order(mid+spread/2+level/256.0,10000000*(level+1),OFFER));
+  }
+  return OrderBook<Bond>(refData.GetHandle(i%refData.Size()),bids,offers);
+}
+
+#endif
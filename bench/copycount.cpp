@@ -0,0 +1,127 @@
+/*
+pin the number of times a message is built from another or copied along each path of main.cpp
+author: Gaoxian Song
+*/
+#include <iostream>
+#include "../products.hpp"
+#include "../producthandle.hpp"
+
+using namespace std;
+
+/**
+ * Every message holds its bond through a ProductHandle, so this counting handle sees each message
+ * carrying a bond that is built from another message's handle or copied whole; building a message
+ * from reference data takes the handle by pointer and is not counted.
+ * It replaces the registry handle for Bond in this program only and must come before any service header.
+ */
+template<>
+class ProductHandle<Bond>
+{
+private:
+  const Bond* product;
+public:
+  static long copies;//handles taken from another handle, by copy construction or assignment
+  static long moves;//the same by move
+  ProductHandle(const Bond& _product):product(ProductRegistry<Bond>::Intern(_product)){}
+  explicit ProductHandle(const Bond* shared):product(shared){}
+  ProductHandle(const ProductHandle& other):product(other.product){++copies;}
+  ProductHandle(ProductHandle&& other):product(other.product){++moves;}
+  ProductHandle& operator=(const ProductHandle& other){product=other.product; ++copies; return *this;}
+  ProductHandle& operator=(ProductHandle&& other){product=other.product; ++moves; return *this;}
+  const Bond& Get() const{return *product;}
+};
+
+long ProductHandle<Bond>::copies=0;
+long ProductHandle<Bond>::moves=0;
+
+#include "benchpaths.hpp"
+
+//copies and moves per event once every bond has been through the path, pinned from the current services;
+//a change that adds a copy fails the run, a change that removes one should lower the pin
+struct PinnedCounts
+{
+  const char* path;
+  long copies;
+  long moves;
+};
+
+//trade: the pv01 kept by the historical pv01 listener and the one in the risk record it writes
+//price: the price cache, the price stream built, and the algo stream and price stream caches; the stream moves into its algo stream
+//market data: the execution order built and the execution cache; the order moves into its algo execution and that into the algo cache
+const PinnedCounts PINNED[]={
+  {"trade, static pipeline",2,0},
+  {"trade, registered listeners",2,0},
+  {"price, static pipeline",4,1},
+  {"price, registered listeners",4,1},
+  {"market data",2,2},
+};
+
+//run events warm and then counted through one path, the message is built before counting starts;
+//false if any counted event differs from the pin
+template<typename Path, typename Make>
+bool Check(const PinnedCounts& pin, Path& path, const BondReferenceDataService& refData, Make make, int events){
+  int warm=refData.Size()*2;
+  for(int i=0;i<warm;++i){
+    auto m=make(refData,i);
+    path.OnMessage(std::move(m));
+  }
+  bool same=true;
+  long copies=0, moves=0;
+  for(int i=warm;i<warm+events;++i){
+    auto m=make(refData,i);
+    ProductHandle<Bond>::copies=0;
+    ProductHandle<Bond>::moves=0;
+    path.OnMessage(std::move(m));
+    if(i==warm){copies=ProductHandle<Bond>::copies; moves=ProductHandle<Bond>::moves;}
+    else if(copies!=ProductHandle<Bond>::copies || moves!=ProductHandle<Bond>::moves) same=false;
+  }
+  bool pinned=same && copies==pin.copies && moves==pin.moves;
+  cout<<pin.path<<": "<<copies<<" copies, "<<moves<<" moves per event";
+  if(!same) cout<<" on the first event, later events differ";
+  if(!pinned) cout<<" (pinned "<<pin.copies<<" copies, "<<pin.moves<<" moves)";
+  cout<<(pinned?"":" FAILED")<<"\n";
+  return pinned;
+}
+
+//the trade and price paths take an lvalue, give them one
+template<typename Path>
+struct LvalueFeed
+{
+  Path& path;
+  template<typename V> void OnMessage(V&& data){path.OnMessage(data);}
+};
+
+int main(int argc, char* argv[]){
+  //run from the repository root; the services' files go to the directory given, or a new one under /tmp
+  BondReferenceDataService refData(ReadBenchBonds("./Input/bonds.txt"),date(2016,Dec,1));
+  if(refData.Size()==0){cerr<<"no bonds in ./Input/bonds.txt, run from the repository root\n"; return 1;}
+  string dir=EnterBenchDirectory(argc>1?argv[1]:nullptr);
+  const int events=1000;
+  bool pinned=true;
+  {
+    BenchTradePath trades(refData,true);
+    LvalueFeed<BenchTradePath> feed={trades};
+    pinned&=Check(PINNED[0],feed,refData,MakeBenchTrade,events);
+  }
+  {
+    BenchTradePath trades(refData,false);
+    LvalueFeed<BenchTradePath> feed={trades};
+    pinned&=Check(PINNED[1],feed,refData,MakeBenchTrade,events);
+  }
+  {
+    BenchPricePath prices(true);
+    LvalueFeed<BenchPricePath> feed={prices};
+    pinned&=Check(PINNED[2],feed,refData,MakeBenchPrice,events);
+  }
+  {
+    BenchPricePath prices(false);
+    LvalueFeed<BenchPricePath> feed={prices};
+    pinned&=Check(PINNED[3],feed,refData,MakeBenchPrice,events);
+  }
+  {
+    BenchMarketDataPath books;
+    pinned&=Check(PINNED[4],books,refData,MakeBenchBook,events);
+  }
+  cout<<"service output in "<<dir<<"\n";
+  return pinned?0:1;
+}
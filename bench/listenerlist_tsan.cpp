@@ -0,0 +1,67 @@
+/*
+check listener lists under ThreadSanitizer: dispatch on several threads while taps are added and removed
+author: Gaoxian Song
+*/
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include "../listenerlist.hpp"
+
+using namespace std;
+
+//a listener that counts its calls, safe to call from any thread
+class CountingTap: public ServiceListener<int>
+{
+public:
+  atomic<long> calls;
+  CountingTap():calls(0){}
+  virtual void ProcessAdd(int &data){calls.fetch_add(1,memory_order_relaxed);}
+  virtual void ProcessRemove(int &data){calls.fetch_add(1,memory_order_relaxed);}
+  virtual void ProcessUpdate(int &data){calls.fetch_add(1,memory_order_relaxed);}
+};
+
+int main(){
+  const int dispatchers=4, dispatches=200000, changes=20000;
+  ListenerList<int> list;
+  CountingTap recorder, taps[4];
+  list.Add(&recorder);//registered throughout, so it sees every dispatch
+  vector<thread> threads;
+  for(int t=0;t<dispatchers;++t){
+    threads.push_back(thread([&list,t](){
+      int data=t;
+      for(int i=0;i<dispatches;++i){
+        if(i%3==0) list.ProcessAdd(data);
+        else if(i%3==1) list.ProcessUpdate(data);
+        else{
+          //several calls per listener through one held snapshot, as the trade book amends a trade
+          ListenerList<int>::Reader reader(list);
+          const vector<ServiceListener<int>*>& listeners=reader.Get();
+          for(size_t l=0;l<listeners.size();++l){
+            listeners[l]->ProcessRemove(data);
+            listeners[l]->ProcessAdd(data);
+          }
+        }
+      }
+    }));
+  }
+  //attach and detach taps while the dispatchers run, as a debugging tap would be at run time
+  size_t peakRetired=0;
+  thread writer([&](){
+    for(int i=0;i<changes;++i){
+      CountingTap* tap=&taps[i%4];
+      if(!list.Remove(tap)) list.Add(tap);
+      peakRetired=max(peakRetired,list.GetRetiredCount());
+    }
+  });
+  for(size_t t=0;t<threads.size();++t) threads[t].join();
+  writer.join();
+  //with every dispatcher gone the next change frees whatever they kept retired
+  list.Add(&taps[0]);
+  list.Remove(&taps[0]);
+  size_t retired=list.GetRetiredCount();
+  long expected=long(dispatchers)*(dispatches/3*4+(dispatches%3>0)+(dispatches%3>1));
+  cout<<"recorder calls "<<recorder.calls<<" of "<<expected<<", "<<changes<<" listener changes, at most "
+      <<peakRetired<<" retired vectors at once, "<<retired<<" left\n";
+  return recorder.calls==expected && retired==0?0:1;
+}
@@ -0,0 +1,87 @@
+/*
+benchmark the trade and price paths wired at compile time against the same paths wired through registered listeners
+author: Gaoxian Song
+*/
+#include <iostream>
+#include <chrono>
+#include <cstdint>
+#include "benchpaths.hpp"
+
+using namespace std;
+
+//time events through one path after warming it, in ns per event; the message is built inside the
+//timed loop the same way for both wirings, so the difference between them is the dispatch.
+//Events are timed in batches and the fastest batch counts, which leaves out batches another process,
+//a trade spill or a log rotation landed in
+template<typename Path, typename Make>
+double Time(Path& path, const BondReferenceDataService& refData, Make make, int warm, int events){
+  const int batch=1000;
+  for(int i=0;i<warm;++i){
+    auto m=make(refData,i);
+    path.OnMessage(m);
+  }
+  double best=0;
+  for(int b=warm;b<warm+events;b+=batch){
+    chrono::steady_clock::time_point start=chrono::steady_clock::now();
+    for(int i=b;i<b+batch;++i){
+      auto m=make(refData,i);
+      path.OnMessage(m);
+    }
+    double ns=chrono::duration<double, nano>(chrono::steady_clock::now()-start).count()/batch;
+    if(b==warm || ns<best) best=ns;
+  }
+  return best;
+}
+
+//best of rounds for each wiring, alternating between them so both see the same machine
+template<typename Path, typename Make>
+void Compare(const char* name, BondReferenceDataService& refData, Make make, const SegmentRotationPolicy& rotation, int rounds, int events){
+  double best[2]={0,0};
+  for(int r=0;r<rounds;++r){
+    for(int wiring=0;wiring<2;++wiring){
+      Path path(refData,wiring==0);
+      path.SetRotationPolicy(rotation);
+      double ns=Time(path,refData,make,refData.Size()*2,events);
+      if(r==0 || ns<best[wiring]) best[wiring]=ns;
+    }
+  }
+  cout<<name<<": static pipeline "<<best[0]<<" ns/event, registered listeners "<<best[1]<<" ns/event, "
+      <<(best[1]-best[0])<<" ns/event gained\n";
+}
+
+//the price path takes no reference data, give it the trade path's constructor
+struct BenchPricePathOf: BenchPricePath
+{
+  BenchPricePathOf(BondReferenceDataService&, bool staticPipeline):BenchPricePath(staticPipeline){}
+};
+
+//move into a directory of its own where the historical logs and price streams are written to /dev/null,
+//so a run times the services rather than the disk; the trade store still spills to a file
+void EnterDiscardDirectory(){
+  EnterBenchDirectory("discard");
+  const char* files[]={"Output/Historical/position.txt","Output/Historical/risk.txt","Output/Historical/streaming.txt","Output/PriceStreams.txt"};
+  for(size_t i=0;i<sizeof(files)/sizeof(files[0]);++i){
+    if(symlink("/dev/null",files[i])!=0){cerr<<"cannot link "<<files[i]<<" to /dev/null\n"; exit(1);}
+  }
+}
+
+int main(int argc, char* argv[]){
+  //run from the repository root; the services' files go to the directory given, or a new one under /tmp
+  BondReferenceDataService refData(ReadBenchBonds("./Input/bonds.txt"),date(2016,Dec,1));
+  if(refData.Size()==0){cerr<<"no bonds in ./Input/bonds.txt, run from the repository root\n"; return 1;}
+  string dir=EnterBenchDirectory(argc>1?argv[1]:nullptr);
+  const int rounds=9, events=100000;
+  //as main.cpp runs, the historical logs rotating every megabyte
+  SegmentRotationPolicy rotation(1<<20, 24*3600);
+  cout<<"writing the historical logs\n";
+  Compare<BenchTradePath>("trade",refData,MakeBenchTrade,rotation,rounds,events);
+  Compare<BenchPricePathOf>("price",refData,MakeBenchPrice,rotation,rounds,events);
+  //the same events with the logs going to /dev/null, never rotated since nothing reaches a segment
+  EnterDiscardDirectory();
+  SegmentRotationPolicy never(SIZE_MAX, 0);
+  cout<<"historical logs to /dev/null\n";
+  Compare<BenchTradePath>("trade",refData,MakeBenchTrade,never,rounds,events);
+  Compare<BenchPricePathOf>("price",refData,MakeBenchPrice,never,rounds,events);
+  cout<<"service output in "<<dir<<"\n";
+  return 0;
+}
@@ -0,0 +1,123 @@
+/*
+benchmark the compile-time csv and binary record formatters against the hand-rolled formatting they replaced
+author: Gaoxian Song
+*/
+#include <iostream>
+#include <sstream>
+#include <chrono>
+#include "../recordformat.hpp"
+
+using namespace std;
+
+//position record the way the historical position connector formatted it before recordformat.hpp,
+//into a stream rather than a file so both sides measure formatting only
+void HandRolled(ostream& file, const string& k, const Position<Bond>& data){
+  file<<k<<",";
+  Position<Bond> pos=data;
+  Bond bnd=pos.GetProduct();
+  string bondid=bnd.GetProductId();
+  file<<bondid<<",";
+  long aqty=pos.GetAggregatePosition();
+  file<<to_string(aqty)<<",";
+  string book="TRSY1";
+  long q1=pos.GetPosition(book);
+  file<<to_string(q1)<<",";
+  book="TRSY2";
+  long q2=pos.GetPosition(book);
+  file<<to_string(q2)<<",";
+  book="TRSY3";
+  long q3=pos.GetPosition(book);
+  file<<to_string(q3)<<"\n";
+}
+
+//write records of every kind the formatters describe into one binary buffer, read them back in order
+//against the records they came from, and check a record that differs in one field does not read back
+bool BinaryRoundTrip(const Bond& bnd, const Position<Bond>& pos){
+  ExecutionOrder<Bond> order(bnd,BID,"AlgoExe12",MARKET,99.515625,1000000,2000000,"AlgoExe12",false);
+  PriceStream<Bond> stream(bnd,PriceStreamOrder(99.5,1000000,2000000,BID),PriceStreamOrder(99.53125,1000000,2000000,OFFER));
+  Inquiry<Bond> inquiry("INQ104",bnd,SELL,3000000,100.0078125,QUOTED);
+  ListInquiry<Bond> list("L7",DONE);
+  list.AddLeg(bnd,BUY,1000000);
+  list.AddLeg(bnd,SELL,2000000);
+  vector<double> prices;
+  prices.push_back(99.25);
+  prices.push_back(99.2578125);
+  list.SetPrices(prices);
+  RecordBuffer buffer(64);//small, so the buffer also grows on the way
+  WriteRecord<BinaryRecordWriter>(buffer,"1",pos);
+  WriteRecord<BinaryRecordWriter>(buffer,"2",order);
+  WriteRecord<BinaryRecordWriter>(buffer,"3",stream);
+  WriteRecord<BinaryRecordWriter>(buffer,"4",inquiry);
+  WriteRecord<BinaryRecordWriter>(buffer,"5",list);
+  BinaryRecordReader r(buffer.Data(),buffer.Size());
+  if(!ReadRecord(r,"1",pos) || !ReadRecord(r,"2",order) || !ReadRecord(r,"3",stream) || !ReadRecord(r,"4",inquiry) || !ReadRecord(r,"5",list) || !r.AtEnd()){
+    cout<<"binary records do not read back\n";
+    return false;
+  }
+  Inquiry<Bond> other("INQ104",bnd,SELL,3000000,100.0078125,DONE);
+  BinaryRecordReader wrong(buffer.Data(),buffer.Size());
+  ReadRecord(wrong,"1",pos); ReadRecord(wrong,"2",order); ReadRecord(wrong,"3",stream);
+  if(ReadRecord(wrong,"4",other)){
+    cout<<"binary record of a different inquiry reads back\n";
+    return false;
+  }
+  BinaryRecordReader cut(buffer.Data(),buffer.Size()-1);
+  ReadRecord(cut,"1",pos); ReadRecord(cut,"2",order); ReadRecord(cut,"3",stream); ReadRecord(cut,"4",inquiry);
+  if(ReadRecord(cut,"5",list)){
+    cout<<"truncated binary record reads back\n";
+    return false;
+  }
+  cout<<"binary round trip of 5 record kinds: "<<buffer.Size()<<" bytes\n";
+  return true;
+}
+
+int main(){
+  const int records=1000000;
+  Bond bnd("912828U24",CUSIP,"T",1.75,date(2021,Nov,30));
+  Position<Bond> pos(bnd);
+  pos.AddToPosition(1500000,"TRSY1");
+  pos.AddToPosition(-700000,"TRSY2");
+  pos.AddToPosition(2300000,"TRSY3");
+  vector<string> keys;
+  for(int i=0;i<1000;++i) keys.push_back(to_string(i+1));
+
+  //both formatters must produce the same text
+  ostringstream check;
+  HandRolled(check,keys[7],pos);
+  RecordBuffer buffer;
+  WriteRecord<CsvRecordWriter>(buffer,keys[7],pos);
+  if(check.str()!=string(buffer.Data(),buffer.Size())){
+    cout<<"formatters disagree:\n"<<check.str()<<string(buffer.Data(),buffer.Size());
+    return 1;
+  }
+  if(!BinaryRoundTrip(bnd,pos)) return 1;
+
+  size_t bytes=0;
+  chrono::steady_clock::time_point t0=chrono::steady_clock::now();
+  for(int i=0;i<records;++i){
+    ostringstream out;
+    HandRolled(out,keys[i%keys.size()],pos);
+    bytes+=out.tellp();
+  }
+  chrono::steady_clock::time_point t1=chrono::steady_clock::now();
+  for(int i=0;i<records;++i){
+    buffer.Reset();
+    WriteRecord<CsvRecordWriter>(buffer,keys[i%keys.size()],pos);
+    bytes+=buffer.Size();
+  }
+  chrono::steady_clock::time_point t2=chrono::steady_clock::now();
+  for(int i=0;i<records;++i){
+    buffer.Reset();
+    WriteRecord<BinaryRecordWriter>(buffer,keys[i%keys.size()],pos);
+    bytes+=buffer.Size();
+  }
+  chrono::steady_clock::time_point t3=chrono::steady_clock::now();
+  double hand=chrono::duration<double,nano>(t1-t0).count()/records;
+  double csv=chrono::duration<double,nano>(t2-t1).count()/records;
+  double binary=chrono::duration<double,nano>(t3-t2).count()/records;
+  cout<<"position record, "<<records<<" records per formatter, "<<bytes<<" bytes over all three\n";
+  cout<<"hand-rolled ostream and to_string: "<<hand<<" ns/record\n";
+  cout<<"CsvRecordWriter into RecordBuffer: "<<csv<<" ns/record\n";
+  cout<<"BinaryRecordWriter into RecordBuffer: "<<binary<<" ns/record\n";
+  return 0;
+}
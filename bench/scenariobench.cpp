@@ -0,0 +1,68 @@
+/*
+benchmark the standard scenario grid over a large bond universe against the number of threads
+author: Gaoxian Song
+*/
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <cstdlib>
+#include "../bondanalytics.hpp"
+#include "../scenarioengine.hpp"
+
+using namespace std;
+
+//a universe of bonds maturing every few days over thirty years, so every sector is well filled
+map<string, Bond> MakeBonds(int count){
+  map<string, Bond> m_bond;
+  date first(2017,Jan,15);
+  for(int i=0;i<count;++i){
+    ostringstream id;
+    id<<"SB"<<setw(7)<<setfill('0')<<i;
+    date maturity=first+days(i*(30*365)/count);
+    m_bond.insert(make_pair(id.str(),Bond(id.str(),CUSIP,"T",1.0f+(i%16)*0.25f,maturity)));
+  }
+  return m_bond;
+}
+
+//fastest of rounds runs of the grid on threads threads, in ms
+double Time(BondRiskService& risk, const vector<CurveShock>& scenarios, int threads, int rounds, ScenarioGrid& grid){
+  ScenarioEngine engine(risk,threads);
+  double best=0;
+  for(int r=0;r<rounds;++r){
+    chrono::steady_clock::time_point start=chrono::steady_clock::now();
+    engine.Run(scenarios,grid);
+    double ms=chrono::duration<double, milli>(chrono::steady_clock::now()-start).count();
+    if(r==0 || ms<best) best=ms;
+  }
+  return best;
+}
+
+int main(int argc, char* argv[]){
+  //bonds in the universe, every one of them with a position
+  int count=argc>1?atoi(argv[1]):10000;
+  const int rounds=10;
+  BondReferenceDataService refData(MakeBonds(count),date(2016,Dec,1));
+  BondAnalyticsEngine analytics(refData);
+  map<string, double> pv01=analytics.GetPV01Map();
+  BucketedSectorRegistry sectors(refData);
+  BondRiskService risk(pv01,refData,sectors);
+  for(int d=0;d<refData.Size();++d){
+    Position<Bond> pos(refData.GetHandle(d));
+    pos.AddToPosition(1000000*((d%7)-3),"TRSY1");
+    risk.AddPosition(pos);
+  }
+  vector<CurveShock> scenarios=ScenarioEngine::StandardScenarios();
+  int cores=thread::hardware_concurrency();
+  cout<<scenarios.size()<<" scenarios over "<<refData.Size()<<" bonds, "<<cores<<" cores\n";
+  ScenarioGrid serial, parallel;
+  double one=Time(risk,scenarios,1,rounds,serial);
+  cout<<"1 thread: "<<one<<" ms\n";
+  for(int threads=2;threads<=max(cores,2)*2;threads*=2){
+    double ms=Time(risk,scenarios,threads,rounds,parallel);
+    bool same=parallel.total==serial.total && parallel.sectorPnL==serial.sectorPnL && parallel.bondPnL==serial.bondPnL;
+    cout<<threads<<" threads: "<<ms<<" ms, "<<one/ms<<"x"<<(same?"":", grid differs from 1 thread")<<"\n";
+    if(!same) return 1;
+  }
+  return 0;
+}
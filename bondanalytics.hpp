@@ -0,0 +1,295 @@
+/*
+implement bond analytics: yield, modified duration and pv01 from price
+author: Gaoxian Song
+*/
+#ifndef BondAnalytics_HPP
+#define BondAnalytics_HPP
+
+#include <vector>
+#include <map>
+#include <cmath>
+#include <stdint.h>
+#include "referencedataservice.hpp"
+#include "pricingservice.hpp"
+#include "riskservice.hpp"
+
+using namespace std;
+
+//most newton steps taken when solving for yield
+const int YIELD_ITERATIONS=12;
+//price error per 100 face below which the yield counts as solved
+const double YIELD_TOLERANCE=1e-10;
+//lowest yield the solver goes to; at -2 the semi-annual discount factor blows up and log1p gives NaN
+const double YIELD_FLOOR=-1.99;
+//yield bump used for the numerical price derivative
+const double YIELD_BUMP=1e-6;
+
+//bonds solved together by the analytics kernels, in GCC vector extensions: each operation on
+//BondLanes is one AVX instruction, or two SSE2 ones on a target without AVX
+const int BOND_LANES=4;
+typedef double BondLanes __attribute__((vector_size(BOND_LANES*sizeof(double))));
+typedef int64_t BondLaneMask __attribute__((vector_size(BOND_LANES*sizeof(int64_t))));//all bits set where true
+const BondLanes LANE_ZERO={0,0,0,0};
+
+//adding 1.5*2^52 to a double and taking it away rounds it to an integer, which is then the low bits of the sum;
+//integer conversions of BondLanes have no SSE2 or AVX2 instruction, so the kernels convert this way
+const double LANE_ROUND=6755399441055744.0;
+const int64_t LANE_ROUND_BITS=0x4338000000000000L;
+
+//lane kernels take and return vectors by reference, 32-byte vectors passed by value change the ABI without AVX
+//x where mask is set, y elsewhere
+inline void LaneSelect(const BondLaneMask& mask, const BondLanes& x, const BondLanes& y, BondLanes& out){
+  out=(BondLanes)(((BondLaneMask)x&mask)|((BondLaneMask)y&~mask));
+}
+inline bool LaneAny(const BondLaneMask& mask){
+  int64_t any=0;
+  for(int i=0;i<BOND_LANES;++i) any|=mask[i];
+  return any!=0;
+}
+//e^x of every lane, for |x|<700, within an ulp of exp
+inline void LaneExp(const BondLanes& x, BondLanes& out){
+  //e^x=2^k*e^r with k the nearest integer to x/ln2 and |r|<=ln2/2, ln2 split in two so r is exact
+  const double LN2_HI=6.93147180369123816490e-01, LN2_LO=1.90821492927058770002e-10;
+  BondLanes rounded=x*1.4426950408889634+LANE_ROUND;
+  BondLanes k=rounded-LANE_ROUND;
+  BondLanes r=(x-k*LN2_HI)-k*LN2_LO;
+  //taylor series to r^13, the next term is below 5e-18
+  BondLanes p=r*(1.0/6227020800)+1.0/479001600;
+  p=p*r+1.0/39916800; p=p*r+1.0/3628800; p=p*r+1.0/362880; p=p*r+1.0/40320;
+  p=p*r+1.0/5040; p=p*r+1.0/720; p=p*r+1.0/120; p=p*r+1.0/24;
+  p=p*r+1.0/6; p=p*r+0.5; p=p*r+1.0; p=p*r+1.0;
+  //2^k built in the exponent bits
+  BondLaneMask bits=((BondLaneMask)rounded-LANE_ROUND_BITS+1023)<<52;
+  out=p*(BondLanes)bits;
+}
+//log(1+x) of every lane, for x>-1, within two ulp of log1p
+inline void LaneLog1p(const BondLanes& x, BondLanes& out){
+  //u=1+x=m*2^e with m in [sqrt(1/2), sqrt(2)), log(m)=2*atanh(s) with s=(m-1)/(m+1)
+  const double LN2_HI=6.93147180369123816490e-01, LN2_LO=1.90821492927058770002e-10;
+  BondLanes u=x+1.0;
+  typedef uint64_t LaneBits __attribute__((vector_size(BOND_LANES*sizeof(uint64_t))));//shifts right without the sign
+  BondLaneMask bits=(BondLaneMask)u;
+  BondLaneMask e=(BondLaneMask)((LaneBits)bits>>52)-1023;//u is positive, so this is the whole exponent field
+  BondLanes m=(BondLanes)((bits&0x000fffffffffffffL)|0x3ff0000000000000L);
+  BondLaneMask high=m>1.4142135623730951;
+  LaneSelect(high,m*0.5,m,m);
+  e-=high;//high is -1 where set
+  BondLanes s=(m-1.0)/(m+1.0), s2=s*s;
+  //odd series of atanh to s^21, the next term is below 1e-18
+  BondLanes p=s2*(1.0/21)+1.0/19;
+  p=p*s2+1.0/17; p=p*s2+1.0/15; p=p*s2+1.0/13; p=p*s2+1.0/11;
+  p=p*s2+1.0/9; p=p*s2+1.0/7; p=p*s2+1.0/5; p=p*s2+1.0/3; p=p*s2+1.0;
+  BondLanes ed=(BondLanes)(e+LANE_ROUND_BITS)-LANE_ROUND;
+  //log(u) plus the rounding error of 1+x, so small x keeps its precision
+  out=ed*LN2_HI+(2.0*s*p+ed*LN2_LO)+(x-(u-1.0))/u;
+}
+
+/**
+ * Analytics for semi-annual coupon bonds, priced per 100 face from the reference data as-of date.
+ * Quoted prices are taken as the full price, accrued interest is not split out.
+ * State is held as structure of arrays indexed by dense product id, and bonds are solved BOND_LANES
+ * at a time in SIMD lanes over those arrays, with exp and log1p evaluated by polynomials in the lanes
+ * rather than by calls into libm. A lane that has converged or broken off is masked out while the
+ * others keep iterating. A single bond ticking runs the same kernel in one lane, so it gets exactly
+ * the analytics a batch such as RecalculateAll gives it.
+ */
+class BondAnalyticsEngine: public Snapshottable
+{
+private:
+  BondReferenceDataService& refData;
+  vector<double> coupons;//annual coupon rate, 0.02 for a 2% bond
+  vector<double> periods;//semi-annual periods to maturity, 0 once matured
+  vector<double> prices;//last price per 100 face
+  vector<double> yields;//yield to maturity, semi-annual compounding
+  vector<double> durations;//modified duration in years
+  vector<double> pv01s;//price change per 100 face for a one basis point fall in yield
+  vector<char> converged;//whether the last yield solve met YIELD_TOLERANCE
+  //price per 100 face at yield y for a bond with coupon rate c and m periods to maturity, y held at YIELD_FLOOR or above
+  static double PriceFromYield(double c, double m, double y);
+  //the same for a lane of bonds, n is ceil(m)
+  static void LanePriceFromYield(const BondLanes& c, const BondLanes& m, const BondLanes& n, const BondLanes& y, BondLanes& out);
+  //recompute analytics for the dense ids in [begin, end)
+  void Calculate(int begin, int end);
+public:
+  //load coupons and maturities from reference data, starting every bond at par
+  BondAnalyticsEngine(BondReferenceDataService& refData_);
+  //reload maturities after a date roll and recompute every bond
+  void Refresh();
+  //recompute every bond from the current prices
+  void RecalculateAll(){Calculate(0,prices.size());}
+  //take a new price for one bond and recompute it; returns its dense id, -1 if unknown
+  int OnPrice(const InlineId& productId, double price);
+  double GetYield(int denseId) const{return yields[denseId];}
+  double GetModifiedDuration(int denseId) const{return durations[denseId];}
+  double GetPV01(int denseId) const{return pv01s[denseId];}
+  //false when the yield solve ran out of steps, the analytics then hold the last newton iterate
+  bool IsConverged(int denseId) const{return converged[denseId]!=0;}
+  double GetPrice(int denseId) const{return prices[denseId];}
+  //years to maturity from the as-of date, 0 once matured
+  double GetMaturity(int denseId) const{return 0.5*periods[denseId];}
+  //price per 100 face of a bond at yield y
+  double GetPriceAtYield(int denseId, double y) const{return PriceFromYield(coupons[denseId],periods[denseId],y);}
+  //dense id of a bond in the engine, -1 if unknown
+  int GetDenseId(const InlineId& productId) const{return refData.GetDenseId(productId);}
+  //number of bonds the engine holds
+  int Size() const{return prices.size();}
+  //pv01 of every bond keyed on product id
+  map<string, double> GetPV01Map() const;
+  //checkpoint the last prices, everything else is recomputed from them
+  virtual string GetSnapshotName() const{return "analytics";}
+  virtual void SaveSnapshot(SnapshotWriter& w) const;
+  virtual void LoadSnapshot(SnapshotReader& r);
+};
+
+//listen to prices, recompute the bond and push its new pv01 into the risk service
+class BondPriceAnalyticsListener: public ServiceListener<Price<Bond> >
+{
+private:
+  BondAnalyticsEngine& engine;
+  BondRiskService& b_risk;
+public:
+  BondPriceAnalyticsListener(BondAnalyticsEngine& src1, BondRiskService& src2):engine(src1),b_risk(src2){}
+  // Listener callback to process an add event to the Service
+  virtual void ProcessAdd(Price<Bond> &data);
+
+  // Listener callback to process a remove event to the Service
+  virtual void ProcessRemove(Price<Bond> &data){}
+
+  // Listener callback to process an update event to the Service
+  virtual void ProcessUpdate(Price<Bond> &data){ProcessAdd(data);}
+};
+
+BondAnalyticsEngine::BondAnalyticsEngine(BondReferenceDataService& refData_):refData(refData_){
+  Refresh();
+}
+
+void BondAnalyticsEngine::Refresh(){
+  int n=refData.Size();
+  coupons.resize(n); periods.resize(n);
+  prices.resize(n,100.0);//bonds without a price yet are taken at par
+  yields.resize(n); durations.resize(n); pv01s.resize(n); converged.resize(n);
+  for(int d=0;d<n;++d){
+    const Bond& bnd=refData.GetBond(d);
+    coupons[d]=bnd.GetCoupon()/100.0;//coupons are quoted in percent
+    periods[d]=max(0.0,2.0*bnd.GetYearFraction());
+  }
+  RecalculateAll();
+}
+
+double BondAnalyticsEngine::PriceFromYield(double c, double m, double y){
+  //coupons fall at periods f, f+1, ..., m where n=ceil(m) and f=m-(n-1), principal at m
+  //price = v^f*(c/2*100*(1-v^n)/(1-v)+100*v^(n-1)) with v=1/(1+y/2), in closed form so there is no loop over coupons
+  y=max(y,YIELD_FLOOR);
+  double n=ceil(m);
+  double f=m-(n-1.0);
+  double lv=-log1p(0.5*y);//log of v
+  double vf=exp(f*lv), vn=exp(n*lv), vn1=exp((n-1.0)*lv);
+  double annuity=fabs(y)>1e-12?(1.0-vn)/(1.0-exp(lv)):n;//sum of v^k for k<n
+  return m>0?vf*(50.0*c*annuity+100.0*vn1):0.0;
+}
+
+void BondAnalyticsEngine::LanePriceFromYield(const BondLanes& c, const BondLanes& m, const BondLanes& n, const BondLanes& y0, BondLanes& out){
+  //the closed form of PriceFromYield, lane by lane
+  BondLanes y;
+  LaneSelect(y0<YIELD_FLOOR,LANE_ZERO+YIELD_FLOOR,y0,y);
+  BondLanes f=m-(n-1.0);
+  BondLanes lv, vf, vn;
+  LaneLog1p(0.5*y,lv);
+  lv=-lv;//log of v
+  LaneExp(f*lv,vf); LaneExp(n*lv,vn);
+  BondLanes v=1.0/(1.0+0.5*y), vn1=vn*(1.0+0.5*y);//v^(n-1) from v^n, without two more exponentials
+  BondLanes annuity;//sum of v^k for k<n
+  BondLanes absY=(BondLanes)((BondLaneMask)y&0x7fffffffffffffffL);
+  LaneSelect(absY>1e-12,(1.0-vn)/(1.0-v),n,annuity);
+  LaneSelect(m>0,vf*(50.0*c*annuity+100.0*vn1),LANE_ZERO,out);
+}
+
+void BondAnalyticsEngine::Calculate(int begin, int end){
+  for(int d0=begin;d0<end;d0+=BOND_LANES){
+    int count=min(BOND_LANES,end-d0);
+    //lanes past end are matured bonds at zero, which are done before they start
+    BondLanes c=LANE_ZERO, m=LANE_ZERO, price=LANE_ZERO;
+    for(int i=0;i<count;++i){c[i]=coupons[d0+i]; m[i]=periods[d0+i]; price[i]=prices[d0+i];}
+    BondLanes whole=(m+LANE_ROUND)-LANE_ROUND, n;
+    LaneSelect(whole<m,whole+1.0,whole,n);//ceil of m
+    //newton iterations for yield, starting from the coupon, the yield at par
+    BondLaneMask live=m>0;//matured bonds have no sensitivity and are left at zero
+    BondLaneMask done=~live, active=live;
+    BondLanes y;
+    LaneSelect(live,c,LANE_ZERO,y);
+    BondLanes p, up, down;
+    for(int it=0;it<YIELD_ITERATIONS && LaneAny(active);++it){
+      LanePriceFromYield(c,m,n,y,p);
+      BondLanes error=p-price;
+      BondLanes absError=(BondLanes)((BondLaneMask)error&0x7fffffffffffffffL);
+      BondLaneMask solved=active&(absError<YIELD_TOLERANCE);
+      done|=solved;
+      active&=~solved;
+      LanePriceFromYield(c,m,n,y+YIELD_BUMP,up);
+      LanePriceFromYield(c,m,n,y-YIELD_BUMP,down);
+      BondLanes slope=(up-down)/(2.0*YIELD_BUMP);
+      active&=(slope<0);//flat or broken derivative, keep the last iterate
+      BondLanes next=y-error/slope;
+      LaneSelect(next<YIELD_FLOOR,LANE_ZERO+YIELD_FLOOR,next,next);
+      LaneSelect(active,next,y,y);
+    }
+    LanePriceFromYield(c,m,n,y,p);
+    BondLanes absError=(BondLanes)((BondLaneMask)(p-price)&0x7fffffffffffffffL);
+    done|=absError<YIELD_TOLERANCE;
+    //duration and pv01 from the derivative at the solved yield
+    LanePriceFromYield(c,m,n,y+YIELD_BUMP,up);
+    LanePriceFromYield(c,m,n,y-YIELD_BUMP,down);
+    BondLanes slope=(up-down)/(2.0*YIELD_BUMP);
+    BondLanes duration, pv01;
+    LaneSelect(p>0,-slope/p,LANE_ZERO,duration);
+    LaneSelect(slope<0,-slope*0.0001,LANE_ZERO,pv01);
+    for(int i=0;i<count;++i){
+      yields[d0+i]=y[i];
+      converged[d0+i]=done[i]!=0;
+      durations[d0+i]=duration[i];
+      pv01s[d0+i]=pv01[i];
+    }
+  }
+}
+
+int BondAnalyticsEngine::OnPrice(const InlineId& productId, double price){
+  int d=refData.GetDenseId(productId);
+  if(d<0 || size_t(d)>=prices.size()) return -1;
+  prices[d]=price;
+  Calculate(d,d+1);
+  return d;
+}
+
+map<string, double> BondAnalyticsEngine::GetPV01Map() const{
+  map<string, double> result;
+  for(size_t d=0;d<pv01s.size();++d)
+    result.insert(make_pair(refData.GetBond(d).GetProductId(),pv01s[d]));
+  return result;
+}
+
+void BondAnalyticsEngine::SaveSnapshot(SnapshotWriter& w) const{
+  w.Put(uint32_t(prices.size()));
+  for(size_t d=0;d<prices.size();++d){
+    w.PutString(refData.GetBond(d).GetProductId());
+    w.Put(prices[d]);
+  }
+}
+
+void BondAnalyticsEngine::LoadSnapshot(SnapshotReader& r){
+  uint32_t n=r.Get<uint32_t>();
+  for(uint32_t i=0;i<n && r.IsGood();++i){
+    string pid=r.GetString();
+    double price=r.Get<double>();
+    int d=refData.GetDenseId(pid);
+    if(d>=0 && size_t(d)<prices.size()) prices[d]=price;
+  }
+  RecalculateAll();
+}
+
+void BondPriceAnalyticsListener::ProcessAdd(Price<Bond> &data){
+  const string& bondid=data.GetProduct().GetProductId();//get bond id
+  int d=engine.OnPrice(data.GetProduct().GetId(),data.GetMid());//recompute analytics from the mid
+  if(d>=0) b_risk.UpdateBondPV01(bondid,engine.GetPV01(d));//flow the new pv01 into risk
+}
+
+#endif
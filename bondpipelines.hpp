@@ -0,0 +1,45 @@
+/*
+implement the trade and price pipelines of the bond services, wired at compile time
+author: Gaoxian Song
+*/
+#ifndef BondPipelines_HPP
+#define BondPipelines_HPP
+
+#include "pipeline.hpp"
+#include "positionservice.hpp"
+#include "riskservice.hpp"
+#include "historicaldataposition.hpp"
+#include "streamingservice.hpp"
+#include "historicalstreamingservice.hpp"
+
+using namespace std;
+
+/**
+ * Each pipeline registers as one listener on the service it starts from; every hop after that is a
+ * call to a known type, so a whole path inlines. Listeners the pipelines do not cover stay
+ * registered on their services and are called after the pipeline, as before.
+ * The risk service is also fed by prices and reference data, so the trade pipeline ends at it and
+ * its historical listeners stay registered on it.
+ */
+
+//trade -> position -> risk and historical positions
+typedef StaticListeners<BondPositionServiceListener&, BondPositionHistoricalListener&> BondPositionSink;
+typedef BondTradeStaticListener<BondPositionSink> BondTradePipeline;
+
+//price -> algo stream -> price stream -> historical price streams
+typedef StaticListeners<BondStreamHistoricalListener&> BondStreamSink;
+typedef StaticListeners<BondAlgoStreamStaticListener<BondStreamSink> > BondAlgoStreamSink;
+typedef BondPriceStaticListener<BondAlgoStreamSink> BondPricePipeline;
+
+//the trade pipeline, to be added as a listener of the trade booking service
+BondTradePipeline* MakeTradePipeline(BondPositionService& positions, BondPositionServiceListener& risk, BondPositionHistoricalListener& history){
+  return new BondTradePipeline(positions,BondPositionSink(risk,history));
+}
+
+//the price pipeline, to be added as a listener of the price service
+BondPricePipeline* MakePricePipeline(BondAlgoStreamingService& algoStreams, BondStreamingService& streams, BondStreamHistoricalListener& history){
+  BondAlgoStreamStaticListener<BondStreamSink> streamHop(streams,BondStreamSink(history));
+  return new BondPricePipeline(algoStreams,BondAlgoStreamSink(streamHop));
+}
+
+#endif
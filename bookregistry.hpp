@@ -0,0 +1,54 @@
+/*
+implement interning of book names to small dense ids
+author: Gaoxian Song
+*/
+#ifndef BookRegistry_HPP
+#define BookRegistry_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <iostream>
+
+using namespace std;
+
+//most books a position can hold, positions keep one counter per book in a fixed array
+const int MAX_BOOKS=16;
+
+//process wide table of book names, ids are assigned in order of first use starting at 0
+class BookRegistry
+{
+private:
+  map<string, int> ids;
+  vector<string> names;
+  static BookRegistry& Instance(){
+    static BookRegistry registry;
+    return registry;
+  }
+public:
+  //id of a book, registering it if it is new; -1 once MAX_BOOKS books exist
+  static int Intern(const string& book){
+    BookRegistry& r=Instance();
+    map<string, int>::iterator it=r.ids.find(book);
+    if(it!=r.ids.end()) return it->second;
+    if(r.names.size()>=MAX_BOOKS){
+      cout<<"Too many books, cannot add "<<book<<"\n";
+      return -1;
+    }
+    r.ids.insert(make_pair(book,int(r.names.size())));
+    r.names.push_back(book);
+    return r.names.size()-1;
+  }
+  //id of a book, -1 if it was never used
+  static int Find(const string& book){
+    BookRegistry& r=Instance();
+    map<string, int>::const_iterator it=r.ids.find(book);
+    return it==r.ids.end()?-1:it->second;
+  }
+  //name of book id
+  static const string& Name(int id){return Instance().names[id];}
+  //number of books registered so far
+  static int Size(){return Instance().names.size();}
+};
+
+#endif
@@ -0,0 +1,242 @@
+/*
+implement yield curve service fitting a Nelson-Siegel curve to live bond yields
+author: Gaoxian Song
+*/
+#ifndef CurveService_HPP
+#define CurveService_HPP
+
+#include <vector>
+#include <cmath>
+#include "bondanalytics.hpp"
+#include "seqlock.hpp"
+
+using namespace std;
+
+//number of curve parameters solved by least squares: level, slope and curvature
+const int CURVE_FACTORS=3;
+//pull towards the previous fit, keeps the curve defined while fewer than three bonds have ticked
+const double CURVE_RIDGE=1e-4;
+
+//fitted Nelson-Siegel curve, y(t)=b0+b1*(1-e^(-t/tau))/(t/tau)+b2*((1-e^(-t/tau))/(t/tau)-e^(-t/tau))
+class NelsonSiegelCurve
+{
+public:
+  double beta[CURVE_FACTORS];
+  double tau;
+  NelsonSiegelCurve(double tau_=2.0):tau(tau_){beta[0]=beta[1]=beta[2]=0;}
+  //basis functions at maturity t, x[0] is always 1
+  static void Basis(double t, double tau, double x[CURVE_FACTORS]);
+  //yield at maturity t in years
+  double Yield(double t) const;
+};
+
+/**
+ * Par yield curve fitted to the yields the analytics engine solves from live mids.
+ * For a fixed tau the fit is linear, so the service keeps the normal equations of the
+ * least squares problem and a tick of one bond swaps that bond's row out and back in
+ * before a 3x3 solve. tau itself is searched every shapeRefitTicks ticks, starting
+ * from the current value. After each refit the curve itself, beta and tau, is published as one
+ * value through a sequence lock, so a tick costs the same however many bonds there are; readers on
+ * any thread evaluate the published curve for the bond they ask about, so every value they read
+ * comes from one whole fit rather than a mix of two.
+ */
+class BondCurveService
+{
+private:
+  BondAnalyticsEngine& engine;
+  NelsonSiegelCurve curve;
+  int shapeRefitTicks;//ticks between searches for tau, 0 to keep tau fixed
+  int ticks;//ticks since the last search for tau
+  //observations indexed by dense id
+  vector<char> observed;//whether the bond has a usable yield in the fit
+  vector<double> basis;//CURVE_FACTORS basis values per bond at the current tau
+  vector<double> observedYield;
+  //normal equations of the fit at the current tau
+  double xtx[CURVE_FACTORS][CURVE_FACTORS];
+  double xty[CURVE_FACTORS];
+  //the curve as of the last refit, written only by the fitting thread
+  SeqLocked<NelsonSiegelCurve> published;
+  //add (sign=1) or remove (sign=-1) the row of bond d in the normal equations
+  void Accumulate(int d, double sign);
+  //rebuild the basis of every bond and the normal equations for a new tau
+  void Rebuild(double newTau);
+  //solve the normal equations for beta
+  void Solve();
+  //squared fit error over the observed bonds for the current beta
+  double Residual() const;
+  //publish the current curve to readers
+  void Publish(){published.Store(curve);}
+public:
+  BondCurveService(BondAnalyticsEngine& engine_, double tau=2.0, int shapeRefitTicks_=256);
+  //take the latest yield of a bond from the analytics engine and refit incrementally
+  void OnYield(int denseId);
+  //search tau around its current value and refit from scratch
+  void FitShape();
+  //the curve as of the last refit, from any thread
+  NelsonSiegelCurve GetCurve() const{return published.Load();}
+  //fitted yield and price per 100 face of a bond, 0 for a matured bond; from any thread
+  double GetFairYield(int denseId) const;
+  double GetFairPrice(int denseId) const;
+  //number of bonds the curve prices
+  int Size() const{return observed.size();}
+};
+
+//listen to prices and feed the bond's yield into the curve
+class BondPriceCurveListener: public ServiceListener<Price<Bond> >
+{
+private:
+  BondAnalyticsEngine& engine;
+  BondCurveService& curve;
+public:
+  BondPriceCurveListener(BondAnalyticsEngine& src1, BondCurveService& src2):engine(src1),curve(src2){}
+  // Listener callback to process an add event to the Service
+  virtual void ProcessAdd(Price<Bond> &data);
+
+  // Listener callback to process a remove event to the Service
+  virtual void ProcessRemove(Price<Bond> &data){}
+
+  // Listener callback to process an update event to the Service
+  virtual void ProcessUpdate(Price<Bond> &data){ProcessAdd(data);}
+};
+
+void NelsonSiegelCurve::Basis(double t, double tau, double x[CURVE_FACTORS]){
+  double u=t/tau;
+  double e=exp(-u);
+  double f1=u>1e-8?(1.0-e)/u:1.0-0.5*u;//limit of 1 at the short end
+  x[0]=1.0;
+  x[1]=f1;
+  x[2]=f1-e;
+}
+
+double NelsonSiegelCurve::Yield(double t) const{
+  double x[CURVE_FACTORS];
+  Basis(t,tau,x);
+  return beta[0]*x[0]+beta[1]*x[1]+beta[2]*x[2];
+}
+
+BondCurveService::BondCurveService(BondAnalyticsEngine& engine_, double tau, int shapeRefitTicks_):
+  engine(engine_),curve(tau),shapeRefitTicks(shapeRefitTicks_),ticks(0),published(curve)
+{
+  int n=engine.Size();
+  observed.assign(n,0);
+  basis.assign(n*CURVE_FACTORS,0);
+  observedYield.assign(n,0);
+  //start from the yields the engine already has, bonds at par until their first price
+  for(int d=0;d<n;++d){
+    if(engine.GetMaturity(d)<=0) continue;//matured bonds carry no information about the curve
+    observed[d]=1;
+    observedYield[d]=engine.GetYield(d);
+  }
+  FitShape();
+}
+
+void BondCurveService::Accumulate(int d, double sign){
+  const double* x=&basis[d*CURVE_FACTORS];
+  for(int i=0;i<CURVE_FACTORS;++i){
+    for(int j=0;j<CURVE_FACTORS;++j) xtx[i][j]+=sign*x[i]*x[j];
+    xty[i]+=sign*x[i]*observedYield[d];
+  }
+}
+
+void BondCurveService::Rebuild(double newTau){
+  curve.tau=newTau;
+  for(int i=0;i<CURVE_FACTORS;++i){
+    xty[i]=0;
+    for(int j=0;j<CURVE_FACTORS;++j) xtx[i][j]=0;
+  }
+  for(size_t d=0;d<observed.size();++d){
+    if(!observed[d]) continue;
+    NelsonSiegelCurve::Basis(engine.GetMaturity(d),newTau,&basis[d*CURVE_FACTORS]);
+    Accumulate(d,1.0);
+  }
+}
+
+void BondCurveService::Solve(){
+  //(X'X+ridge*I)beta=X'y+ridge*previous beta, by gaussian elimination on the 3x3 system
+  double a[CURVE_FACTORS][CURVE_FACTORS+1];
+  for(int i=0;i<CURVE_FACTORS;++i){
+    for(int j=0;j<CURVE_FACTORS;++j) a[i][j]=xtx[i][j]+(i==j?CURVE_RIDGE:0);
+    a[i][CURVE_FACTORS]=xty[i]+CURVE_RIDGE*curve.beta[i];
+  }
+  for(int c=0;c<CURVE_FACTORS;++c){
+    int pivot=c;
+    for(int r=c+1;r<CURVE_FACTORS;++r) if(fabs(a[r][c])>fabs(a[pivot][c])) pivot=r;
+    for(int j=0;j<=CURVE_FACTORS;++j) swap(a[c][j],a[pivot][j]);
+    for(int r=c+1;r<CURVE_FACTORS;++r){
+      double f=a[r][c]/a[c][c];
+      for(int j=c;j<=CURVE_FACTORS;++j) a[r][j]-=f*a[c][j];
+    }
+  }
+  for(int c=CURVE_FACTORS-1;c>=0;--c){
+    double v=a[c][CURVE_FACTORS];
+    for(int j=c+1;j<CURVE_FACTORS;++j) v-=a[c][j]*curve.beta[j];
+    curve.beta[c]=v/a[c][c];
+  }
+}
+
+double BondCurveService::Residual() const{
+  double sum=0;
+  for(size_t d=0;d<observed.size();++d){
+    if(!observed[d]) continue;
+    double err=curve.Yield(engine.GetMaturity(d))-observedYield[d];
+    sum+=err*err;
+  }
+  return sum;
+}
+
+void BondCurveService::FitShape(){
+  //golden section search on log(tau) between a quarter and four times the current tau
+  const double g=0.5*(sqrt(5.0)-1.0);
+  double lo=log(curve.tau)-log(4.0), hi=log(curve.tau)+log(4.0);
+  double start[CURVE_FACTORS]={curve.beta[0],curve.beta[1],curve.beta[2]};
+  for(int it=0;it<20;++it){
+    double m1=hi-g*(hi-lo), m2=lo+g*(hi-lo);
+    double r[2];
+    double m[2]={m1,m2};
+    for(int k=0;k<2;++k){
+      for(int i=0;i<CURVE_FACTORS;++i) curve.beta[i]=start[i];//every candidate warm starts from the same fit
+      Rebuild(exp(m[k]));
+      Solve();
+      r[k]=Residual();
+    }
+    if(r[0]<r[1]) hi=m2; else lo=m1;
+  }
+  for(int i=0;i<CURVE_FACTORS;++i) curve.beta[i]=start[i];
+  Rebuild(exp(0.5*(lo+hi)));
+  Solve();
+  ticks=0;
+  Publish();
+}
+
+void BondCurveService::OnYield(int d){
+  if(d<0 || size_t(d)>=observed.size() || engine.GetMaturity(d)<=0) return;
+  if(observed[d]) Accumulate(d,-1.0);//take the old observation out
+  else NelsonSiegelCurve::Basis(engine.GetMaturity(d),curve.tau,&basis[d*CURVE_FACTORS]);
+  observed[d]=1;
+  observedYield[d]=engine.GetYield(d);
+  Accumulate(d,1.0);
+  Solve();//warm starts from the previous beta through the ridge term
+  if(shapeRefitTicks>0 && ++ticks>=shapeRefitTicks) FitShape();
+  else Publish();
+}
+
+double BondCurveService::GetFairYield(int d) const{
+  double t=engine.GetMaturity(d);
+  return t>0?published.Load().Yield(t):0.0;
+}
+
+double BondCurveService::GetFairPrice(int d) const{
+  double t=engine.GetMaturity(d);
+  return t>0?engine.GetPriceAtYield(d,published.Load().Yield(t)):0.0;
+}
+
+void BondPriceCurveListener::ProcessAdd(Price<Bond> &data){
+  const InlineId& bondid=data.GetProduct().GetId();//get bond id
+  int d=engine.GetDenseId(bondid);
+  if(d<0) return;
+  //the analytics listener normally solved this mid already
+  if(engine.GetPrice(d)!=data.GetMid()) engine.OnPrice(bondid,data.GetMid());
+  curve.OnYield(d);//refit the curve with the new yield
+}
+
+#endif
@@ -10,7 +10,9 @@
 #include <string>
 #include <stdlib.h>
 #include "soa.hpp"
+#include "listenerlist.hpp"
 #include "marketdataservice.hpp"
+#include "randomsource.hpp"
 #include <fstream>
 
 enum OrderType { FOK, IOC, MARKET, LIMIT, STOP };
@@ -28,11 +30,14 @@ class ExecutionOrder
 public:
 
   // ctor for an order
-  ExecutionOrder(const T &_product, PricingSide _side, string _orderId, OrderType _orderType, double _price, long _visibleQuantity, long _hiddenQuantity, string _parentOrderId, bool _isChildOrder);
+  ExecutionOrder(const ProductHandle<T> &_product, PricingSide _side, string _orderId, OrderType _orderType, double _price, long _visibleQuantity, long _hiddenQuantity, string _parentOrderId, bool _isChildOrder);
 
   // Get the product
   const T& GetProduct() const;
 
+  // Get the shared handle of the product, to build further messages without interning it again
+  const ProductHandle<T>& GetProductHandle() const{return product;}
+
   // Get the order ID
   const string& GetOrderId() const;
 
@@ -58,7 +63,7 @@ public:
   PricingSide GetSide() const{return side;}
 
 private:
-  T product;
+  ProductHandle<T> product;
   PricingSide side;
   string orderId;
   OrderType orderType;
@@ -76,12 +81,14 @@ template<typename T>
 class AlgoExecution
 {
 private:
-  ExecutionOrder<T>& exe_orders; //each algo execution is associated with a vector of references
+  ExecutionOrder<T> exe_orders; //each algo execution owns a copy of its order so the cache outlives the caller
 public:
   //constructor
-  AlgoExecution(ExecutionOrder<T>& m_exe_order): exe_orders(m_exe_order){}
+  AlgoExecution(const ExecutionOrder<T>& m_exe_order): exe_orders(m_exe_order){}
+  AlgoExecution(ExecutionOrder<T>&& m_exe_order): exe_orders(std::move(m_exe_order)){}
   //get execution order
   ExecutionOrder<T>& GetExecutionOrder(){return exe_orders;}
+  const ExecutionOrder<T>& GetExecutionOrder() const{return exe_orders;}
   //set execution order
   void SetExecutionOrder(const ExecutionOrder<T>& src){exe_orders=src;}
 };
@@ -102,6 +109,17 @@ public:
 
 };
 /*
+pre-trade check consulted before an execution order is published
+T is product type
+*/
+template<typename T>
+class OrderCheck
+{
+public:
+  //return false to stop the order from going out
+  virtual bool Accept(const ExecutionOrder<T>& order)=0;
+};
+/*
 AlgoExecutionService to execute algo
 keyed on product identifier and T is product type
 */
@@ -112,16 +130,19 @@ public:
   virtual void ExecuteAlgo(OrderBook<T>& o_book)=0;
 };
 //bond algo execution service
-class BondAlgoExecutionService: public AlgoExecutionService<Bond>
+class BondAlgoExecutionService: public AlgoExecutionService<Bond>, public Snapshottable
 {
 private:
   //record the most recent executed algoexecution
   map<string, AlgoExecution<Bond> > bondAlgoExeCache;
-  vector< ServiceListener<AlgoExecution<Bond> >* > algoExeListeners;
+  ListenerList<AlgoExecution<Bond> > algoExeListeners;
   map<string, bool> isBuy;//constrol alternation
   int orderNum;//it will be converted to order id
+  OrderCheck<Bond>* orderCheck;//pre-trade check, null if orders go out unchecked
 public:
-  BondAlgoExecutionService(){orderNum=1;}
+  BondAlgoExecutionService(){orderNum=1;orderCheck=nullptr;}
+  //set the pre-trade check every order must pass before it is published
+  void SetOrderCheck(OrderCheck<Bond>* check){orderCheck=check;}
    // Get data on our service given a key
   virtual AlgoExecution<Bond>& GetData(string key){
     return bondAlgoExeCache.find(key)->second;
@@ -132,12 +153,18 @@ public:
 
   // Add a listener to the Service for callbacks on add, remove, and update events
   // for data to the Service.
-  virtual void AddListener(ServiceListener<AlgoExecution<Bond> > *listener){algoExeListeners.push_back(listener);}
+  virtual void AddListener(ServiceListener<AlgoExecution<Bond> > *listener){algoExeListeners.Add(listener);}
+  //remove a listener, a dispatch already under way may still call it
+  virtual void RemoveListener(ServiceListener<AlgoExecution<Bond> > *listener){algoExeListeners.Remove(listener);}
 
   // Get all listeners on the Service.
-  virtual const vector< ServiceListener<AlgoExecution<Bond> >* >& GetListeners() const {return algoExeListeners;}
+  virtual const vector< ServiceListener<AlgoExecution<Bond> >* >& GetListeners() const {return algoExeListeners.Snapshot();}
   //execute algo
   virtual void ExecuteAlgo(OrderBook<Bond>& o_book);
+  //checkpoint the open orders, the side alternation and the order id sequence
+  virtual string GetSnapshotName() const{return "algoexecution";}
+  virtual void SaveSnapshot(SnapshotWriter& w) const;
+  virtual void LoadSnapshot(SnapshotReader& r);
 };
 //orderbook listeners
 //link orderbook from marketdata service to bondalgoexecution service
@@ -159,8 +186,12 @@ public:
 
 class BondExecutionConnector: public Connector<pair<Market, ExecutionOrder<Bond> > >
 {
+private:
+   ofstream file;//./Output/ExecutionOrders.txt, opened on the first order and kept open
 public:
-   virtual void Publish(pair<Market, ExecutionOrder<Bond> > &data);
+   virtual void Publish(pair<Market, ExecutionOrder<Bond> > &data){Publish(data.first,data.second);}
+   //write an order without pairing it with its market first
+   void Publish(Market mkt, const ExecutionOrder<Bond>& exe_order);
 };
 
 //implement bondexecution service
@@ -169,9 +200,15 @@ class BondExecutionService: public ExecutionService<Bond>
 private:
   map<string, ExecutionOrder<Bond> > bondExeOrderCache;//record most recent executed order
   //this vector should only contain one listener
-  vector< ServiceListener<ExecutionOrder<Bond> >* > exeOrderListeners;
+  ListenerList<ExecutionOrder<Bond> > exeOrderListeners;
   BondExecutionConnector b_exe_connector;
+  RandomSource ownRandom;
+  RandomSource* random;//where markets are drawn from, ownRandom unless a shared one is set
 public:
+  BondExecutionService():random(&ownRandom){}
+  //draw markets from a source shared with other services, such as one saved with the checkpoints
+  void SetRandomSource(RandomSource* src){random=src;}
+  RandomSource& GetRandomSource(){return *random;}
    // Get data on our service given a key
   virtual ExecutionOrder<Bond>& GetData(string key){
     return bondExeOrderCache.find(key)->second;
@@ -182,10 +219,12 @@ public:
 
   // Add a listener to the Service for callbacks on add, remove, and update events
   // for data to the Service.
-  virtual void AddListener(ServiceListener<ExecutionOrder<Bond> > *listener){exeOrderListeners.push_back(listener);}
+  virtual void AddListener(ServiceListener<ExecutionOrder<Bond> > *listener){exeOrderListeners.Add(listener);}
+  //remove a listener, a dispatch already under way may still call it
+  virtual void RemoveListener(ServiceListener<ExecutionOrder<Bond> > *listener){exeOrderListeners.Remove(listener);}
 
   // Get all listeners on the Service.
-  virtual const vector< ServiceListener<ExecutionOrder<Bond> >* >& GetListeners() const {return exeOrderListeners;}
+  virtual const vector< ServiceListener<ExecutionOrder<Bond> >* >& GetListeners() const {return exeOrderListeners.Snapshot();}
 
   virtual void ExecuteOrder(const ExecutionOrder<Bond>& order, Market market);
 };
@@ -208,7 +247,7 @@ public:
 };
 
 template<typename T>
-ExecutionOrder<T>::ExecutionOrder(const T &_product, PricingSide _side, string _orderId, OrderType _orderType, double _price, long _visibleQuantity, long _hiddenQuantity, string _parentOrderId, bool _isChildOrder) :
+ExecutionOrder<T>::ExecutionOrder(const ProductHandle<T> &_product, PricingSide _side, string _orderId, OrderType _orderType, double _price, long _visibleQuantity, long _hiddenQuantity, string _parentOrderId, bool _isChildOrder) :
   product(_product)
 {
   side = _side;
@@ -224,7 +263,7 @@ ExecutionOrder<T>::ExecutionOrder(const T &_product, PricingSide _side, string _
 template<typename T>
 const T& ExecutionOrder<T>::GetProduct() const
 {
-  return product;
+  return product.Get();
 }
 
 template<typename T>
@@ -269,8 +308,55 @@ bool ExecutionOrder<T>::IsChildOrder() const
   return isChildOrder;
 }
 
+void BondAlgoExecutionService::SaveSnapshot(SnapshotWriter& w) const{
+  w.Put(orderNum);
+  w.Put(uint32_t(isBuy.size()));
+  for(map<string, bool>::const_iterator it=isBuy.begin();it!=isBuy.end();++it){
+    w.PutString(it->first);
+    w.Put(it->second);
+  }
+  w.Put(uint32_t(bondAlgoExeCache.size()));
+  for(map<string, AlgoExecution<Bond> >::const_iterator it=bondAlgoExeCache.begin();it!=bondAlgoExeCache.end();++it){
+    const ExecutionOrder<Bond>& e=it->second.GetExecutionOrder();
+    w.PutString(it->first);
+    w.Put(e.GetSide());
+    w.PutString(e.GetOrderId());
+    w.Put(e.GetOrderType());
+    w.Put(e.GetPrice());
+    w.Put(e.GetVisibleQuantity());
+    w.Put(e.GetHiddenQuantity());
+    w.PutString(e.GetParentOrderId());
+    w.Put(e.IsChildOrder());
+  }
+}
+
+void BondAlgoExecutionService::LoadSnapshot(SnapshotReader& r){
+  orderNum=r.Get<int>();
+  isBuy.clear();
+  uint32_t n=r.Get<uint32_t>();
+  for(uint32_t i=0;i<n && r.IsGood();++i){
+    string pid=r.GetString();
+    isBuy[pid]=r.Get<bool>();
+  }
+  bondAlgoExeCache.clear();
+  n=r.Get<uint32_t>();
+  for(uint32_t i=0;i<n && r.IsGood();++i){
+    string pid=r.GetString();
+    PricingSide side=r.Get<PricingSide>();
+    string oid=r.GetString();
+    OrderType type=r.Get<OrderType>();
+    double p=r.Get<double>();
+    long visible=r.Get<long>();
+    long hidden=r.Get<long>();
+    string parent=r.GetString();
+    bool child=r.Get<bool>();
+    const Bond* bnd=r.GetBond(pid);
+    if(bnd) bondAlgoExeCache.insert(make_pair(pid,AlgoExecution<Bond>(ExecutionOrder<Bond>(*bnd,side,oid,type,p,visible,hidden,parent,child))));
+  }
+}
+
 void BondAlgoExecutionService::ExecuteAlgo(OrderBook<Bond>& o_book){
-     Bond bnd=o_book.GetProduct();//get product of bond
+     const Bond& bnd=o_book.GetProduct();//get product of bond
      string bid=bnd.GetProductId();//get bond id
      //initially set the order to buy, otherwise alternate the isbuy signal for the product
      if(isBuy.find(bid)==isBuy.end()){isBuy.insert(make_pair(bid,true));}
@@ -278,7 +364,7 @@ void BondAlgoExecutionService::ExecuteAlgo(OrderBook<Bond>& o_book){
      //assume each execution order always sweep the entire best bid or best offer of market
      if(isBuy[bid]){
       //if we need to buy
-      vector<Order> offers=o_book.GetOfferStack();
+      vector<Order>& offers=o_book.GetOfferStack();//taken from the book in place
       vector<Order>::iterator index=offers.begin();//point to best offer 
       double p=offers[0].GetPrice();//store best offer price
       vector<Order>::iterator it=offers.begin();
@@ -294,33 +380,26 @@ void BondAlgoExecutionService::ExecuteAlgo(OrderBook<Bond>& o_book){
       long visible=q*0.3;
       long invisible=q-visible;
       offers.erase(index); //this order of market is exhausted
-      o_book.SetOfferStack(offers);//update offerstack
       //construct the execution order
-      ExecutionOrder<Bond> e_order(bnd, BID, to_string(orderNum),MARKET,p,visible,invisible,to_string(orderNum),false);
+      ExecutionOrder<Bond> e_order(o_book.GetProductHandle(), BID, to_string(orderNum),MARKET,p,visible,invisible,to_string(orderNum),false);
       orderNum++;
-      AlgoExecution<Bond> algo_exe(e_order);//construct algo execution object
+      if(orderCheck && !orderCheck->Accept(e_order)) return;//rejected before it goes out
+      AlgoExecution<Bond> algo_exe(std::move(e_order));//construct algo execution object
       map<string, AlgoExecution<Bond> >::iterator m_algo_exe=bondAlgoExeCache.find(bid);
       if(m_algo_exe==bondAlgoExeCache.end()){
         //new order
-        bondAlgoExeCache.insert(make_pair(bid,algo_exe));
-        //iterate listeners
-        for(int i=0;i<algoExeListeners.size();++i){
-          algoExeListeners[i]->ProcessAdd(algo_exe);
-        }
+        m_algo_exe=bondAlgoExeCache.insert(make_pair(bid,std::move(algo_exe))).first;
       }
       else{
-        //exist past order
-        bondAlgoExeCache.erase(bid);
-        bondAlgoExeCache.insert(make_pair(bid,algo_exe));
-        //iterate listeners
-        for(int i=0;i<algoExeListeners.size();++i){
-          algoExeListeners[i]->ProcessAdd(algo_exe);
-        }
+        //exist past order, replaced in place
+        m_algo_exe->second=std::move(algo_exe);
       }
+      //iterate listeners with the cached order
+      algoExeListeners.ProcessAdd(m_algo_exe->second);
      }
      else{
      //if we need to sell
-      vector<Order> bids=o_book.GetBidStack();
+      vector<Order>& bids=o_book.GetBidStack();//taken from the book in place
       vector<Order>::iterator index=bids.begin();//point to best bid 
       double p=bids[0].GetPrice();//store best bid price
       vector<Order>::iterator it=bids.begin();
@@ -336,59 +415,44 @@ void BondAlgoExecutionService::ExecuteAlgo(OrderBook<Bond>& o_book){
       long visible=q*0.3;
       long invisible=q-visible;
       bids.erase(index); //this order of market is exhausted
-      o_book.SetBidStack(bids);//update bidstack
       //construct the execution order
-      ExecutionOrder<Bond> e_order(bnd, OFFER, to_string(orderNum),MARKET,p,visible,invisible,to_string(orderNum),false);
+      ExecutionOrder<Bond> e_order(o_book.GetProductHandle(), OFFER, to_string(orderNum),MARKET,p,visible,invisible,to_string(orderNum),false);
       orderNum++;
-      AlgoExecution<Bond> algo_exe(e_order);//construct algo execution object
+      if(orderCheck && !orderCheck->Accept(e_order)) return;//rejected before it goes out
+      AlgoExecution<Bond> algo_exe(std::move(e_order));//construct algo execution object
       map<string, AlgoExecution<Bond> >::iterator m_algo_exe=bondAlgoExeCache.find(bid);
       if(m_algo_exe==bondAlgoExeCache.end()){
         //new order
-        bondAlgoExeCache.insert(make_pair(bid,algo_exe));
-        //iterate listeners
-        for(int i=0;i<algoExeListeners.size();++i){
-          algoExeListeners[i]->ProcessAdd(algo_exe);
-        }
+        m_algo_exe=bondAlgoExeCache.insert(make_pair(bid,std::move(algo_exe))).first;
       }
       else{
-        //exist past order
-        bondAlgoExeCache.erase(bid);
-        bondAlgoExeCache.insert(make_pair(bid,algo_exe));
-        //iterate listeners
-        for(int i=0;i<algoExeListeners.size();++i){
-          algoExeListeners[i]->ProcessAdd(algo_exe);
-        }
+        //exist past order, replaced in place
+        m_algo_exe->second=std::move(algo_exe);
       }
+      //iterate listeners with the cached order
+      algoExeListeners.ProcessAdd(m_algo_exe->second);
     }
   }
 
 void BondExecutionService::ExecuteOrder(const ExecutionOrder<Bond>& order, Market market){
-    Bond bnd=order.GetProduct();//get product of the order
-    string bondid=bnd.GetProductId();//get product id
+    const Bond& bnd=order.GetProduct();//get product of the order
+    const string& bondid=bnd.GetProductId();//get product id
     map<string, ExecutionOrder<Bond> >::iterator it=bondExeOrderCache.find(bondid);//get corresponding entry
-    ExecutionOrder<Bond> copy=order;
     if(it==bondExeOrderCache.end()){
       //new entry
-      bondExeOrderCache.insert(make_pair(bondid,order));//insert into cache
-      for(int i=0;i<exeOrderListeners.size();++i){
-        //iterate listeners
-         exeOrderListeners[i]->ProcessAdd(copy);
-      }
+      it=bondExeOrderCache.insert(make_pair(bondid,order)).first;//the only copy of the order
     }
     else{
-      bondExeOrderCache.erase(bondid);//remove old entry
-      bondExeOrderCache.insert(make_pair(bondid,order));//insert into cache
-      for(int i=0;i<exeOrderListeners.size();++i){
-        exeOrderListeners[i]->ProcessAdd(copy);//iterate listeners
-      }
+      it->second=order;//replace the old entry in place
     }
-    pair<Market, ExecutionOrder<Bond> > currentOrder(make_pair(market,copy));
-    b_exe_connector.Publish(currentOrder);
+    //listeners and the connector are handed the cached order
+    exeOrderListeners.ProcessAdd(it->second);
+    b_exe_connector.Publish(market,it->second);
   }
 
   void BondAlgoExecutionListener::ProcessAdd(AlgoExecution<Bond> &data){
-    ExecutionOrder<Bond> exe_order=data.GetExecutionOrder();//get the executionorder of data
-    int i=rand()%3;//to determine the market
+    const ExecutionOrder<Bond>& exe_order=data.GetExecutionOrder();//get the executionorder of data
+    int i=b_exe_service.GetRandomSource().Next()%3;//to determine the market
     Market mkt;
     //assign mkt randomly based on i
     switch(i){
@@ -402,14 +466,11 @@ void BondExecutionService::ExecuteOrder(const ExecutionOrder<Bond>& order, Marke
     b_exe_service.ExecuteOrder(exe_order,mkt);//flow data to execution service
   }
 
-void BondExecutionConnector::Publish(pair<Market, ExecutionOrder<Bond> > &data){
-   ofstream file;
-   file.open("./Output/ExecutionOrders.txt",ios_base::app);//open the file to append
-   Market mkt=data.first;//get the market
-   ExecutionOrder<Bond> exe_order=data.second;//get the execution order
-   string orderid=exe_order.GetOrderId(); //get order id
+void BondExecutionConnector::Publish(Market mkt, const ExecutionOrder<Bond>& exe_order){
+   if(!file.is_open()) file.open("./Output/ExecutionOrders.txt",ios_base::app);//open the file to append
+   const string& orderid=exe_order.GetOrderId(); //get order id
    file<<orderid<<",";//write orderid to file
-   Bond bnd=exe_order.GetProduct();//get prodcut of the order
+   const Bond& bnd=exe_order.GetProduct();//get prodcut of the order
    string bondid=bnd.GetProductId();//get bond cusip
    file<<bondid<<",";//write cusip to file
    PricingSide side=exe_order.GetSide();//Get side
@@ -460,6 +521,7 @@ void BondExecutionConnector::Publish(pair<Market, ExecutionOrder<Bond> > &data){
     p_str=to_string(part1)+"-"+"0"+to_string(part2)+to_string(part3);
    }
    file<<p_str<<"\n";//write to file
+   file.flush();//each order reaches the file as it is executed
 }
 
 #endif
@@ -12,21 +12,42 @@ author: Gaoxian Song
 //paired with persist key
 class BondPositionHistoricalConnector: public Connector<pair<string, Position<Bond> > >
 {
+private:
+  RecordBuffer buffer;//preallocated buffer the records are formatted into
+  SegmentedLogWriter log;//rotating segments of ./Output/Historical/position.txt
 public:
+  BondPositionHistoricalConnector():log("./Output/Historical/position.txt","PersistKey,CUSIP,AggregatePosition,TRSY1,TRSY2,TRSY3"){}//constructor
   // Publish data to the Connector
-  virtual void Publish(pair<string, Position<Bond> > &data);
+  virtual void Publish(pair<string, Position<Bond> > &data){Write(data.first,data.second);}
+  //format and write one record without pairing the key and data first; false if it could not be written
+  bool Write(const string& persistKey, const Position<Bond>& data);
+  //set when the live segment is rotated
+  void SetRotationPolicy(const SegmentRotationPolicy& policy){log.SetRotationPolicy(policy);}
+  //sync the log and return its end, taken with a checkpoint
+  SegmentedLogPosition GetLogPosition(){log.Sync(); return log.GetPosition();}
+  //cut the log back to a checkpointed end, records after it are written again on replay
+  void RestoreLog(const SegmentedLogPosition& pos){log.Truncate(pos);}
 };
 //historical dataservice for bond position
 //keyed on record, not product
-class BondPositionHistoricalData: public HistoricalDataService<Position<Bond> >
+class BondPositionHistoricalData: public HistoricalDataService<Position<Bond> >, public Snapshottable
 {
 private:
   int counter;//count record to determine the key
   map<string, Position<Bond> > bondHistoricalPositionCache;
-  vector<ServiceListener<Position<Bond> >* > bondPositionListeners;//listeners
+  ListenerList<Position<Bond> > bondPositionListeners;//listeners
   BondPositionHistoricalConnector& b_pos_historical;//connector to output file
 public:
   BondPositionHistoricalData(BondPositionHistoricalConnector& src):b_pos_historical(src){counter=1;}//constructor
+  //checkpoint the key counter and the end of the log, so a warm start continues the key sequence
+  //from a log holding nothing written after the checkpoint
+  virtual string GetSnapshotName() const{return "history.positions";}
+  virtual void SaveSnapshot(SnapshotWriter& w) const{w.Put(counter); w.Put(b_pos_historical.GetLogPosition());}
+  virtual void LoadSnapshot(SnapshotReader& r){
+    counter=r.Get<int>();
+    SegmentedLogPosition pos=r.Get<SegmentedLogPosition>();
+    if(r.IsGood()) b_pos_historical.RestoreLog(pos);
+  }
   // Get data on our service given a key
   virtual Position<Bond>& GetData(string key){return bondHistoricalPositionCache.find(key)->second;}
 
@@ -35,20 +56,21 @@ public:
 
   // Add a listener to the Service for callbacks on add, remove, and update events
   // for data to the Service.
-  virtual void AddListener(ServiceListener<Position<Bond> > *listener){bondPositionListeners.push_back(listener);}
+  virtual void AddListener(ServiceListener<Position<Bond> > *listener){bondPositionListeners.Add(listener);}
+  //remove a listener, a dispatch already under way may still call it
+  virtual void RemoveListener(ServiceListener<Position<Bond> > *listener){bondPositionListeners.Remove(listener);}
 
   // Get all listeners on the Service.
-  virtual const vector< ServiceListener<Position<Bond> >* >& GetListeners() const{return bondPositionListeners;}
+  virtual const vector< ServiceListener<Position<Bond> >* >& GetListeners() const{return bondPositionListeners.Snapshot();}
   //persist data to a store
   virtual void PersistData(string persistKey, const Position<Bond>& data){
-  	pair<string, Position<Bond> > dataPair=make_pair(persistKey,data);//construct data pair
-  	b_pos_historical.Publish(dataPair);//publish data to file
+  	b_pos_historical.Write(persistKey,data);//publish data to file
   }
   //set key for persist data
   void SetPersistKey(Position<Bond>& data){
   	//get key from counter and increment counter
   	string k=to_string(counter); ++counter;
-  	Position<Bond> data_copy=data; PersistData(k,data_copy);
+  	PersistData(k,data);
   }
 };
 
@@ -59,7 +81,7 @@ private:
 public:
 	BondPositionHistoricalListener(BondPositionHistoricalData& src): b_historical_data(src){}
 	// Listener callback to process an add event to the Service
-  virtual void ProcessAdd(Position<Bond> &data){}
+  virtual void ProcessAdd(Position<Bond> &data){b_historical_data.SetPersistKey(data);}
 
   // Listener callback to process a remove event to the Service
   virtual void ProcessRemove(Position<Bond> &data){}
@@ -69,30 +91,12 @@ public:
 };
 
 //implement publish
-void BondPositionHistoricalConnector::Publish(pair<string, Position<Bond> > &data){
-	ofstream file;
-    file.open("./Output/Historical/position.txt",ios_base::app);//open the file to append
-   //get key
-	string k=data.first;
-	file<<k<<",";
-	//get position
-	Position<Bond> pos=data.second;
-	//get bond
-	Bond bnd=pos.GetProduct();
-	//get bond id
-	string bondid=bnd.GetProductId();
-    file<<bondid<<",";
-    long aqty=pos.GetAggregatePosition();//get aggregate position
-    file<<to_string(aqty)<<",";
-    string book="TRSY1";
-    long q1=pos.GetPosition(book);//get quatity for TRSY1
-    file<<to_string(q1)<<",";
-    book="TRSY2";
-    long q2=pos.GetPosition(book);//get quantity for TRSY2
-    file<<to_string(q2)<<",";
-    book="TRSY3";
-    long q3=pos.GetPosition(book);//get quantity for TRSY3
-    file<<to_string(q3)<<"\n";
+bool BondPositionHistoricalConnector::Write(const string& persistKey, const Position<Bond>& data){
+  buffer.Reset();
+  WriteRecord<CsvRecordWriter>(buffer,persistKey,data);//format key and fields into the buffer
+  if(log.Append(buffer.Data(),buffer.Size())) return true;//write to the live segment
+  cout<<"Cannot write record "<<persistKey<<" to "<<log.GetBasePath()<<"\n";
+  return false;
 }
 
 #endif
\ No newline at end of file
@@ -14,30 +14,66 @@ class BondRiskRecord
 public:
   string persistKey;//the persist key
   PV01<Bond> b_pv01;//the bond's pv01 to be updated or added
-  PV01<BucketedSector<Bond> > front_end, belly, long_end;//three sectors to record
-  BondRiskRecord(PV01<Bond>& src1, PV01<BucketedSector<Bond> >& f1, PV01<BucketedSector<Bond> >& b1, PV01<BucketedSector<Bond> >& l1):b_pv01(src1),front_end(f1),belly(b1),long_end(l1), persistKey("123"){}//ctor, avoid null string
+  double front_end, belly, long_end;//pv01 of the three sectors to record, without copying their products
+  BondRiskRecord(PV01<Bond>& src1, PV01<BucketedSector<Bond> >& f1, PV01<BucketedSector<Bond> >& b1, PV01<BucketedSector<Bond> >& l1):b_pv01(src1),front_end(f1.GetPV01()),belly(b1.GetPV01()),long_end(l1.GetPV01()), persistKey("123"){}//ctor, avoid null string
+};
+
+//fields of a risk record: key, bond, quantity and the pv01 of the three sectors
+template<>
+struct RecordFields<BondRiskRecord>
+{
+  template<typename W>
+  static void Write(const BondRiskRecord& data, W& w){
+    w.Field(data.persistKey);
+    w.Field(data.b_pv01.GetProduct().GetProductId());
+    w.Field(data.b_pv01.GetQuantity());
+    w.Field(data.front_end);
+    w.Field(data.belly);
+    w.Field(data.long_end);
+  }
 };
 
 //connector for historical data service for bond position
 //paired with persist key
 class BondRiskHistoricalConnector: public Connector<BondRiskRecord>
 {
+private:
+  RecordBuffer buffer;//preallocated buffer the records are formatted into
+  SegmentedLogWriter log;//rotating segments of ./Output/Historical/risk.txt
 public:
+  BondRiskHistoricalConnector():log("./Output/Historical/risk.txt","PersistKey,CUSIP,PV01,Qty,FrontEndPV01,BellyPV01,LongEndPV01"){}//constructor
   // Publish data to the Connector
-  virtual void Publish(BondRiskRecord &data);
+  virtual void Publish(BondRiskRecord &data){Write(data);}
+  //format and write one record; false if it could not be written
+  bool Write(const BondRiskRecord& data);
+  //set when the live segment is rotated
+  void SetRotationPolicy(const SegmentRotationPolicy& policy){log.SetRotationPolicy(policy);}
+  //sync the log and return its end, taken with a checkpoint
+  SegmentedLogPosition GetLogPosition(){log.Sync(); return log.GetPosition();}
+  //cut the log back to a checkpointed end, records after it are written again on replay
+  void RestoreLog(const SegmentedLogPosition& pos){log.Truncate(pos);}
 };
 
 //historical dataservice for bond risk
 //keyed on record, not product
-class BondRiskHistoricalData: public HistoricalDataService<BondRiskRecord>
+class BondRiskHistoricalData: public HistoricalDataService<BondRiskRecord>, public Snapshottable
 {
 private:
   int counter;//count record to determine the key
   map<string, BondRiskRecord> bondRecordRiskCache;
-  vector<ServiceListener<BondRiskRecord>* > bondRiskListeners;//listeners
+  ListenerList<BondRiskRecord> bondRiskListeners;//listeners
   BondRiskHistoricalConnector& b_risk_historical;//connector to output file
 public:
   BondRiskHistoricalData(BondRiskHistoricalConnector& src):b_risk_historical(src){counter=1;}//constructor
+  //checkpoint the key counter and the end of the log, so a warm start continues the key sequence
+  //from a log holding nothing written after the checkpoint
+  virtual string GetSnapshotName() const{return "history.risk";}
+  virtual void SaveSnapshot(SnapshotWriter& w) const{w.Put(counter); w.Put(b_risk_historical.GetLogPosition());}
+  virtual void LoadSnapshot(SnapshotReader& r){
+    counter=r.Get<int>();
+    SegmentedLogPosition pos=r.Get<SegmentedLogPosition>();
+    if(r.IsGood()) b_risk_historical.RestoreLog(pos);
+  }
   // Get data on our service given a key
   virtual BondRiskRecord& GetData(string key){return bondRecordRiskCache.find(key)->second;}
 
@@ -46,20 +82,21 @@ public:
 
   // Add a listener to the Service for callbacks on add, remove, and update events
   // for data to the Service.
-  virtual void AddListener(ServiceListener<BondRiskRecord> *listener){bondRiskListeners.push_back(listener);}
+  virtual void AddListener(ServiceListener<BondRiskRecord> *listener){bondRiskListeners.Add(listener);}
+  //remove a listener, a dispatch already under way may still call it
+  virtual void RemoveListener(ServiceListener<BondRiskRecord> *listener){bondRiskListeners.Remove(listener);}
 
   // Get all listeners on the Service.
-  virtual const vector< ServiceListener<BondRiskRecord>* >& GetListeners() const{return bondRiskListeners;}
+  virtual const vector< ServiceListener<BondRiskRecord>* >& GetListeners() const{return bondRiskListeners.Snapshot();}
   //persist data to a store
   virtual void PersistData(string persistKey, const BondRiskRecord& data){
-    BondRiskRecord datacopy=data;//construct data pair
-  	b_risk_historical.Publish(datacopy);//publish data to file
+  	b_risk_historical.Write(data);//publish data to file
   }
   //set key for persist data
   void SetPersistKey(BondRiskRecord& data){
   	//get key from counter and increment counter
   	string k=to_string(counter); ++counter;data.persistKey=k;
-  	BondRiskRecord data_copy=data; PersistData(k,data_copy);
+  	PersistData(k,data);
   }
 };
 
@@ -99,7 +136,7 @@ public:
 
   // Listener callback to process an update event to the Service
   virtual void ProcessUpdate(PV01<Bond> &data){}
-  PV01<Bond> GetData(){return theData;}//get data
+  PV01<Bond>& GetData(){return theData;}//get data
   void SetProcessed(bool s){needProcessed=s;}//update the needprocessed status
   bool GetProcessed(){return needProcessed;} //return needprocessed status
 };
@@ -125,40 +162,17 @@ void BondSectorsRiskListener::ProcessUpdate(SectorsRisk &data){
     bool status=b_pv01_listener.GetProcessed();//get status
     if(status){
       b_pv01_listener.SetProcessed(false);//update the status
-      PV01<Bond> bnd_pv01=b_pv01_listener.GetData(); //get the data
+      PV01<Bond>& bnd_pv01=b_pv01_listener.GetData(); //get the data
       b_risk_record_listener.SetUpdate(bnd_pv01,data);
     }
   }
 
-void BondRiskHistoricalConnector::Publish(BondRiskRecord& data){
-  ofstream file;
-  file.open("./Output/Historical/risk.txt",ios_base::app);//open the file to append
-   //get key
-  string k=data.persistKey;
-  file<<k<<",";
-  //get pv01
-  PV01<Bond> thepv01=data.b_pv01;
-  //get bond
-  Bond bnd=thepv01.GetProduct();
-  //get bond id
-  string bondid=bnd.GetProductId();
-  file<<bondid<<",";
-  //get pv01
-  double pv01_d=thepv01.GetPV01();
-  //get quantity
-  long qty=thepv01.GetQuantity();
-  file<<to_string(qty)<<",";
-  //get different bucked sectors
-  PV01<BucketedSector<Bond> > sector_pv01=data.front_end;
-  //get pv01
-  pv01_d=sector_pv01.GetPV01();
-  file<<to_string(pv01_d)<<",";
-  sector_pv01=data.belly;
-  pv01_d=sector_pv01.GetPV01();
-  file<<to_string(pv01_d)<<",";
-  sector_pv01=data.long_end;
-  pv01_d=sector_pv01.GetPV01();
-  file<<to_string(pv01_d)<<"\n";
+bool BondRiskHistoricalConnector::Write(const BondRiskRecord& data){
+  buffer.Reset();
+  WriteRecord<CsvRecordWriter>(buffer,data);//format key and fields into the buffer
+  if(log.Append(buffer.Data(),buffer.Size())) return true;//write to the live segment
+  cout<<"Cannot write record "<<data.persistKey<<" to "<<log.GetBasePath()<<"\n";
+  return false;
 }
 
 void BondRiskRecordListener::SetUpdate(PV01<Bond>& data1, SectorsRisk& data2){
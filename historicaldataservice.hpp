@@ -12,12 +12,16 @@
 
 #include "executionservice.hpp"
 #include "inquiryservice.hpp"
+#include "listinquiryservice.hpp"
 #include "marketdataservice.hpp"
 #include "positionservice.hpp"
 #include "pricingservice.hpp"
 #include "riskservice.hpp"
 #include "streamingservice.hpp"
 #include "tradebookingservice.hpp" 
+#include "historicallog.hpp"
+#include "recordformat.hpp"
+#include <sstream>
 
 /**
  * Service for processing and persisting historical data to a persistent store.
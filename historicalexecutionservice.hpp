@@ -12,21 +12,42 @@ author: Gaoxian Song
 //paired with persist key
 class BondExecutionHistoricalConnector: public Connector<pair<string,ExecutionOrder<Bond> > >
 {
+private:
+  RecordBuffer buffer;//preallocated buffer the records are formatted into
+  SegmentedLogWriter log;//rotating segments of ./Output/Historical/executions.txt
 public:
+  BondExecutionHistoricalConnector():log("./Output/Historical/executions.txt","persistKey,orderId,CUSIP,PricingSide,orderType,visibleQty,hiddenQty,price"){}//constructor
   // Publish data to the Connector
-  virtual void Publish(pair<string, ExecutionOrder<Bond> > &data);
+  virtual void Publish(pair<string, ExecutionOrder<Bond> > &data){Write(data.first,data.second);}
+  //format and write one record without pairing the key and data first; false if it could not be written
+  bool Write(const string& persistKey, const ExecutionOrder<Bond>& data);
+  //set when the live segment is rotated
+  void SetRotationPolicy(const SegmentRotationPolicy& policy){log.SetRotationPolicy(policy);}
+  //sync the log and return its end, taken with a checkpoint
+  SegmentedLogPosition GetLogPosition(){log.Sync(); return log.GetPosition();}
+  //cut the log back to a checkpointed end, records after it are written again on replay
+  void RestoreLog(const SegmentedLogPosition& pos){log.Truncate(pos);}
 };
 //historical dataservice for bond position
 //keyed on record, not product
-class BondExecutionHistoricalData: public HistoricalDataService<ExecutionOrder<Bond> >
+class BondExecutionHistoricalData: public HistoricalDataService<ExecutionOrder<Bond> >, public Snapshottable
 {
 private:
   int counter;//count record to determine the key
   map<string, ExecutionOrder<Bond> > bondHistoricalCache;
-  vector<ServiceListener<ExecutionOrder<Bond> >* > bondListeners;//listeners
+  ListenerList<ExecutionOrder<Bond> > bondListeners;//listeners
   BondExecutionHistoricalConnector& b_historical;//connector to output file
 public:
   BondExecutionHistoricalData(BondExecutionHistoricalConnector& src):b_historical(src){counter=1;}//constructor
+  //checkpoint the key counter and the end of the log, so a warm start continues the key sequence
+  //from a log holding nothing written after the checkpoint
+  virtual string GetSnapshotName() const{return "history.executions";}
+  virtual void SaveSnapshot(SnapshotWriter& w) const{w.Put(counter); w.Put(b_historical.GetLogPosition());}
+  virtual void LoadSnapshot(SnapshotReader& r){
+    counter=r.Get<int>();
+    SegmentedLogPosition pos=r.Get<SegmentedLogPosition>();
+    if(r.IsGood()) b_historical.RestoreLog(pos);
+  }
   // Get data on our service given a key
   virtual ExecutionOrder<Bond>& GetData(string key){return bondHistoricalCache.find(key)->second;}
 
@@ -35,20 +56,21 @@ public:
 
   // Add a listener to the Service for callbacks on add, remove, and update events
   // for data to the Service.
-  virtual void AddListener(ServiceListener<ExecutionOrder<Bond> > *listener){bondListeners.push_back(listener);}
+  virtual void AddListener(ServiceListener<ExecutionOrder<Bond> > *listener){bondListeners.Add(listener);}
+  //remove a listener, a dispatch already under way may still call it
+  virtual void RemoveListener(ServiceListener<ExecutionOrder<Bond> > *listener){bondListeners.Remove(listener);}
 
   // Get all listeners on the Service.
-  virtual const vector< ServiceListener<ExecutionOrder<Bond> >* >& GetListeners() const{return bondListeners;}
+  virtual const vector< ServiceListener<ExecutionOrder<Bond> >* >& GetListeners() const{return bondListeners.Snapshot();}
   //persist data to a store
   virtual void PersistData(string persistKey, const ExecutionOrder<Bond>& data){
-  	pair<string, ExecutionOrder<Bond> > dataPair=make_pair(persistKey,data);//construct data pair
-  	b_historical.Publish(dataPair);//publish data to file
+  	b_historical.Write(persistKey,data);//publish data to file
   }
   //set key for persist data
   void SetPersistKey(ExecutionOrder<Bond>& data){
   	//get key from counter and increment counter
   	string k=to_string(counter); ++counter;
-  	ExecutionOrder<Bond> data_copy=data; PersistData(k,data_copy);
+  	PersistData(k,data);
   }
 };
 
@@ -69,57 +91,12 @@ public:
 };
 
 //implement publish
-void BondExecutionHistoricalConnector::Publish(pair<string, ExecutionOrder<Bond> > &data){
-	ofstream file;
-  file.open("./Output/Historical/executions.txt",ios_base::app);//open the file to append
-   //get key
-	string k=data.first;
-	file<<k<<",";
-  ExecutionOrder<Bond> exe_order=data.second;//get the execution order
-  string orderid=exe_order.GetOrderId(); //get order id
-   file<<orderid<<",";//write orderid to file
-   Bond bnd=exe_order.GetProduct();//get prodcut of the order
-   string bondid=bnd.GetProductId();//get bond cusip
-   file<<bondid<<",";//write cusip to file
-   PricingSide side=exe_order.GetSide();//Get side
-   if(side==BID){
-    file<<"BID,";//write side to file
-   }
-   else{
-    file<<"OFFER,";//write side to file
-   }
-   OrderType o_type=exe_order.GetOrderType();//get order type
-   //write corresponding type to file
-   switch(o_type){
-    case FOK: file<<"FOK,";
-              break;
-    case IOC: file<<"IOC,";
-              break;
-    case MARKET: file<<"MARKET,";
-                 break;
-    case LIMIT: file<<"LIMIT,";
-                 break;
-    case STOP: file<<"STOP,";
-               break;
-   }
-   long visible=exe_order.GetVisibleQuantity();//get visible qty
-   file<<to_string(visible)<<",";//write to file
-   long hidden=exe_order.GetHiddenQuantity();//get hidden qty
-   file<<to_string(hidden)<<",";//write to file
-   double p=exe_order.GetPrice();//get price
-   int part1=int(p);//get the integer part of price
-   double p2=p-double(part1);//get the decimal part of price
-   int part2=int(p2*32);//get part2 of price
-   double p3=p2-double(part2)/32;//get last part of price
-   int part3=round(p3*256);//get part3 of price
-   string p_str;//store the string of price
-   if(part2>=10){
-     p_str=to_string(part1)+"-"+to_string(part2)+to_string(part3);//construct price string
-   }
-   else{
-    p_str=to_string(part1)+"-"+"0"+to_string(part2)+to_string(part3);
-   }
-   file<<p_str<<"\n";//write to file
+bool BondExecutionHistoricalConnector::Write(const string& persistKey, const ExecutionOrder<Bond>& data){
+  buffer.Reset();
+  WriteRecord<CsvRecordWriter>(buffer,persistKey,data);//format key and fields into the buffer
+  if(log.Append(buffer.Data(),buffer.Size())) return true;//write to the live segment
+  cout<<"Cannot write record "<<persistKey<<" to "<<log.GetBasePath()<<"\n";
+  return false;
 }
 
 #endif
\ No newline at end of file
@@ -12,21 +12,42 @@ author: Gaoxian Song
 //paired with persist key
 class BondIqHistoricalConnector: public Connector<pair<string,Inquiry<Bond> > >
 {
+private:
+  RecordBuffer buffer;//preallocated buffer the records are formatted into
+  SegmentedLogWriter log;//rotating segments of ./Output/Historical/allinquiries.txt
 public:
+  BondIqHistoricalConnector():log("./Output/Historical/allinquiries.txt","persistKey,InquiryId,ProductId,Side,Quantity,Price,State"){}//constructor
   // Publish data to the Connector
-  virtual void Publish(pair<string, Inquiry<Bond> > &data);
+  virtual void Publish(pair<string, Inquiry<Bond> > &data){Write(data.first,data.second);}
+  //format and write one record without pairing the key and data first; false if it could not be written
+  bool Write(const string& persistKey, const Inquiry<Bond>& data);
+  //set when the live segment is rotated
+  void SetRotationPolicy(const SegmentRotationPolicy& policy){log.SetRotationPolicy(policy);}
+  //sync the log and return its end, taken with a checkpoint
+  SegmentedLogPosition GetLogPosition(){log.Sync(); return log.GetPosition();}
+  //cut the log back to a checkpointed end, records after it are written again on replay
+  void RestoreLog(const SegmentedLogPosition& pos){log.Truncate(pos);}
 };
 //historical dataservice for bond position
 //keyed on record, not product
-class BondIqHistoricalData: public HistoricalDataService<Inquiry<Bond> >
+class BondIqHistoricalData: public HistoricalDataService<Inquiry<Bond> >, public Snapshottable
 {
 private:
   int counter;//count record to determine the key
   map<string, Inquiry<Bond> > bondHistoricalCache;
-  vector<ServiceListener<Inquiry<Bond> >* > bondListeners;//listeners
+  ListenerList<Inquiry<Bond> > bondListeners;//listeners
   BondIqHistoricalConnector& b_historical;//connector to output file
 public:
   BondIqHistoricalData(BondIqHistoricalConnector& src):b_historical(src){counter=1;}//constructor
+  //checkpoint the key counter and the end of the log, so a warm start continues the key sequence
+  //from a log holding nothing written after the checkpoint
+  virtual string GetSnapshotName() const{return "history.inquiries";}
+  virtual void SaveSnapshot(SnapshotWriter& w) const{w.Put(counter); w.Put(b_historical.GetLogPosition());}
+  virtual void LoadSnapshot(SnapshotReader& r){
+    counter=r.Get<int>();
+    SegmentedLogPosition pos=r.Get<SegmentedLogPosition>();
+    if(r.IsGood()) b_historical.RestoreLog(pos);
+  }
   // Get data on our service given a key
   virtual Inquiry<Bond>& GetData(string key){return bondHistoricalCache.find(key)->second;}
 
@@ -35,20 +56,21 @@ public:
 
   // Add a listener to the Service for callbacks on add, remove, and update events
   // for data to the Service.
-  virtual void AddListener(ServiceListener<Inquiry<Bond> > *listener){bondListeners.push_back(listener);}
+  virtual void AddListener(ServiceListener<Inquiry<Bond> > *listener){bondListeners.Add(listener);}
+  //remove a listener, a dispatch already under way may still call it
+  virtual void RemoveListener(ServiceListener<Inquiry<Bond> > *listener){bondListeners.Remove(listener);}
 
   // Get all listeners on the Service.
-  virtual const vector< ServiceListener<Inquiry<Bond> >* >& GetListeners() const{return bondListeners;}
+  virtual const vector< ServiceListener<Inquiry<Bond> >* >& GetListeners() const{return bondListeners.Snapshot();}
   //persist data to a store
   virtual void PersistData(string persistKey, const Inquiry<Bond>& data){
-  	pair<string, Inquiry<Bond> > dataPair=make_pair(persistKey,data);//construct data pair
-  	b_historical.Publish(dataPair);//publish data to file
+  	b_historical.Write(persistKey,data);//publish data to file
   }
   //set key for persist data
   void SetPersistKey(Inquiry<Bond>& data){
   	//get key from counter and increment counter
   	string k=to_string(counter); ++counter;
-  	Inquiry<Bond> data_copy=data; PersistData(k,data_copy);
+  	PersistData(k,data);
   }
 };
 
@@ -59,14 +81,7 @@ private:
 public:
 	BondIqHistoricalListener(BondIqHistoricalData& src): b_historical_data(src){}
 	// Listener callback to process an update event to the Service
-  virtual void ProcessUpdate(Inquiry<Bond> &data){
-    b_historical_data.SetPersistKey(data);
-    InquiryState s=data.GetState();//get state
-    if(s==QUOTED){
-      data.SetState(DONE);//update to done 
-      b_historical_data.SetPersistKey(data);//flow updated data
-    }
-  }
+  virtual void ProcessUpdate(Inquiry<Bond> &data){b_historical_data.SetPersistKey(data);}//every state the inquiry moves through
 
   // Listener callback to process a remove event to the Service
   virtual void ProcessRemove(Inquiry<Bond> &data){}
@@ -75,44 +90,103 @@ public:
   virtual void ProcessAdd(Inquiry<Bond> &data){b_historical_data.SetPersistKey(data);}
 };
 
+//connector for historical data of list inquiries, one record per list with its legs
+class BondListIqHistoricalConnector: public Connector<pair<string,ListInquiry<Bond> > >
+{
+private:
+  RecordBuffer buffer;//preallocated buffer the records are formatted into
+  SegmentedLogWriter log;//rotating segments of ./Output/Historical/listinquiries.txt
+public:
+  BondListIqHistoricalConnector():log("./Output/Historical/listinquiries.txt","persistKey,ListId,State,LegCount,ProductId,Side,Quantity,Price"){}//constructor, the leg fields repeat per leg
+  // Publish data to the Connector
+  virtual void Publish(pair<string, ListInquiry<Bond> > &data){Write(data.first,data.second);}
+  //format and write one record without pairing the key and data first; false if it could not be written
+  bool Write(const string& persistKey, const ListInquiry<Bond>& data);
+  //set when the live segment is rotated
+  void SetRotationPolicy(const SegmentRotationPolicy& policy){log.SetRotationPolicy(policy);}
+  //sync the log and return its end, taken with a checkpoint
+  SegmentedLogPosition GetLogPosition(){log.Sync(); return log.GetPosition();}
+  //cut the log back to a checkpointed end, records after it are written again on replay
+  void RestoreLog(const SegmentedLogPosition& pos){log.Truncate(pos);}
+};
+//historical dataservice for list inquiries
+//keyed on record, not list
+class BondListIqHistoricalData: public HistoricalDataService<ListInquiry<Bond> >, public Snapshottable
+{
+private:
+  int counter;//count record to determine the key
+  map<string, ListInquiry<Bond> > listHistoricalCache;
+  ListenerList<ListInquiry<Bond> > listListeners;//listeners
+  BondListIqHistoricalConnector& b_historical;//connector to output file
+public:
+  BondListIqHistoricalData(BondListIqHistoricalConnector& src):b_historical(src){counter=1;}//constructor
+  //checkpoint the key counter and the end of the log, so a warm start continues the key sequence
+  //from a log holding nothing written after the checkpoint
+  virtual string GetSnapshotName() const{return "history.listinquiries";}
+  virtual void SaveSnapshot(SnapshotWriter& w) const{w.Put(counter); w.Put(b_historical.GetLogPosition());}
+  virtual void LoadSnapshot(SnapshotReader& r){
+    counter=r.Get<int>();
+    SegmentedLogPosition pos=r.Get<SegmentedLogPosition>();
+    if(r.IsGood()) b_historical.RestoreLog(pos);
+  }
+  // Get data on our service given a key
+  virtual ListInquiry<Bond>& GetData(string key){return listHistoricalCache.find(key)->second;}
+
+  // The callback that a Connector should invoke for any new or updated data
+  virtual void OnMessage(ListInquiry<Bond> &data){}//do nothing
+
+  // Add a listener to the Service for callbacks on add, remove, and update events
+  // for data to the Service.
+  virtual void AddListener(ServiceListener<ListInquiry<Bond> > *listener){listListeners.Add(listener);}
+  //remove a listener, a dispatch already under way may still call it
+  virtual void RemoveListener(ServiceListener<ListInquiry<Bond> > *listener){listListeners.Remove(listener);}
+
+  // Get all listeners on the Service.
+  virtual const vector< ServiceListener<ListInquiry<Bond> >* >& GetListeners() const{return listListeners.Snapshot();}
+  //persist data to a store
+  virtual void PersistData(string persistKey, const ListInquiry<Bond>& data){
+  	b_historical.Write(persistKey,data);//publish data to file
+  }
+  //set key for persist data
+  void SetPersistKey(ListInquiry<Bond>& data){
+  	//get key from counter and increment counter
+  	string k=to_string(counter); ++counter;
+  	PersistData(k,data);
+  }
+};
+
+class BondListIqHistoricalListener: public ServiceListener<ListInquiry<Bond> >
+{
+private:
+	BondListIqHistoricalData& b_historical_data;//to flow into
+public:
+	BondListIqHistoricalListener(BondListIqHistoricalData& src): b_historical_data(src){}
+	// Listener callback to process an update event to the Service
+  virtual void ProcessUpdate(ListInquiry<Bond> &data){b_historical_data.SetPersistKey(data);}//every state the list moves through
+
+  // Listener callback to process a remove event to the Service
+  virtual void ProcessRemove(ListInquiry<Bond> &data){}
+
+  // Listener callback to process an add event to the Service
+  virtual void ProcessAdd(ListInquiry<Bond> &data){b_historical_data.SetPersistKey(data);}
+};
+
+//implement publish
+bool BondListIqHistoricalConnector::Write(const string& persistKey, const ListInquiry<Bond>& data){
+  buffer.Reset();
+  WriteRecord<CsvRecordWriter>(buffer,persistKey,data);//format key, list fields and legs into the buffer
+  if(log.Append(buffer.Data(),buffer.Size())) return true;//write to the live segment
+  cout<<"Cannot write record "<<persistKey<<" to "<<log.GetBasePath()<<"\n";
+  return false;
+}
+
 //implement publish
-void BondIqHistoricalConnector::Publish(pair<string, Inquiry<Bond> > &data1){
-	ofstream file;
-  file.open("./Output/Historical/allinquiries.txt",ios_base::app);//open the file to append
-   //get key
-	string k=data1.first;
-	file<<k<<",";
-  Inquiry<Bond> data=data1.second;//get price stream
-  string iqid=data.GetInquiryId();//get inquiry id
-  file<<iqid<<",";
-   Bond bnd=data.GetProduct();//get prodcut of data
-   string bondid=bnd.GetProductId();//get bond cusip
-   file<<bondid<<",";//write cusip to file
-   Side theside=data.GetSide();//get side
-   if(theside==BUY){
-    file<<"BUY,";
-   }
-   else{
-    file<<"SELL,";
-   }
-   long q=data.GetQuantity();//get quantity
-   file<<to_string(q)<<",";
-   double price=data.GetPrice();//get bid price
-   string p_str=PriceProcess(price);//convert to string
-   file<<p_str<<",";//write to file
-   InquiryState s=data.GetState();//get inquiry state
-   switch(s){
-    case RECEIVED:
-      file<<"RECEIVED\n"; break;
-    case QUOTED:
-      file<<"QUOTED\n";break;
-    case REJECTED:
-      file<<"REJECTED\n";break;
-    case CUSTOMER_REJECTED:
-      file<<"CUSTOMER_REJECTED\n";break;
-    case DONE:
-      file<<"DONE\n";break;
-   }
+bool BondIqHistoricalConnector::Write(const string& persistKey, const Inquiry<Bond>& data){
+  buffer.Reset();
+  WriteRecord<CsvRecordWriter>(buffer,persistKey,data);//format key and fields into the buffer
+  if(log.Append(buffer.Data(),buffer.Size())) return true;//write to the live segment
+  cout<<"Cannot write record "<<persistKey<<" to "<<log.GetBasePath()<<"\n";
+  return false;
 }
 
 #endif
\ No newline at end of file
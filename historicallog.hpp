@@ -0,0 +1,319 @@
+/*
+implement segmented, rotating log files for historical data connectors
+author: Gaoxian Song
+*/
+#ifndef HistoricalLog_HPP
+#define HistoricalLog_HPP
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+//when the live segment of a historical log is closed and a new one is started
+//a zero value disables the corresponding trigger
+class SegmentRotationPolicy
+{
+public:
+  size_t maxBytes;//rotate once the live segment reaches this size
+  long maxSeconds;//rotate once the live segment has been open this long
+  unsigned indexStride;//keep one record offset in the footer index every indexStride records
+  SegmentRotationPolicy(size_t maxBytes_=1<<20, long maxSeconds_=0, unsigned indexStride_=64):
+    maxBytes(maxBytes_),maxSeconds(maxSeconds_),indexStride(indexStride_){}
+};
+
+//footer written at the very end of a closed segment, after the sparse index
+//layout of a closed segment: header line, records, uint64 index[indexCount], footer
+struct SegmentFooter
+{
+  char magic[8];//always "HSEGIDX1"
+  uint64_t recordCount;//number of records in the segment, header excluded
+  uint64_t dataBegin;//offset of the first record
+  uint64_t dataEnd;//offset one past the last record, the index starts here
+  uint32_t indexStride;//index[k] is the offset of record k*indexStride
+  uint32_t indexCount;//number of entries in the index
+  int64_t openTime;//when the segment was started
+  int64_t closeTime;//when the segment was closed
+};
+
+const char SEGMENT_MAGIC[8]={'H','S','E','G','I','D','X','1'};
+
+//name of the closed segment with sequence number seq, e.g. position.txt.000003
+string SegmentPath(const string& basePath, int seq){
+  char suffix[16];
+  snprintf(suffix,sizeof(suffix),".%06d",seq);
+  return basePath+suffix;
+}
+
+bool FileExists(const string& path){
+  struct stat st;
+  return stat(path.c_str(),&st)==0;
+}
+
+//where a log stood, saved with a checkpoint so a warm start can cut the log back to it
+struct SegmentedLogPosition
+{
+  int64_t segment;//sequence number the live segment was to get when closed
+  uint64_t size;//bytes in the live segment
+};
+
+//append-only writer: records go to the live file basePath, which is sealed with a footer
+//and renamed to basePath.NNNNNN when the rotation policy triggers
+class SegmentedLogWriter
+{
+private:
+  string basePath;//path of the live segment
+  string header;//header line repeated at the top of every segment
+  SegmentRotationPolicy policy;
+  int fd;//descriptor of the live segment
+  int nextSeq;//sequence number the live segment gets when closed
+  uint64_t size;//bytes in the live segment
+  uint64_t dataBegin;//offset of the first record in the live segment
+  uint64_t recordCount;//records in the live segment
+  vector<uint64_t> index;//sparse record offsets of the live segment
+  unsigned indexStride;//stride of index, fixed for the life of the live segment
+  time_t openTime;//when the live segment was started
+  void OpenLive();//open or create the live segment
+  //write the whole buffer to the live segment; on failure cut off what was written and return false
+  bool WriteAll(const char* data, size_t len);
+public:
+  SegmentedLogWriter(const string& basePath_, const string& header_, const SegmentRotationPolicy& policy_=SegmentRotationPolicy());
+  ~SegmentedLogWriter();
+  //append one record; line must end with '\n'; false if it could not be written, the segment is then unchanged
+  bool Append(const char* line, size_t len);
+  bool Append(const string& line){return Append(line.data(),line.size());}
+  //seal the live segment with its footer and start a new one
+  void Rotate();
+  //change the policy; a new index stride applies from the next segment, the live one keeps its own
+  void SetRotationPolicy(const SegmentRotationPolicy& src){policy=src;}
+  //make every record appended so far durable
+  void Sync(){if(fd>=0) fdatasync(fd);}
+  //current end of the log
+  SegmentedLogPosition GetPosition() const;
+  //drop every record appended after pos, reopening a segment sealed since; false if the log no longer reaches pos
+  bool Truncate(const SegmentedLogPosition& pos);
+  const string& GetBasePath() const{return basePath;}
+  int GetNextSegment() const{return nextSeq;}
+};
+
+//read-only view of a closed segment through mmap
+//safe to use from a separate process while the writer keeps appending to the live segment
+class SegmentedLogReader
+{
+private:
+  int fd;
+  const char* base;//start of the mapping
+  size_t length;//length of the mapping
+  SegmentFooter footer;
+  const char* index;//sparse index inside the mapping, not necessarily aligned
+  bool valid;//whether the file carries a well-formed footer
+public:
+  SegmentedLogReader(const string& path);
+  ~SegmentedLogReader();
+  bool IsValid() const{return valid;}
+  uint64_t GetRecordCount() const{return valid?footer.recordCount:0;}
+  const SegmentFooter& GetFooter() const{return footer;}
+  //header line of the segment, without the trailing newline
+  string GetHeader() const;
+  //get record i without the trailing newline; returns false if i is out of range
+  bool GetRecord(uint64_t i, const char*& data, size_t& len) const;
+  string GetRecord(uint64_t i) const;
+  //list the closed segments of a log in sequence order
+  static vector<string> ListSegments(const string& basePath);
+};
+
+SegmentedLogWriter::SegmentedLogWriter(const string& basePath_, const string& header_, const SegmentRotationPolicy& policy_):
+  basePath(basePath_),header(header_),policy(policy_),fd(-1),nextSeq(1),size(0),dataBegin(0),recordCount(0),indexStride(0),openTime(0)
+{
+  while(FileExists(SegmentPath(basePath,nextSeq))) ++nextSeq;//continue after the last closed segment
+  OpenLive();
+}
+
+SegmentedLogWriter::~SegmentedLogWriter(){
+  if(fd>=0) close(fd);//the live segment stays unsealed so the next run keeps appending to it
+}
+
+void SegmentedLogWriter::OpenLive(){
+  fd=open(basePath.c_str(),O_WRONLY|O_CREAT|O_APPEND,0644);
+  openTime=time(nullptr);
+  size=0; dataBegin=0; recordCount=0; index.clear();
+  indexStride=policy.indexStride;
+  if(fd<0) return;
+  //rebuild the offsets of a live segment left over from a previous run
+  ifstream existing(basePath.c_str(),ios_base::binary);
+  string line;
+  bool first=true;
+  while(getline(existing,line)){
+    uint64_t len=line.size()+1;
+    if(first){first=false; dataBegin=len;}
+    else{
+      if(indexStride>0 && recordCount%indexStride==0) index.push_back(size);
+      ++recordCount;
+    }
+    size+=len;
+  }
+  if(size==0){
+    //fresh segment, start with the header line
+    string h=header+"\n";
+    WriteAll(h.data(),h.size());
+    dataBegin=size;
+  }
+}
+
+bool SegmentedLogWriter::WriteAll(const char* data, size_t len){
+  uint64_t start=size;
+  while(len>0){
+    ssize_t n=write(fd,data,len);
+    if(n<=0){
+      //disk full or closed descriptor; cut off a partial write so the segment stays whole records
+      if(size>start && ftruncate(fd,start)==0) size=start;
+      return false;
+    }
+    data+=n; len-=n; size+=n;
+  }
+  return true;
+}
+
+bool SegmentedLogWriter::Append(const char* line, size_t len){
+  if(fd<0) return false;
+  bool full=policy.maxBytes>0 && size+len>policy.maxBytes && recordCount>0;
+  bool expired=policy.maxSeconds>0 && time(nullptr)-openTime>=policy.maxSeconds && recordCount>0;
+  if(full || expired) Rotate();
+  if(fd<0) return false;//the new live segment could not be opened
+  uint64_t offset=size;
+  if(!WriteAll(line,len)) return false;
+  if(indexStride>0 && recordCount%indexStride==0) index.push_back(offset);
+  ++recordCount;
+  return true;
+}
+
+void SegmentedLogWriter::Rotate(){
+  if(fd<0) return;
+  SegmentFooter footer;
+  memcpy(footer.magic,SEGMENT_MAGIC,sizeof(footer.magic));
+  footer.recordCount=recordCount;
+  footer.dataBegin=dataBegin;
+  footer.dataEnd=size;
+  footer.indexStride=indexStride;
+  footer.indexCount=index.size();
+  footer.openTime=openTime;
+  footer.closeTime=time(nullptr);
+  if(!index.empty()) WriteAll((const char*)&index[0],index.size()*sizeof(uint64_t));
+  WriteAll((const char*)&footer,sizeof(footer));
+  fsync(fd);//a sealed segment must be complete before readers can see it
+  close(fd);
+  rename(basePath.c_str(),SegmentPath(basePath,nextSeq).c_str());//publish the closed segment
+  ++nextSeq;
+  OpenLive();
+}
+
+SegmentedLogPosition SegmentedLogWriter::GetPosition() const{
+  SegmentedLogPosition pos;
+  pos.segment=nextSeq;
+  pos.size=size;
+  return pos;
+}
+
+bool SegmentedLogWriter::Truncate(const SegmentedLogPosition& pos){
+  if(pos.segment>nextSeq){
+    cout<<"Historical log "<<basePath<<" has fewer segments than its checkpoint\n";
+    return false;
+  }
+  if(fd>=0) close(fd);
+  fd=-1;
+  if(pos.segment<nextSeq){
+    //the segment that was live at the checkpoint has been sealed since, later ones hold only newer records
+    for(int seq=nextSeq-1;seq>pos.segment;--seq) unlink(SegmentPath(basePath,seq).c_str());
+    rename(SegmentPath(basePath,pos.segment).c_str(),basePath.c_str());//its footer is cut off below
+    nextSeq=pos.segment;
+  }
+  struct stat st;
+  bool reaches=stat(basePath.c_str(),&st)==0 && uint64_t(st.st_size)>=pos.size;
+  if(!reaches) cout<<"Historical log "<<basePath<<" is shorter than its checkpoint\n";
+  else if(truncate(basePath.c_str(),pos.size)!=0) cout<<"Cannot truncate historical log "<<basePath<<"\n";
+  OpenLive();
+  return reaches;
+}
+
+SegmentedLogReader::SegmentedLogReader(const string& path):fd(-1),base(nullptr),length(0),index(nullptr),valid(false)
+{
+  memset(&footer,0,sizeof(footer));
+  fd=open(path.c_str(),O_RDONLY);
+  if(fd<0) return;
+  struct stat st;
+  if(fstat(fd,&st)!=0 || st.st_size<(off_t)sizeof(SegmentFooter)) return;
+  length=st.st_size;
+  void* m=mmap(nullptr,length,PROT_READ,MAP_PRIVATE,fd,0);
+  if(m==MAP_FAILED){length=0; return;}
+  base=(const char*)m;
+  memcpy(&footer,base+length-sizeof(SegmentFooter),sizeof(SegmentFooter));
+  if(memcmp(footer.magic,SEGMENT_MAGIC,sizeof(footer.magic))!=0) return;
+  //a corrupt or truncated footer must not point outside the mapping
+  if(footer.dataEnd>length-sizeof(SegmentFooter)) return;
+  if(footer.dataEnd+uint64_t(footer.indexCount)*sizeof(uint64_t)+sizeof(SegmentFooter)!=length) return;
+  if(footer.dataBegin>footer.dataEnd) return;
+  index=base+footer.dataEnd;
+  valid=true;
+}
+
+SegmentedLogReader::~SegmentedLogReader(){
+  if(base) munmap((void*)base,length);
+  if(fd>=0) close(fd);
+}
+
+string SegmentedLogReader::GetHeader() const{
+  if(!valid || footer.dataBegin==0) return "";
+  return string(base,footer.dataBegin-1);
+}
+
+bool SegmentedLogReader::GetRecord(uint64_t i, const char*& data, size_t& len) const{
+  if(!valid || i>=footer.recordCount) return false;
+  const char* end=base+footer.dataEnd;
+  const char* p;
+  uint64_t skip;
+  if(footer.indexStride>0 && i/footer.indexStride<footer.indexCount){
+    uint64_t offset;
+    memcpy(&offset,index+(i/footer.indexStride)*sizeof(uint64_t),sizeof(offset));
+    if(offset<footer.dataBegin || offset>=footer.dataEnd) return false;//corrupt index entry
+    p=base+offset;//jump to the closest indexed record
+    skip=i%footer.indexStride;
+  }
+  else{
+    p=base+footer.dataBegin;
+    skip=i;
+  }
+  for(;skip>0;--skip){
+    const char* nl=(const char*)memchr(p,'\n',end-p);
+    if(!nl || nl+1>=end) return false;//fewer records than the footer counts
+    p=nl+1;
+  }
+  const char* nl=(const char*)memchr(p,'\n',end-p);
+  data=p;
+  len=nl?nl-p:end-p;
+  return true;
+}
+
+string SegmentedLogReader::GetRecord(uint64_t i) const{
+  const char* data; size_t len;
+  if(!GetRecord(i,data,len)) return "";
+  return string(data,len);
+}
+
+vector<string> SegmentedLogReader::ListSegments(const string& basePath){
+  vector<string> result;
+  for(int seq=1;FileExists(SegmentPath(basePath,seq));++seq)
+    result.push_back(SegmentPath(basePath,seq));
+  return result;
+}
+
+#endif
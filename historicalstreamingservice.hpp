@@ -12,21 +12,42 @@ author: Gaoxian Song
 //paired with persist key
 class BondStreamHistoricalConnector: public Connector<pair<string,PriceStream<Bond> > >
 {
+private:
+  RecordBuffer buffer;//preallocated buffer the records are formatted into
+  SegmentedLogWriter log;//rotating segments of ./Output/Historical/streaming.txt
 public:
+  BondStreamHistoricalConnector():log("./Output/Historical/streaming.txt","persistKey,CUSIP,BidPrice,BidVisible,BidHidden,OfferPrice,OfferVisible,OfferHidden"){}//constructor
   // Publish data to the Connector
-  virtual void Publish(pair<string, PriceStream<Bond> > &data);
+  virtual void Publish(pair<string, PriceStream<Bond> > &data){Write(data.first,data.second);}
+  //format and write one record without pairing the key and data first; false if it could not be written
+  bool Write(const string& persistKey, const PriceStream<Bond>& data);
+  //set when the live segment is rotated
+  void SetRotationPolicy(const SegmentRotationPolicy& policy){log.SetRotationPolicy(policy);}
+  //sync the log and return its end, taken with a checkpoint
+  SegmentedLogPosition GetLogPosition(){log.Sync(); return log.GetPosition();}
+  //cut the log back to a checkpointed end, records after it are written again on replay
+  void RestoreLog(const SegmentedLogPosition& pos){log.Truncate(pos);}
 };
 //historical dataservice for bond position
 //keyed on record, not product
-class BondStreamHistoricalData: public HistoricalDataService<PriceStream<Bond> >
+class BondStreamHistoricalData: public HistoricalDataService<PriceStream<Bond> >, public Snapshottable
 {
 private:
   int counter;//count record to determine the key
   map<string, PriceStream<Bond> > bondHistoricalCache;
-  vector<ServiceListener<PriceStream<Bond> >* > bondListeners;//listeners
+  ListenerList<PriceStream<Bond> > bondListeners;//listeners
   BondStreamHistoricalConnector& b_historical;//connector to output file
 public:
   BondStreamHistoricalData(BondStreamHistoricalConnector& src):b_historical(src){counter=1;}//constructor
+  //checkpoint the key counter and the end of the log, so a warm start continues the key sequence
+  //from a log holding nothing written after the checkpoint
+  virtual string GetSnapshotName() const{return "history.streams";}
+  virtual void SaveSnapshot(SnapshotWriter& w) const{w.Put(counter); w.Put(b_historical.GetLogPosition());}
+  virtual void LoadSnapshot(SnapshotReader& r){
+    counter=r.Get<int>();
+    SegmentedLogPosition pos=r.Get<SegmentedLogPosition>();
+    if(r.IsGood()) b_historical.RestoreLog(pos);
+  }
   // Get data on our service given a key
   virtual PriceStream<Bond>& GetData(string key){return bondHistoricalCache.find(key)->second;}
 
@@ -35,20 +56,21 @@ public:
 
   // Add a listener to the Service for callbacks on add, remove, and update events
   // for data to the Service.
-  virtual void AddListener(ServiceListener<PriceStream<Bond> > *listener){bondListeners.push_back(listener);}
+  virtual void AddListener(ServiceListener<PriceStream<Bond> > *listener){bondListeners.Add(listener);}
+  //remove a listener, a dispatch already under way may still call it
+  virtual void RemoveListener(ServiceListener<PriceStream<Bond> > *listener){bondListeners.Remove(listener);}
 
   // Get all listeners on the Service.
-  virtual const vector< ServiceListener<PriceStream<Bond> >* >& GetListeners() const{return bondListeners;}
+  virtual const vector< ServiceListener<PriceStream<Bond> >* >& GetListeners() const{return bondListeners.Snapshot();}
   //persist data to a store
   virtual void PersistData(string persistKey, const PriceStream<Bond>& data){
-  	pair<string, PriceStream<Bond> > dataPair=make_pair(persistKey,data);//construct data pair
-  	b_historical.Publish(dataPair);//publish data to file
+  	b_historical.Write(persistKey,data);//publish data to file
   }
   //set key for persist data
   void SetPersistKey(PriceStream<Bond>& data){
   	//get key from counter and increment counter
   	string k=to_string(counter); ++counter;
-  	PriceStream<Bond> data_copy=data; PersistData(k,data_copy);
+  	PersistData(k,data);
   }
 };
 
@@ -69,32 +91,12 @@ public:
 };
 
 //implement publish
-void BondStreamHistoricalConnector::Publish(pair<string, PriceStream<Bond> > &data1){
-	ofstream file;
-  file.open("./Output/Historical/streaming.txt",ios_base::app);//open the file to append
-   //get key
-	string k=data1.first;
-	file<<k<<",";
-  PriceStream<Bond> data=data1.second;//get price stream
-   Bond bnd=data.GetProduct();//get prodcut of data
-   string bondid=bnd.GetProductId();//get bond cusip
-   file<<bondid<<",";//write cusip to file
-   PriceStreamOrder bid_order=data.GetBidOrder();//get bid order
-   double price=bid_order.GetPrice();//get bid price
-   string p_str=PriceProcess(price);//convert to string
-   file<<p_str<<",";//write to file
-   long visible=bid_order.GetVisibleQuantity();//get visible qty
-   file<<to_string(visible)<<",";//write to file
-   long hidden=bid_order.GetHiddenQuantity();//get hidden qty
-   file<<to_string(hidden)<<",";//write to file
-   PriceStreamOrder offer_order=data.GetOfferOrder();//get offer order
-   price=offer_order.GetPrice();//get price
-   p_str=PriceProcess(price);//convert to string
-   file<<p_str<<",";//write to file
-   visible=offer_order.GetVisibleQuantity();//get visible qty
-   file<<to_string(visible)<<",";
-   hidden=offer_order.GetHiddenQuantity();
-   file<<to_string(hidden)<<"\n";
+bool BondStreamHistoricalConnector::Write(const string& persistKey, const PriceStream<Bond>& data){
+  buffer.Reset();
+  WriteRecord<CsvRecordWriter>(buffer,persistKey,data);//format key and fields into the buffer
+  if(log.Append(buffer.Data(),buffer.Size())) return true;//write to the live segment
+  cout<<"Cannot write record "<<persistKey<<" to "<<log.GetBasePath()<<"\n";
+  return false;
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,81 @@
+/*
+implement fixed-size inline product identifiers and numeric message ids
+author: Gaoxian Song
+*/
+#ifndef Identifiers_HPP
+#define Identifiers_HPP
+
+#include <string>
+#include <cstring>
+#include <functional>
+#include <stdint.h>
+
+using namespace std;
+
+//characters held inline, enough for a 9 character CUSIP or a 12 character ISIN
+const int INLINE_ID_CHARS=12;
+
+/**
+ * Product identifier held in 16 bytes: the characters zero padded to 12 and a 32-bit hash of the
+ * whole identifier computed once at construction. Copying one never allocates, and comparing two
+ * is two 8-byte word compares over characters and hash together.
+ * An identifier longer than 12 characters keeps its first 12 and is told apart from others with the
+ * same prefix by the hash only, which CUSIPs and ISINs never need.
+ */
+class InlineId
+{
+private:
+  char chars[INLINE_ID_CHARS];
+  uint32_t hash;
+  static uint32_t Hash(const char* data, size_t len){
+    //FNV-1a
+    uint32_t h=2166136261u;
+    for(size_t i=0;i<len;++i){
+      h^=(unsigned char)data[i];
+      h*=16777619u;
+    }
+    return h;
+  }
+public:
+  InlineId(){memset(chars,0,INLINE_ID_CHARS); hash=Hash(chars,0);}
+  explicit InlineId(const string& id){
+    memset(chars,0,INLINE_ID_CHARS);
+    memcpy(chars,id.data(),id.size()<INLINE_ID_CHARS?id.size():INLINE_ID_CHARS);
+    hash=Hash(id.data(),id.size());
+  }
+  uint32_t GetHash() const{return hash;}
+  string ToString() const{return string(chars,strnlen(chars,INLINE_ID_CHARS));}
+  bool operator==(const InlineId& other) const{
+    uint64_t a[2], b[2];
+    memcpy(a,this,sizeof(a));
+    memcpy(b,&other,sizeof(b));
+    return ((a[0]^b[0])|(a[1]^b[1]))==0;
+  }
+  bool operator!=(const InlineId& other) const{return !(*this==other);}
+};
+
+namespace std
+{
+  //the hash is already computed, unordered containers use it as is
+  template<>
+  struct hash<InlineId>
+  {
+    size_t operator()(const InlineId& id) const{return id.GetHash();}
+  };
+}
+
+//integer id of a trade, order or inquiry, positive when valid
+typedef int64_t NumericId;
+
+//numeric id of a text id made only of decimal digits, -1 for anything else or on overflow
+inline NumericId ParseNumericId(const string& id){
+  if(id.empty() || id.size()>18) return -1;
+  NumericId v=0;
+  for(size_t i=0;i<id.size();++i){
+    if(id[i]<'0' || id[i]>'9') return -1;
+    v=10*v+(id[i]-'0');
+  }
+  return v;
+}
+
+#endif
@@ -8,10 +8,27 @@
 #define INQUIRY_SERVICE_HPP
 
 #include "soa.hpp"
+#include "listenerlist.hpp"
 #include "tradebookingservice.hpp"
+#include "referencedataservice.hpp"
+#include <deque>
+#include <cstdlib>
+#include <stdexcept>
 
 // Various inqyury states
 enum InquiryState { RECEIVED, QUOTED, DONE, REJECTED, CUSTOMER_REJECTED };
+const int INQUIRY_STATES=5;
+
+//allowed moves of the inquiry lifecycle, INQUIRY_TRANSITIONS[from][to]
+//a new inquiry with the id of one that is finished starts again at RECEIVED
+const bool INQUIRY_TRANSITIONS[INQUIRY_STATES][INQUIRY_STATES]={
+  //to: RECEIVED QUOTED DONE   REJECTED CUSTOMER_REJECTED
+  {false, true,  false, true,  false},//from RECEIVED
+  {false, false, true,  true,  true },//from QUOTED
+  {true,  false, false, false, false},//from DONE
+  {true,  false, false, false, false},//from REJECTED
+  {true,  false, false, false, false} //from CUSTOMER_REJECTED
+};
 
 /**
  * Inquiry object modeling a customer inquiry from a client.
@@ -24,7 +41,7 @@ class Inquiry
 public:
 
   // ctor for an inquiry
-  Inquiry(string _inquiryId, const T &_product, Side _side, long _quantity, double _price, InquiryState _state);
+  Inquiry(string _inquiryId, const ProductHandle<T> &_product, Side _side, long _quantity, double _price, InquiryState _state);
 
   // Get the inquiry ID
   const string& GetInquiryId() const;
@@ -32,6 +49,9 @@ public:
   // Get the product
   const T& GetProduct() const;
 
+  // Get the shared handle of the product, to build further messages without interning it again
+  const ProductHandle<T>& GetProductHandle() const{return product;}
+
   // Get the side on the inquiry
   Side GetSide() const;
 
@@ -51,7 +71,7 @@ public:
 
 private:
   string inquiryId;
-  T product;
+  ProductHandle<T> product;
   Side side;
   long quantity;
   double price;
@@ -59,6 +79,40 @@ private:
 
 };
 
+//one bond of a list inquiry
+template<typename T>
+struct ListInquiryLeg
+{
+  ProductHandle<T> product;
+  Side side;
+  long quantity;
+  double price;//price quoted for the leg, 0 until quoted
+};
+
+/**
+ * List (portfolio) inquiry: a client asks for one response covering several bonds at once.
+ * The list moves through the same lifecycle as a single inquiry and is traded or rejected whole.
+ * Type T is the product type.
+ */
+template<typename T>
+class ListInquiry
+{
+public:
+  ListInquiry(const string& _listId, InquiryState _state):listId(_listId),state(_state){}
+  const string& GetListId() const{return listId;}
+  InquiryState GetState() const{return state;}
+  void SetState(InquiryState s){state=s;}
+  void AddLeg(const ProductHandle<T>& product, Side side, long quantity);
+  int GetLegCount() const{return legs.size();}
+  const ListInquiryLeg<T>& GetLeg(int i) const{return legs[i];}
+  //set the quoted price of every leg, in leg order
+  void SetPrices(const vector<double>& prices);
+private:
+  string listId;
+  vector<ListInquiryLeg<T> > legs;
+  InquiryState state;
+};
+
 /**
  * Service for customer inquirry objects.
  * Keyed on inquiry identifier (NOTE: this is NOT a product identifier since each inquiry must be unique).
@@ -77,60 +131,177 @@ public:
   virtual void RejectInquiry(const string &inquiryId) = 0;
 
 };
+/*
+pre-trade check consulted before a quote is sent back to the client
+T is product type
+*/
+template<typename T>
+class QuoteCheck
+{
+public:
+  //return false to reject the inquiry instead of quoting price
+  virtual bool Accept(const Inquiry<T>& inquiry, double price)=0;
+  //return false to reject the whole list instead of quoting prices, one per leg
+  virtual bool Accept(const ListInquiry<T>& list, const vector<double>& prices)=0;
+};
+/*
+prices the quote sent back for an inquiry
+T is product type
+*/
+template<typename T>
+class InquiryPricer
+{
+public:
+  //quote for the inquiry, 0 if it cannot be priced
+  virtual double Quote(const Inquiry<T>& inquiry)=0;
+  //quote every leg of a list into prices, 0 for a leg that cannot be priced
+  //quotes the legs one by one unless the pricer can do better
+  virtual void QuoteList(const ListInquiry<T>& list, vector<double>& prices);
+};
 class BondInquiryService;
 //publish only connector
 class BondPublishIqConnector: public Connector<Inquiry<Bond> >
 {
 public:
     virtual void Publish(Inquiry<Bond> &data);
-    virtual void SetPublish(Inquiry<Bond> &data, BondInquiryService& b_iqure);
 };
+//whether an inquiry is finished
+inline bool IsTerminal(InquiryState s){return s==DONE || s==REJECTED || s==CUSTOMER_REJECTED;}
+
+//inquiry held in the live pool, with the product as a dense id
+struct InquiryRecord
+{
+  NumericId inquiryId;
+  int product;//dense id from BondReferenceDataService
+  Side side;
+  InquiryState state;
+  long quantity;
+  double price;
+};
+
+/**
+ * Slab of live inquiries keyed on integer inquiry id. Slots of finished inquiries go on a free
+ * list and are reused, and the id index is open addressing with backward shift deletion, so
+ * neither taking an inquiry nor retiring one allocates once the pool has reached its peak.
+ */
+class InquiryPool
+{
+private:
+  vector<InquiryRecord> slab;
+  vector<int> freeSlots;
+  vector<int> index;//slot of each id, -1 when empty; the size is a power of two
+  int live;
+  size_t Home(NumericId id) const{return (uint64_t(id)*11400714819323198485ULL)>>(64-indexBits);}
+  int indexBits;
+  void Grow();
+public:
+  InquiryPool():live(0),indexBits(10){index.assign(1<<indexBits,-1);}
+  //slot of a live inquiry, -1 if there is none
+  int Find(NumericId inquiryId) const;
+  //take a slot for a new inquiry
+  int Add(const InquiryRecord& record);
+  //free the slot of a finished inquiry
+  void Remove(int slot);
+  InquiryRecord& Get(int slot){return slab[slot];}
+  int GetLiveCount() const{return live;}
+  int GetCapacity() const{return slab.size();}
+};
+
+//a requested move of one inquiry to a new state
+struct InquiryEvent
+{
+  NumericId inquiryId;
+  InquiryState to;
+  double price;//quote price for a move to QUOTED
+};
+/**
+ * Inquiries move through their lifecycle by events taken off a queue one at a time.
+ * New inquiries, quotes, rejections and client replies only enqueue an event, so a listener
+ * that quotes from inside a callback never re-enters the service; the first caller drains the
+ * queue and the stack stays one level deep however many inquiries are in flight.
+ * Each event is checked against INQUIRY_TRANSITIONS and the cached inquiry is updated in place.
+ * Live inquiries are compact records in an InquiryPool keyed on the numeric inquiry id; once an
+ * inquiry is finished and listeners (the historical service among them) have seen it, it leaves
+ * the pool, so memory follows the number of open inquiries rather than the day's total.
+ */
 class BondInquiryService: public InquiryService<Bond>
 {
 private:
-  map<string, Inquiry<Bond> > bondInquiryCache;
-  vector< ServiceListener<Inquiry<Bond> >* > bondInquiryListeners;
+  const BondReferenceDataService& refData;
+  InquiryPool bondInquiryCache;
+  vector<Inquiry<Bond> > lookup;//the inquiry last handed out, rebuilt from its record
+  long evicted;//finished inquiries dropped from the pool
+  ListenerList<Inquiry<Bond> > bondInquiryListeners;
   BondPublishIqConnector b_publish;
+  QuoteCheck<Bond>* quoteCheck;//pre-trade check, null if quotes go out unchecked
+  deque<InquiryEvent> events;//pending moves in arrival order
+  deque<Inquiry<Bond> > arrivals;//inquiries of the pending moves to RECEIVED, in the same order
+  bool draining;//whether a caller further up the stack is already draining the queue
+  void Enqueue(const string& inquiryId, InquiryState to, double price);
+  //inquiry rebuilt from a pool record
+  Inquiry<Bond> ToInquiry(const InquiryRecord& record) const;
+  //drain the queue unless a caller further up already does
+  void Drain();
+  //apply one event and notify listeners
+  void Apply(const InquiryEvent& event);
 public:
-  BondInquiryService(BondPublishIqConnector& src):b_publish(src){}
+  BondInquiryService(const BondReferenceDataService& refData_, BondPublishIqConnector& src):
+    refData(refData_),evicted(0),b_publish(src),quoteCheck(nullptr),draining(false){}
+  //set the pre-trade check every quote must pass before it is sent
+  void SetQuoteCheck(QuoteCheck<Bond>* check){quoteCheck=check;}
   // Get data on our service given a key
-  virtual Inquiry<Bond>& GetData(string key){return bondInquiryCache.find(key)->second;}
+  // only open inquiries are held, the result stays valid until the next call into the service;
+  // throws out_of_range for an id that is not open, finished inquiries are only in the historical file
+  virtual Inquiry<Bond>& GetData(string key);
+  //number of open inquiries and of finished ones dropped so far
+  int GetOpenCount() const{return bondInquiryCache.GetLiveCount();}
+  long GetEvictedCount() const{return evicted;}
 
   // The callback that a Connector should invoke for any new or updated data
+  // a RECEIVED inquiry is new, any other state is the client moving an existing one
   virtual void OnMessage(Inquiry<Bond> &data);
 
   // Add a listener to the Service for callbacks on add, remove, and update events
   // for data to the Service.
-  virtual void AddListener(ServiceListener<Inquiry<Bond> > *listener){bondInquiryListeners.push_back(listener);}
+  virtual void AddListener(ServiceListener<Inquiry<Bond> > *listener){bondInquiryListeners.Add(listener);}
+  //remove a listener, a dispatch already under way may still call it
+  virtual void RemoveListener(ServiceListener<Inquiry<Bond> > *listener){bondInquiryListeners.Remove(listener);}
 
   // Get all listeners on the Service.
-  virtual const vector< ServiceListener<Inquiry<Bond> >* >& GetListeners() const {return bondInquiryListeners;}
+  virtual const vector< ServiceListener<Inquiry<Bond> >* >& GetListeners() const {return bondInquiryListeners.Snapshot();}
   //send a quote back to client
   virtual void SendQuote(const string& inquiryId, double price);
-  //reject an inquiry if a sell inquiry has price higher than 100 or a buy inquiry has price lower than 100
-  virtual void RejectInquiry(const string& inquiryId){} 
+  //reject an inquiry, e.g. when its quote fails the pre-trade check
+  virtual void RejectInquiry(const string& inquiryId);
 
 };
 
 //subscribe only connector
-class BondInquiryConnector: public Connector<Inquiry<Bond> >
+class BondInquiryConnector: public Connector<Inquiry<Bond> >, public Snapshottable
 {
 private:
    int counter;
 public:
    BondInquiryConnector(){counter=0;}//constructor
+   //number of input lines consumed
+   int GetCounter() const{return counter;}
+   //checkpoint the input offset
+   virtual string GetSnapshotName() const{return "inquiries.offset";}
+   virtual void SaveSnapshot(SnapshotWriter& w) const{w.Put(counter);}
+   virtual void LoadSnapshot(SnapshotReader& r){counter=r.Get<int>();}
    // Publish data to the Connector
   virtual void Publish(Inquiry<Bond> &data){}//do nothing
   //subscribe and return subscribed data
-  virtual void Subscribe(BondInquiryService& b_inquire, map<string, Bond> m_bond);
+  virtual void Subscribe(BondInquiryService& b_inquire, map<string, Bond>& m_bond);
 };
 
 class BondInquiryListener: public ServiceListener<Inquiry<Bond> >
 {
 private:
   BondInquiryService& b_inquire;
+  InquiryPricer<Bond>* pricer;//null to quote a fixed 100
 public:
-  BondInquiryListener(BondInquiryService& src):b_inquire(src){}
+  BondInquiryListener(BondInquiryService& src, InquiryPricer<Bond>* pricer_=nullptr):b_inquire(src),pricer(pricer_){}
    // Listener callback to process an add event to the Service
   virtual void ProcessAdd(Inquiry<Bond> &data);
 
@@ -138,11 +309,11 @@ public:
   virtual void ProcessRemove(Inquiry<Bond> &data){}
 
   // Listener callback to process an update event to the Service
-  virtual void ProcessUpdate(Inquiry<Bond> &data){data.SetState(DONE);}
+  virtual void ProcessUpdate(Inquiry<Bond> &data);
 };
 
 template<typename T>
-Inquiry<T>::Inquiry(string _inquiryId, const T &_product, Side _side, long _quantity, double _price, InquiryState _state) :
+Inquiry<T>::Inquiry(string _inquiryId, const ProductHandle<T> &_product, Side _side, long _quantity, double _price, InquiryState _state) :
   product(_product)
 {
   inquiryId = _inquiryId;
@@ -161,7 +332,7 @@ const string& Inquiry<T>::GetInquiryId() const
 template<typename T>
 const T& Inquiry<T>::GetProduct() const
 {
-  return product;
+  return product.Get();
 }
 
 template<typename T>
@@ -188,8 +359,28 @@ InquiryState Inquiry<T>::GetState() const
   return state;
 }
 
+template<typename T>
+void ListInquiry<T>::AddLeg(const ProductHandle<T>& product, Side side, long quantity){
+  ListInquiryLeg<T> leg={product,side,quantity,0};
+  legs.push_back(leg);
+}
+
+template<typename T>
+void ListInquiry<T>::SetPrices(const vector<double>& prices){
+  for(size_t i=0;i<legs.size() && i<prices.size();++i) legs[i].price=prices[i];
+}
+
+template<typename T>
+void InquiryPricer<T>::QuoteList(const ListInquiry<T>& list, vector<double>& prices){
+  prices.resize(list.GetLegCount());
+  for(int i=0;i<list.GetLegCount();++i){
+    const ListInquiryLeg<T>& leg=list.GetLeg(i);
+    prices[i]=Quote(Inquiry<T>(list.GetListId(),leg.product,leg.side,leg.quantity,0,RECEIVED));//the leg's handle, no registry lookup
+  }
+}
+
 //flow into service
-void BondInquiryConnector::Subscribe(BondInquiryService& b_inquire, map<string, Bond> m_bond){
+void BondInquiryConnector::Subscribe(BondInquiryService& b_inquire, map<string, Bond>& m_bond){
     ifstream file;
     file.open("./Input/inquiries.txt");//open file
     string line;//store one line
@@ -235,70 +426,182 @@ void BondInquiryConnector::Subscribe(BondInquiryService& b_inquire, map<string,
     bid2num=bid2num/32.0;
     double bid3num=int(p2[2]-'0')/256.0;//get part 3 of price
     double Ptotal=bid1num+bid2num+bid3num;//sum up price
-    Bond bnd=m_bond[bondId];//get bond
+    const Bond& bnd=m_bond[bondId];//get bond
     Inquiry<Bond> iq_bnd(inquireId,bnd,theside,qty,Ptotal,RECEIVED);
     b_inquire.OnMessage(iq_bnd);//flow data to service
 }
 
+int InquiryPool::Find(NumericId inquiryId) const{
+  size_t mask=index.size()-1;
+  for(size_t i=Home(inquiryId);;i=(i+1)&mask){
+    if(index[i]<0) return -1;
+    if(slab[index[i]].inquiryId==inquiryId) return index[i];
+  }
+}
+
+void InquiryPool::Grow(){
+  ++indexBits;
+  index.assign(size_t(1)<<indexBits,-1);
+  size_t mask=index.size()-1;
+  for(size_t k=0;k<slab.size();++k){
+    if(slab[k].inquiryId<0) continue;//free slot
+    size_t i=Home(slab[k].inquiryId);
+    while(index[i]>=0) i=(i+1)&mask;
+    index[i]=k;
+  }
+}
+
+int InquiryPool::Add(const InquiryRecord& record){
+  int slot;
+  if(!freeSlots.empty()){slot=freeSlots.back(); freeSlots.pop_back(); slab[slot]=record;}
+  else{slot=slab.size(); slab.push_back(record);}
+  ++live;
+  if(size_t(2*live)>index.size()) Grow();//keep the load factor at most a half, the new slot is included
+  else{
+    size_t mask=index.size()-1;
+    size_t i=Home(record.inquiryId);
+    while(index[i]>=0) i=(i+1)&mask;
+    index[i]=slot;
+  }
+  return slot;
+}
+
+void InquiryPool::Remove(int slot){
+  size_t mask=index.size()-1;
+  size_t i=Home(slab[slot].inquiryId);
+  while(index[i]!=slot) i=(i+1)&mask;
+  //shift later entries of the probe run back so no tombstone is needed
+  for(size_t j=(i+1)&mask;index[j]>=0;j=(j+1)&mask){
+    size_t h=Home(slab[index[j]].inquiryId);
+    //move j into the hole at i unless its home lies cyclically in (i, j]
+    if(((j-h)&mask)>=((j-i)&mask)){index[i]=index[j]; i=j;}
+  }
+  index[i]=-1;
+  slab[slot].inquiryId=-1;
+  freeSlots.push_back(slot);
+  --live;
+}
+
+Inquiry<Bond> BondInquiryService::ToInquiry(const InquiryRecord& r) const{
+  return Inquiry<Bond>(to_string(r.inquiryId),refData.GetHandle(r.product),r.side,r.quantity,r.price,r.state);
+}
+
+Inquiry<Bond>& BondInquiryService::GetData(string key){
+  int slot=bondInquiryCache.Find(ParseNumericId(key));
+  if(slot<0) throw out_of_range("no open inquiry "+key);
+  lookup.clear();
+  lookup.push_back(ToInquiry(bondInquiryCache.Get(slot)));
+  return lookup.back();
+}
+
 void BondInquiryService::OnMessage(Inquiry<Bond> &data){
-  //get inquiry state
-  InquiryState state1=data.GetState();
-  string iqId=data.GetInquiryId();//get inquiry id
-  map<string, Inquiry<Bond> >::iterator it=bondInquiryCache.find(iqId);
-  if(state1==RECEIVED){
-     //for the case of received
-    if(it==bondInquiryCache.end()){
-      bondInquiryCache.insert(make_pair(iqId,data));//insert data
-    }
-    else{
-      bondInquiryCache.erase(iqId);//erase old record
-      bondInquiryCache.insert(make_pair(iqId,data));//insert data
-    }
-    for(int i=0;i<bondInquiryListeners.size();++i){
-      //processAdd is called for receive state process
-      bondInquiryListeners[i]->ProcessAdd(data);
-    }
+  if(data.GetState()==RECEIVED) arrivals.push_back(data);
+  Enqueue(data.GetInquiryId(),data.GetState(),data.GetPrice());
+  Drain();
+}
+
+void BondInquiryService::Enqueue(const string& inquiryId, InquiryState to, double price){
+  InquiryEvent event;
+  event.inquiryId=ParseNumericId(inquiryId);
+  event.to=to;
+  event.price=price;
+  events.push_back(event);
+}
+
+void BondInquiryService::Drain(){
+  if(draining) return;//the caller further up picks the new events up
+  draining=true;
+  while(!events.empty()){
+    InquiryEvent event=events.front();
+    events.pop_front();
+    Apply(event);
   }
-  else if(state1==QUOTED){
-    //update it immediately
-    for(int i=0;i<bondInquiryListeners.size();++i){
-      //processupdate is called
-      bondInquiryListeners[i]->ProcessUpdate(data);
-    }
-    if(it==bondInquiryCache.end()){
-      bondInquiryCache.insert(make_pair(iqId,data));//insert data
+  draining=false;
+}
+
+void BondInquiryService::Apply(const InquiryEvent& event){
+  int slot=bondInquiryCache.Find(event.inquiryId);
+  if(event.to==RECEIVED){
+    Inquiry<Bond> data=arrivals.front();
+    arrivals.pop_front();
+    if(slot>=0){
+      cout<<"Inquiry "<<event.inquiryId<<" is still open\n";
+      return;
     }
-    else{
-      bondInquiryCache.erase(iqId);//erase old record
-      bondInquiryCache.insert(make_pair(iqId,data));//insert data
+    InquiryRecord record;
+    record.inquiryId=event.inquiryId;
+    record.product=refData.GetDenseId(data.GetProduct().GetId());
+    record.side=data.GetSide();
+    record.state=RECEIVED;
+    record.quantity=data.GetQuantity();
+    record.price=data.GetPrice();
+    if(record.inquiryId<=0 || record.product<0){
+      cout<<"Inquiry "<<data.GetInquiryId()<<" needs a positive numeric id and a known product\n";
+      return;
     }
+    bondInquiryCache.Add(record);
+    //processAdd is called for receive state process, every listener sees the same inquiry
+    Inquiry<Bond> inquiry=ToInquiry(record);
+    bondInquiryListeners.ProcessAdd(inquiry);
+    return;
+  }
+  if(slot<0){
+    //no such open inquiry
+    cout<<"Cache miss\n";
+    return;
+  }
+  InquiryRecord& record=bondInquiryCache.Get(slot);
+  InquiryState to=event.to;
+  if(!INQUIRY_TRANSITIONS[record.state][to]){
+    cout<<"Inquiry "<<event.inquiryId<<" cannot move from state "<<record.state<<" to "<<to<<"\n";
+    return;
+  }
+  //built once, checked and then handed to every listener
+  Inquiry<Bond> inquiry=ToInquiry(record);
+  if(to==QUOTED){
+    if(quoteCheck && !quoteCheck->Accept(inquiry,event.price)) to=REJECTED;//the quote would breach a limit
+    else record.price=event.price;//reset the price
+  }
+  record.state=to;
+  inquiry.SetPrice(record.price);
+  inquiry.SetState(to);
+  if(to==QUOTED) b_publish.Publish(inquiry);//send the quote to the client
+  bondInquiryListeners.ProcessUpdate(inquiry);
+  if(IsTerminal(to)){
+    //every listener has seen the final state, the historical service keeps the record from here
+    bondInquiryCache.Remove(slot);
+    ++evicted;
   }
 }
 
 void BondInquiryListener::ProcessAdd(Inquiry<Bond>& data){
    string iqId=data.GetInquiryId();//get inquiry id of data
-   double p=100;//set quote price to be 100
-   b_inquire.SendQuote(iqId,p);//send a quote of 100
+   double p=pricer?pricer->Quote(data):100;//quote from the pricer, or 100 without one
+   if(p>0) b_inquire.SendQuote(iqId,p);
+   else b_inquire.RejectInquiry(iqId);//no price to quote from
+}
+
+void BondInquiryListener::ProcessUpdate(Inquiry<Bond>& data){
+   if(data.GetState()!=QUOTED) return;
+   //the client always trades on our quote
+   Inquiry<Bond> reply=data;
+   reply.SetState(DONE);
+   b_inquire.OnMessage(reply);
 }
 
 void BondInquiryService::SendQuote(const string& inquiryId, double price){
-  map<string, Inquiry<Bond> >::iterator it=bondInquiryCache.find(inquiryId);
-  if(it==bondInquiryCache.end()){
-    //such inquiry does not exist
-    cout<<"Cache miss\n";
-    return;
-  }
-  it->second.SetPrice(price);//reset the price
-  b_publish.SetPublish(it->second,*this);//publish it
+  Enqueue(inquiryId,QUOTED,price);
+  Drain();
+}
+
+void BondInquiryService::RejectInquiry(const string& inquiryId){
+  Enqueue(inquiryId,REJECTED,0);
+  Drain();
 }
 
  void BondPublishIqConnector::Publish(Inquiry<Bond> &data){
     //transit to Quoted state
     data.SetState(QUOTED);
   }
-  void BondPublishIqConnector::SetPublish(Inquiry<Bond> &data, BondInquiryService& b_iqure){
-     Publish(data);
-     b_iqure.OnMessage(data);//flow into service
-  }
 
 #endif
@@ -0,0 +1,266 @@
+/*
+implement pre-trade limit checks on positions and pv01 for orders and quotes
+author: Gaoxian Song
+*/
+#ifndef LimitEngine_HPP
+#define LimitEngine_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cmath>
+#include <climits>
+#include "referencedataservice.hpp"
+#include "bookregistry.hpp"
+#include "positionservice.hpp"
+#include "riskservice.hpp"
+#include "executionservice.hpp"
+#include "inquiryservice.hpp"
+
+using namespace std;
+
+//which limit stopped an order or quote
+enum LimitType {CUSIP_LIMIT, BOOK_LIMIT, SECTOR_LIMIT};
+const int LIMIT_TYPES=3;
+
+/**
+ * Pre-trade limits on the position of each CUSIP, the gross position of each book and the
+ * net pv01 of each standard sector. Counters are indexed by dense product id and updated
+ * incrementally from position and risk listeners, so a check is a handful of array reads.
+ * Orders and quotes are assumed to fill into flowBook. A trade that takes an exposure
+ * further past its limit is rejected, one that reduces it is always accepted.
+ */
+class BondLimitEngine: public OrderCheck<Bond>, public QuoteCheck<Bond>
+{
+private:
+  BondReferenceDataService& refData;
+  //ids from BookRegistry of the books with a limit, plus the flow book
+  vector<int> books;
+  int flowBook;
+  //limits, LONG_MAX or HUGE_VAL when unlimited
+  vector<long> cusipLimit;//by dense id
+  long bookLimit[MAX_BOOKS];//by book id
+  double sectorLimit[STANDARD_SECTORS];
+  //exposure counters
+  vector<long> cusipPosition;//aggregate position by dense id
+  vector<vector<long> > bookPosition;//position by book id, then dense id, empty for untracked books
+  long bookGross[MAX_BOOKS];//sum of |position| over the bonds of each book
+  vector<double> bondPV01;//pv01 by dense id
+  vector<int> sectorOf;//standard sector a bond's exposure is counted in
+  double sectorExposure[STANDARD_SECTORS];//sum of position*pv01 over the bonds of each sector
+  //net quantity of a list by dense id and the bonds it touches, cleared after each list
+  vector<long> listNet;
+  vector<int> listBonds;
+  //check results
+  long accepted;
+  long rejected[LIMIT_TYPES];
+  //book id of a name, tracking it if it is new
+  int Book(const string& book);
+  //move the sector exposure of bond d to its current position and pv01
+  void UpdateExposure(int d, long oldPosition, double oldPV01);
+  //check a fill of signed quantity dq in bond d
+  bool Check(int d, long dq);
+public:
+  //pv01 holds the starting pv01 of every bond, refreshed afterwards from the risk service
+  BondLimitEngine(BondReferenceDataService& refData_, const map<string, double>& pv01, const string& flowBookName);
+  void SetCusipLimit(const string& productId, long limit);
+  void SetDefaultCusipLimit(long limit);
+  void SetBookLimit(const string& book, long limit);
+  void SetSectorLimit(BondSectorType sector, double limit){sectorLimit[sector]=limit;}
+  //take the full position of a product
+  void OnPosition(const Position<Bond>& position);
+  //take the pv01 of a bond
+  void OnPV01(const PV01<Bond>& pv01);
+  //an order buying (BID) or selling (OFFER) its visible and hidden quantity
+  virtual bool Accept(const ExecutionOrder<Bond>& order);
+  //a quote fills the other side of the client's inquiry
+  virtual bool Accept(const Inquiry<Bond>& inquiry, double price);
+  //a list is checked on its legs netted per bond and counts as one check
+  virtual bool Accept(const ListInquiry<Bond>& list, const vector<double>& prices);
+  long GetAcceptedCount() const{return accepted;}
+  long GetRejectedCount(LimitType type) const{return rejected[type];}
+  long GetRejectedCount() const{return rejected[CUSIP_LIMIT]+rejected[BOOK_LIMIT]+rejected[SECTOR_LIMIT];}
+};
+
+//keep the limit engine's position counters up to date
+class BondPositionLimitListener: public ServiceListener<Position<Bond> >
+{
+private:
+  BondLimitEngine& limits;
+public:
+  BondPositionLimitListener(BondLimitEngine& src):limits(src){}
+  // Listener callback to process an add event to the Service
+  virtual void ProcessAdd(Position<Bond> &data){limits.OnPosition(data);}
+
+  // Listener callback to process a remove event to the Service
+  virtual void ProcessRemove(Position<Bond> &data){}
+
+  // Listener callback to process an update event to the Service
+  virtual void ProcessUpdate(Position<Bond> &data){limits.OnPosition(data);}
+};
+
+//keep the limit engine's pv01 counters up to date
+class BondPV01LimitListener: public ServiceListener<PV01<Bond> >
+{
+private:
+  BondLimitEngine& limits;
+public:
+  BondPV01LimitListener(BondLimitEngine& src):limits(src){}
+  // Listener callback to process an add event to the Service
+  virtual void ProcessAdd(PV01<Bond> &data){limits.OnPV01(data);}
+
+  // Listener callback to process a remove event to the Service
+  virtual void ProcessRemove(PV01<Bond> &data){}
+
+  // Listener callback to process an update event to the Service
+  virtual void ProcessUpdate(PV01<Bond> &data){limits.OnPV01(data);}
+};
+
+BondLimitEngine::BondLimitEngine(BondReferenceDataService& refData_, const map<string, double>& pv01, const string& flowBookName):
+  refData(refData_),accepted(0)
+{
+  int n=refData.Size();
+  cusipLimit.assign(n,LONG_MAX);
+  cusipPosition.assign(n,0);
+  listNet.assign(n,0);
+  bondPV01.assign(n,0);
+  sectorOf.assign(n,0);
+  for(int d=0;d<n;++d){
+    map<string, double>::const_iterator it=pv01.find(refData.GetBond(d).GetProductId());
+    if(it!=pv01.end()) bondPV01[d]=it->second;
+    sectorOf[d]=refData.GetBond(d).GetSectorType();
+  }
+  for(int k=0;k<STANDARD_SECTORS;++k){sectorLimit[k]=HUGE_VAL; sectorExposure[k]=0;}
+  for(int t=0;t<LIMIT_TYPES;++t) rejected[t]=0;
+  for(int b=0;b<MAX_BOOKS;++b){bookLimit[b]=LONG_MAX; bookGross[b]=0;}
+  bookPosition.resize(MAX_BOOKS);
+  flowBook=Book(flowBookName);
+}
+
+int BondLimitEngine::Book(const string& book){
+  int b=BookRegistry::Intern(book);
+  if(b>=0 && bookPosition[b].empty()){
+    books.push_back(b);
+    bookPosition[b].assign(refData.Size(),0);
+  }
+  return b;
+}
+
+void BondLimitEngine::SetCusipLimit(const string& productId, long limit){
+  int d=refData.GetDenseId(productId);
+  if(d>=0) cusipLimit[d]=limit;
+}
+
+void BondLimitEngine::SetDefaultCusipLimit(long limit){
+  for(size_t d=0;d<cusipLimit.size();++d) cusipLimit[d]=limit;
+}
+
+void BondLimitEngine::SetBookLimit(const string& book, long limit){
+  int b=Book(book);
+  if(b>=0) bookLimit[b]=limit;
+}
+
+void BondLimitEngine::UpdateExposure(int d, long oldPosition, double oldPV01){
+  sectorExposure[sectorOf[d]]-=double(oldPosition)*oldPV01;
+  sectorOf[d]=refData.GetBond(d).GetSectorType();//the bond may have moved sector after a date roll
+  sectorExposure[sectorOf[d]]+=double(cusipPosition[d])*bondPV01[d];
+}
+
+void BondLimitEngine::OnPosition(const Position<Bond>& position){
+  int d=refData.GetDenseId(position.GetProduct().GetId());
+  if(d<0) return;
+  for(size_t i=0;i<books.size();++i){
+    int b=books[i];
+    long p=position.GetPosition(b);
+    bookGross[b]+=labs(p)-labs(bookPosition[b][d]);
+    bookPosition[b][d]=p;
+  }
+  long old=cusipPosition[d];
+  cusipPosition[d]=position.GetAggregatePosition();
+  UpdateExposure(d,old,bondPV01[d]);
+}
+
+void BondLimitEngine::OnPV01(const PV01<Bond>& pv01){
+  int d=refData.GetDenseId(pv01.GetProduct().GetId());
+  if(d<0) return;
+  double old=bondPV01[d];
+  bondPV01[d]=pv01.GetPV01();
+  UpdateExposure(d,cusipPosition[d],old);
+}
+
+bool BondLimitEngine::Check(int d, long dq){
+  //cusip position
+  long pos=cusipPosition[d];
+  if(labs(pos+dq)>cusipLimit[d] && labs(pos+dq)>labs(pos)){
+    ++rejected[CUSIP_LIMIT];
+    return false;
+  }
+  //gross position of the flow book
+  if(flowBook>=0){
+    long bpos=bookPosition[flowBook][d];
+    long gross=bookGross[flowBook]-labs(bpos)+labs(bpos+dq);
+    if(gross>bookLimit[flowBook] && gross>bookGross[flowBook]){
+      ++rejected[BOOK_LIMIT];
+      return false;
+    }
+  }
+  //net pv01 of the sector the bond's exposure is counted in
+  int k=sectorOf[d];
+  double exposure=sectorExposure[k]+double(dq)*bondPV01[d];
+  if(fabs(exposure)>sectorLimit[k] && fabs(exposure)>fabs(sectorExposure[k])){
+    ++rejected[SECTOR_LIMIT];
+    return false;
+  }
+  ++accepted;
+  return true;
+}
+
+bool BondLimitEngine::Accept(const ExecutionOrder<Bond>& order){
+  int d=refData.GetDenseId(order.GetProduct().GetId());
+  if(d<0) return true;//no reference data, nothing to check against
+  long q=order.GetVisibleQuantity()+order.GetHiddenQuantity();
+  return Check(d,order.GetSide()==BID?q:-q);
+}
+
+bool BondLimitEngine::Accept(const Inquiry<Bond>& inquiry, double price){
+  int d=refData.GetDenseId(inquiry.GetProduct().GetId());
+  if(d<0) return true;
+  long q=inquiry.GetQuantity();
+  return Check(d,inquiry.GetSide()==BUY?-q:q);//we sell when the client buys
+}
+
+bool BondLimitEngine::Accept(const ListInquiry<Bond>& list, const vector<double>& prices){
+  //net the legs so a switch between two bonds is judged on what the list leaves us with
+  for(int i=0;i<list.GetLegCount();++i){
+    const ListInquiryLeg<Bond>& leg=list.GetLeg(i);
+    int d=refData.GetDenseId(leg.product.Get().GetId());
+    if(d<0) continue;
+    if(listNet[d]==0) listBonds.push_back(d);
+    listNet[d]+=leg.side==BUY?-leg.quantity:leg.quantity;
+  }
+  int breach=-1;
+  long gross=flowBook>=0?bookGross[flowBook]:0;
+  double exposure[STANDARD_SECTORS];
+  for(int k=0;k<STANDARD_SECTORS;++k) exposure[k]=sectorExposure[k];
+  for(size_t i=0;i<listBonds.size();++i){
+    int d=listBonds[i];
+    long dq=listNet[d];
+    long pos=cusipPosition[d];
+    if(breach<0 && labs(pos+dq)>cusipLimit[d] && labs(pos+dq)>labs(pos)) breach=CUSIP_LIMIT;
+    if(flowBook>=0) gross+=labs(bookPosition[flowBook][d]+dq)-labs(bookPosition[flowBook][d]);
+    exposure[sectorOf[d]]+=double(dq)*bondPV01[d];
+    listNet[d]=0;
+  }
+  listBonds.clear();
+  if(breach<0 && flowBook>=0 && gross>bookLimit[flowBook] && gross>bookGross[flowBook]) breach=BOOK_LIMIT;
+  for(int k=0;k<STANDARD_SECTORS && breach<0;++k)
+    if(fabs(exposure[k])>sectorLimit[k] && fabs(exposure[k])>fabs(sectorExposure[k])) breach=SECTOR_LIMIT;
+  if(breach>=0){
+    ++rejected[breach];
+    return false;
+  }
+  ++accepted;
+  return true;
+}
+
+#endif
@@ -0,0 +1,148 @@
+/*
+implement copy-on-write listener lists that dispatch from an immutable snapshot
+author: Gaoxian Song
+*/
+#ifndef ListenerList_HPP
+#define ListenerList_HPP
+
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include "soa.hpp"
+
+using namespace std;
+
+/**
+ * Listeners of a service, read through an atomic pointer to an immutable vector.
+ * Dispatch loads the pointer once and walks that vector: it takes no lock and is never held up by
+ * a listener being added or removed, from this thread or any other.
+ * Adding or removing copies the current vector, changes the copy and publishes it with a single
+ * store; writers are serialized among themselves only. A dispatch already under way finishes with
+ * the listeners it started with, so a listener removed during one can still be called by it.
+ * Superseded vectors are reclaimed by epoch: a dispatch counts itself in readers under the parity of
+ * the epoch it starts in, and can only load vectors that were current at or after that epoch began.
+ * A writer ends the epoch once no dispatch from the one before is left, which makes everything
+ * superseded so far unreachable by later dispatches, and frees it at the next change that finds the
+ * ended epoch's dispatches gone. Dispatches are short, so a vector lives about one change past its
+ * last reader even while other threads dispatch without pause.
+ * Type V is the data type the listeners take.
+ */
+template<typename V>
+class ListenerList
+{
+private:
+  atomic<const vector<ServiceListener<V>*>*> current;
+  atomic<unsigned> epoch;//changed by writers only
+  mutable atomic<int> readers[2];//dispatches running, by the parity of the epoch they started in
+  vector<const vector<ServiceListener<V>*>*> retiring;//superseded in this epoch, its dispatches or the last one's may hold them
+  vector<const vector<ServiceListener<V>*>*> retired;//superseded in the last epoch, only its dispatches may hold them
+  mutex writers;//serializes Add and Remove, never taken on dispatch
+  ListenerList(const ListenerList&);
+  ListenerList& operator=(const ListenerList&);
+  //publish a changed copy of the current list, with writers held
+  void Publish(const vector<ServiceListener<V>*>& listeners);
+  //free what the last epoch's dispatches are done with and move to the next epoch, with writers held
+  void Reclaim();
+public:
+  /**
+   * The listeners as of its construction, held for as long as it lives; for a dispatch that calls
+   * several methods per listener. It takes no lock.
+   */
+  class Reader
+  {
+  private:
+    const ListenerList& list;
+    int slot;//parity of the epoch this dispatch is counted in
+    const vector<ServiceListener<V>*>* listeners;
+    Reader(const Reader&);
+    Reader& operator=(const Reader&);
+  public:
+    explicit Reader(const ListenerList& list_):list(list_){
+      for(;;){
+        unsigned e=list.epoch.load();
+        slot=e&1;
+        list.readers[slot].fetch_add(1);
+        if(list.epoch.load()==e) break;//counted before the epoch could end
+        list.readers[slot].fetch_sub(1);//the epoch moved on meanwhile, count in the new one
+      }
+      listeners=list.current.load();
+    }
+    ~Reader(){list.readers[slot].fetch_sub(1,memory_order_release);}
+    const vector<ServiceListener<V>*>& Get() const{return *listeners;}
+  };
+  ListenerList():current(new vector<ServiceListener<V>*>()),epoch(0){readers[0]=0; readers[1]=0;}
+  ~ListenerList();
+  //the listeners as of now, not held: valid until the listeners next change, so on a thread that
+  //may race a change use a Reader or the dispatch calls below
+  const vector<ServiceListener<V>*>& Snapshot() const{return *current.load(memory_order_acquire);}
+  void Add(ServiceListener<V>* listener){
+    lock_guard<mutex> lock(writers);
+    vector<ServiceListener<V>*> listeners=Snapshot();
+    listeners.push_back(listener);
+    Publish(listeners);
+  }
+  //remove a listener; false if it was not registered
+  bool Remove(ServiceListener<V>* listener){
+    lock_guard<mutex> lock(writers);
+    vector<ServiceListener<V>*> listeners=Snapshot();
+    typename vector<ServiceListener<V>*>::iterator it=find(listeners.begin(),listeners.end(),listener);
+    if(it==listeners.end()) return false;
+    listeners.erase(it);
+    Publish(listeners);
+    return true;
+  }
+  //number of superseded vectors not freed yet
+  size_t GetRetiredCount(){
+    lock_guard<mutex> lock(writers);
+    return retiring.size()+retired.size();
+  }
+  //call every listener of the snapshot in the order they were added
+  void ProcessAdd(V &data) const{
+    Reader reader(*this);
+    const vector<ServiceListener<V>*>& listeners=reader.Get();
+    for(size_t i=0;i<listeners.size();++i) listeners[i]->ProcessAdd(data);
+  }
+  void ProcessRemove(V &data) const{
+    Reader reader(*this);
+    const vector<ServiceListener<V>*>& listeners=reader.Get();
+    for(size_t i=0;i<listeners.size();++i) listeners[i]->ProcessRemove(data);
+  }
+  void ProcessUpdate(V &data) const{
+    Reader reader(*this);
+    const vector<ServiceListener<V>*>& listeners=reader.Get();
+    for(size_t i=0;i<listeners.size();++i) listeners[i]->ProcessUpdate(data);
+  }
+};
+
+template<typename V>
+ListenerList<V>::~ListenerList(){
+  for(size_t i=0;i<retiring.size();++i) delete retiring[i];
+  for(size_t i=0;i<retired.size();++i) delete retired[i];
+  delete current.load();
+}
+
+template<typename V>
+void ListenerList<V>::Publish(const vector<ServiceListener<V>*>& listeners){
+  retiring.push_back(current.load(memory_order_relaxed));
+  current.store(new vector<ServiceListener<V>*>(listeners));
+  Reclaim();
+}
+
+template<typename V>
+void ListenerList<V>::Reclaim(){
+  //twice at most: the epoch just ended may have no dispatches left either
+  for(int pass=0;pass<2;++pass){
+    unsigned e=epoch.load(memory_order_relaxed);
+    //dispatches of the last epoch share a counter with the next one, which cannot start until they are done
+    if(readers[(e+1)&1].load()!=0) return;
+    for(size_t i=0;i<retired.size();++i) delete retired[i];
+    retired.clear();
+    if(retiring.empty()) return;
+    //dispatches from here on load the current vector or a later one, never one superseded so far
+    retired.swap(retiring);
+    epoch.store(e+1);
+  }
+}
+
+#endif
@@ -0,0 +1,251 @@
+/*
+implement list (portfolio) inquiries quoted as one response
+author: Gaoxian Song
+*/
+#ifndef ListInquiryService_HPP
+#define ListInquiryService_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <stdexcept>
+#include "soa.hpp"
+#include "listenerlist.hpp"
+#include "referencedataservice.hpp"
+#include "inquiryservice.hpp"
+#include "snapshot.hpp"
+
+using namespace std;
+
+//publish only connector, sends the quoted list back to the client as one response
+class BondPublishListIqConnector: public Connector<ListInquiry<Bond> >
+{
+public:
+  virtual void Publish(ListInquiry<Bond> &data){data.SetState(QUOTED);}
+};
+
+//a requested move of one list to a new state
+struct ListInquiryEvent
+{
+  string listId;
+  InquiryState to;
+  vector<double> prices;//leg prices for a move to QUOTED
+};
+
+/**
+ * Service for list inquiries, keyed on list id.
+ * A list follows INQUIRY_TRANSITIONS like a single inquiry and moves by events taken off a queue,
+ * so the listener quoting a new list from inside its callback never re-enters the service.
+ * A quote carries a price for every leg and passes the pre-trade check on the netted list;
+ * the list is published in one piece and leaves the cache once it is finished.
+ */
+class BondListInquiryService: public Service<string, ListInquiry<Bond> >
+{
+private:
+  map<string, ListInquiry<Bond> > openLists;
+  ListenerList<ListInquiry<Bond> > listListeners;
+  BondPublishListIqConnector& b_publish;
+  QuoteCheck<Bond>* quoteCheck;//pre-trade check, null if quotes go out unchecked
+  deque<ListInquiryEvent> events;//pending moves in arrival order
+  deque<ListInquiry<Bond> > arrivals;//lists of the pending moves to RECEIVED, in the same order
+  bool draining;//whether a caller further up the stack is already draining the queue
+  void Enqueue(const string& listId, InquiryState to, const vector<double>& prices);
+  void Drain();
+  //apply one event and notify listeners
+  void Apply(const ListInquiryEvent& event);
+public:
+  BondListInquiryService(BondPublishListIqConnector& src):b_publish(src),quoteCheck(nullptr),draining(false){}
+  //set the pre-trade check every list quote must pass before it is sent
+  void SetQuoteCheck(QuoteCheck<Bond>* check){quoteCheck=check;}
+  // Get data on our service given a key
+  // only open lists are held; throws out_of_range for a list that is not open
+  virtual ListInquiry<Bond>& GetData(string key){
+    map<string, ListInquiry<Bond> >::iterator it=openLists.find(key);
+    if(it==openLists.end()) throw out_of_range("no open list "+key);
+    return it->second;
+  }
+
+  // The callback that a Connector should invoke for any new or updated data
+  // a RECEIVED list is new, any other state is the client moving an existing one
+  virtual void OnMessage(ListInquiry<Bond> &data);
+
+  // Add a listener to the Service for callbacks on add, remove, and update events
+  // for data to the Service.
+  virtual void AddListener(ServiceListener<ListInquiry<Bond> > *listener){listListeners.Add(listener);}
+  //remove a listener, a dispatch already under way may still call it
+  virtual void RemoveListener(ServiceListener<ListInquiry<Bond> > *listener){listListeners.Remove(listener);}
+
+  // Get all listeners on the Service.
+  virtual const vector< ServiceListener<ListInquiry<Bond> >* >& GetListeners() const{return listListeners.Snapshot();}
+  //send a quote for every leg back to the client
+  void SendQuote(const string& listId, const vector<double>& prices);
+  //reject a whole list
+  void RejectList(const string& listId);
+  int GetOpenCount() const{return openLists.size();}
+};
+
+//subscribe only connector
+//a line of ./Input/listinquiries.txt is a list id, the leg count and product id, side and quantity per leg
+class BondListInquiryConnector: public Connector<ListInquiry<Bond> >, public Snapshottable
+{
+private:
+  int counter;
+public:
+  BondListInquiryConnector(){counter=0;}//constructor
+  //number of input lines consumed
+  int GetCounter() const{return counter;}
+  //checkpoint the input offset
+  virtual string GetSnapshotName() const{return "listinquiries.offset";}
+  virtual void SaveSnapshot(SnapshotWriter& w) const{w.Put(counter);}
+  virtual void LoadSnapshot(SnapshotReader& r){counter=r.Get<int>();}
+  // Publish data to the Connector
+  virtual void Publish(ListInquiry<Bond> &data){}//do nothing
+  //subscribe and return subscribed data
+  void Subscribe(BondListInquiryService& b_lists, const BondReferenceDataService& refData);
+};
+
+//quotes new lists in one pass through the pricer and trades every quoted list
+class BondListInquiryListener: public ServiceListener<ListInquiry<Bond> >
+{
+private:
+  BondListInquiryService& b_lists;
+  InquiryPricer<Bond>& pricer;
+  vector<double> prices;//reused across lists
+public:
+  BondListInquiryListener(BondListInquiryService& src, InquiryPricer<Bond>& pricer_):b_lists(src),pricer(pricer_){}
+  // Listener callback to process an add event to the Service
+  virtual void ProcessAdd(ListInquiry<Bond> &data);
+
+  // Listener callback to process a remove event to the Service
+  virtual void ProcessRemove(ListInquiry<Bond> &data){}
+
+  // Listener callback to process an update event to the Service
+  virtual void ProcessUpdate(ListInquiry<Bond> &data);
+};
+
+void BondListInquiryService::OnMessage(ListInquiry<Bond> &data){
+  if(data.GetState()==RECEIVED) arrivals.push_back(data);
+  Enqueue(data.GetListId(),data.GetState(),vector<double>());
+  Drain();
+}
+
+void BondListInquiryService::Enqueue(const string& listId, InquiryState to, const vector<double>& prices){
+  ListInquiryEvent event;
+  event.listId=listId;
+  event.to=to;
+  event.prices=prices;
+  events.push_back(event);
+}
+
+void BondListInquiryService::Drain(){
+  if(draining) return;//the caller further up picks the new events up
+  draining=true;
+  while(!events.empty()){
+    ListInquiryEvent event=events.front();
+    events.pop_front();
+    Apply(event);
+  }
+  draining=false;
+}
+
+void BondListInquiryService::Apply(const ListInquiryEvent& event){
+  map<string, ListInquiry<Bond> >::iterator it=openLists.find(event.listId);
+  if(event.to==RECEIVED){
+    ListInquiry<Bond> data=arrivals.front();
+    arrivals.pop_front();
+    if(it!=openLists.end()){
+      cout<<"List inquiry "<<event.listId<<" is still open\n";
+      return;
+    }
+    if(data.GetLegCount()==0){
+      cout<<"List inquiry "<<event.listId<<" has no legs\n";
+      return;
+    }
+    it=openLists.insert(make_pair(event.listId,data)).first;
+    listListeners.ProcessAdd(it->second);
+    return;
+  }
+  if(it==openLists.end()){
+    cout<<"Cache miss\n";
+    return;
+  }
+  ListInquiry<Bond>& list=it->second;
+  InquiryState to=event.to;
+  if(!INQUIRY_TRANSITIONS[list.GetState()][to]){
+    cout<<"List inquiry "<<event.listId<<" cannot move from state "<<list.GetState()<<" to "<<to<<"\n";
+    return;
+  }
+  if(to==QUOTED){
+    if(event.prices.size()!=size_t(list.GetLegCount()) || (quoteCheck && !quoteCheck->Accept(list,event.prices))) to=REJECTED;
+    else list.SetPrices(event.prices);
+  }
+  list.SetState(to);
+  if(to==QUOTED) b_publish.Publish(list);//one response for the whole list
+  listListeners.ProcessUpdate(list);
+  if(IsTerminal(to)) openLists.erase(it);//listeners, the historical service among them, have seen it
+}
+
+void BondListInquiryService::SendQuote(const string& listId, const vector<double>& prices){
+  Enqueue(listId,QUOTED,prices);
+  Drain();
+}
+
+void BondListInquiryService::RejectList(const string& listId){
+  Enqueue(listId,REJECTED,vector<double>());
+  Drain();
+}
+
+//flow into service
+void BondListInquiryConnector::Subscribe(BondListInquiryService& b_lists, const BondReferenceDataService& refData){
+  ifstream file("./Input/listinquiries.txt");
+  string line;
+  getline(file,line);//read header line
+  for(int i=0;i<=counter;++i){
+    if(!getline(file,line) || line.length()<4){
+      //a normal data entry line length can never be less than 4
+      cout<<"reached end of file\n";
+      return;
+    }
+  }
+  ++counter;//update counter
+  vector<string> fields;
+  boost::split(fields,line,boost::is_any_of(","));//split line
+  int legs=fields.size()>1?stoi(fields[1]):0;
+  if(legs<0 || fields.size()!=size_t(2+3*legs)){
+    cout<<"Malformed list inquiry "<<fields[0]<<"\n";
+    return;
+  }
+  ListInquiry<Bond> list(fields[0],RECEIVED);
+  for(int k=0;k<legs;++k){
+    int d=refData.GetDenseId(fields[2+3*k]);
+    if(d<0){
+      cout<<"List inquiry "<<fields[0]<<" has unknown product "<<fields[2+3*k]<<"\n";
+      return;
+    }
+    list.AddLeg(refData.GetHandle(d),fields[3+3*k]=="SELL"?SELL:BUY,stol(fields[4+3*k]));
+  }
+  b_lists.OnMessage(list);//flow data to service
+}
+
+void BondListInquiryListener::ProcessAdd(ListInquiry<Bond>& data){
+  pricer.QuoteList(data,prices);
+  //a list is quoted whole or not at all
+  for(size_t i=0;i<prices.size();++i){
+    if(prices[i]<=0){
+      b_lists.RejectList(data.GetListId());
+      return;
+    }
+  }
+  b_lists.SendQuote(data.GetListId(),prices);
+}
+
+void BondListInquiryListener::ProcessUpdate(ListInquiry<Bond>& data){
+  if(data.GetState()!=QUOTED) return;
+  //the client always trades on our quote
+  ListInquiry<Bond> reply=data;
+  reply.SetState(DONE);
+  b_lists.OnMessage(reply);
+}
+
+#endif
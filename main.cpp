@@ -2,6 +2,13 @@
 #include "positionservice.hpp"
 #include "pricingservice.hpp"
 #include "riskservice.hpp"
+#include "bondanalytics.hpp"
+#include "scenarioengine.hpp"
+#include "curveservice.hpp"
+#include "limitengine.hpp"
+#include "pnlservice.hpp"
+#include "tradejournal.hpp"
+#include "rfqpricer.hpp"
 #include "marketdataservice.hpp"
 #include "executionservice.hpp"
 #include "streamingservice.hpp"
@@ -11,6 +18,7 @@
 #include "historicalexecutionservice.hpp"
 #include "historicalstreamingservice.hpp"
 #include "historicalinquiryservice.hpp"
+#include "bondpipelines.hpp"
 
 map<string, Bond> GetBonds(){
 	map<string, Bond> m_bond;
@@ -35,30 +43,74 @@ int main(){
     //numofprice is number of prices to flow into bondpriceservice
     //numofmarket is number of marketdata to flow into market data service
     //numofiq is number of inquiries to flow into inquiry service
-    int numOftrades=18, numofprice=36, numofmarket=36, numofiq=36;
+    //numoflists is number of list inquiries to flow into list inquiry service
+    int numOftrades=18, numofprice=36, numofmarket=36, numofiq=36, numoflists=6;
+    //historical logs are rotated into numbered segments once the live file reaches
+    //maxbytes bytes or has been open maxseconds seconds (0 disables the time trigger)
+    SegmentRotationPolicy hist_rotation(1<<20, 24*3600);
+    //service state is checkpointed as each feed starts, every checkpointEvery inputs of it and once
+    //it is done; with warmStart set the latest checkpoint is restored and each feed resumes after the
+    //last input it covers
+    bool warmStart=false;
+    int checkpointEvery=12;
+    //trades are journaled before booking and synced in batches of up to 8 or after 2ms,
+    //whichever comes first; a batch of 1 makes every trade durable before it is booked
+    JournalCommitPolicy journalPolicy(8, 2000);
+    //the trade and price paths are wired at compile time through bondpipelines.hpp;
+    //set false to wire them through listeners registered on each service instead
+    bool staticPipelines=true;
 
-	map<string, Bond> m_bond=GetBonds();//get a map of bonds
+    //business date for date dependent bond attributes such as sector and years to maturity
+    //set to the date of the input files; use day_clock::local_day() with live data
+    date asOfDate(2016,Dec,1);
+    //load the bond universe into reference data, which computes the attributes once per date
+    BondReferenceDataService b_ref_data(GetBonds(),asOfDate);
+	map<string, Bond> m_bond=b_ref_data.GetBondMap();//get a map of bonds
+    //construct the checkpoint manager, every service and connector registers right after construction
+    //so it is restored before any listener or input can reach it
+    CheckpointManager b_checkpoint("./Output/checkpoint.bin", b_ref_data, warmStart);
+    //construct the trade journal, kept across a warm start so trades after the checkpoint can be replayed
+    BondTradeJournal b_journal("./Output/trades.journal", b_ref_data, journalPolicy, warmStart);
+    b_checkpoint.Register(&b_journal);
+    //random draws of the price streams and executions, shared in feed order and checkpointed
+    //so a warm start draws what an uninterrupted run would have
+    RandomSource b_random;
+    b_checkpoint.Register(&b_random);
 	vector<string> bids; //store bond ids
-    map<string, double> m_bond_pv01;
 	for(map<string, Bond>::iterator it=m_bond.begin(); it!=m_bond.end();++it){
 		bids.push_back(it->first);//push bond ids to bids
 	}
-    //assign reasonable values as pv01
-    m_bond_pv01[bids[0]]=0.295;
-    m_bond_pv01[bids[1]]=0.102;
-    m_bond_pv01[bids[2]]=0.031;
-    m_bond_pv01[bids[3]]=0.017;
-    m_bond_pv01[bids[4]]=0.0707;
-    m_bond_pv01[bids[5]]=0.0455;
+    //construct bond analytics, which computes yield, duration and pv01 from coupon and maturity
+    //every bond starts at par until its first price arrives
+    BondAnalyticsEngine b_analytics(b_ref_data);
+    b_checkpoint.Register(&b_analytics);
+    map<string, double> m_bond_pv01=b_analytics.GetPV01Map();
     PV01<Bond> temp(m_bond[bids[0]],0,0);
     //configure services, listeners, etc and link them together
-    BondTradeBookService bt_service;//construct trade book service
+    //construct trade book service, which keeps the newest 65536 trades in memory and spills older ones
+    BondTradeBookService bt_service(b_ref_data,"./Output/trades.spill",1<<16);
+    b_checkpoint.Register(&bt_service);
+    bt_service.SetTradeLog(&b_journal);
     BondTradeBookingConnector bt_connector; //construct trade book connector
+    b_checkpoint.Register(&bt_connector);
     BondPositionService bposition; //construct bond position service
-    BondRiskService bndrisk(m_bond_pv01, m_bond); //construct bond risk service
+    b_checkpoint.Register(&bposition);
+    //bucketed sectors for risk: FrontEnd, Belly and LongEnd are always defined,
+    //risk managers add their own buckets here before the risk service is constructed
+    BucketedSectorRegistry b_sectors(b_ref_data);
+    b_sectors.DefineMaturityBucket("2Y-5Y",2,5);
+    b_sectors.DefineTickerBucket("Treasuries","T");
+    b_sectors.DefineBookBucket("TRSY1 bonds","TRSY1");
+    BondRiskService bndrisk(m_bond_pv01, b_ref_data, b_sectors); //construct bond risk service
+    b_checkpoint.Register(&bndrisk);
+    //construct reference data listener so a date roll moves bonds to their new sectors
+    BondRefDataRiskListener* b_ref_risk_listen=new BondRefDataRiskListener(bndrisk);
+    b_ref_data.AddListener(b_ref_risk_listen);
     BondRiskHistoricalConnector b_risk_connector; //construct bond risk historical data connector
+    b_risk_connector.SetRotationPolicy(hist_rotation);
     BondRiskHistoricalData b_risk_data(b_risk_connector); //construct bond risk historical data service
                                                           //and link with corresponding connector
+    b_checkpoint.Register(&b_risk_data);
     BondRiskRecordListener b_risk_record_listen(b_risk_data);//construct risk record listener
     BondPV01HistoricalListener* b_pv01_listen=new BondPV01HistoricalListener(temp);//construct pv01 listener for historical data
                                                                             //the temp will be modifed later
@@ -66,61 +118,142 @@ int main(){
     //construct bond sectors risk listener and link with pv01 lister and risk record listener for historical data service
     BondSectorsRiskListener* b_sector_listen=new BondSectorsRiskListener(*b_pv01_listen,b_risk_record_listen);
     bndrisk.AddListener(b_sector_listen);//add bond sectors listener to risk service
+    //pre-trade limits for algo orders and inquiry quotes, which are booked into TRSY1
+    //limits must be set before positions flow so the book counters see every trade
+    BondLimitEngine b_limits(b_ref_data,m_bond_pv01,"TRSY1");
+    b_limits.SetDefaultCusipLimit(100000000);
+    b_limits.SetBookLimit("TRSY1",100000000);
+    b_limits.SetSectorLimit(FrontEnd,5000000);
+    b_limits.SetSectorLimit(Belly,5000000);
+    b_limits.SetSectorLimit(LongEnd,5000000);
+    BondPV01LimitListener* b_pv01_limit_listen=new BondPV01LimitListener(b_limits);
+    bndrisk.AddListener(b_pv01_limit_listen);//pv01 counters follow the risk service
     //construct bond position connector for historical data
     BondPositionHistoricalConnector bp_his_connector;
+    bp_his_connector.SetRotationPolicy(hist_rotation);
     //construct bond position historical data service and link with connector
     BondPositionHistoricalData bp_his_data(bp_his_connector);
+    b_checkpoint.Register(&bp_his_data);
     //construct bond position listener for historical data service and linke with bond historical position servce
     BondPositionHistoricalListener* bp_his_listener=new BondPositionHistoricalListener(bp_his_data);
     //construct bond position listener and link with risk service
     BondPositionServiceListener* bnd_pos_listener=new BondPositionServiceListener(bndrisk);
-    //add positionlisteners to bond position service
-    bposition.AddListener(bnd_pos_listener);
-    bposition.AddListener(bp_his_listener);
+    //add positionlisteners to bond position service, unless the trade pipeline calls them
+    if(!staticPipelines){
+      bposition.AddListener(bnd_pos_listener);
+      bposition.AddListener(bp_his_listener);
+    }
+    //position counters of the limit engine follow the position service
+    BondPositionLimitListener* bp_limit_listen=new BondPositionLimitListener(b_limits);
+    bposition.AddListener(bp_limit_listen);
+    //construct pnl service, fed by positions here and by prices below
+    BondPnLService b_pnl(b_ref_data);
+    b_checkpoint.Register(&b_pnl);
+    BondPositionPnLListener* bp_pnl_listen=new BondPositionPnLListener(b_pnl);
+    bposition.AddListener(bp_pnl_listen);
+    //construct the rfq pricer, fed by positions here and by prices and market data below
+    BondRfqPricer b_rfq_pricer(b_ref_data);
+    b_checkpoint.Register(&b_rfq_pricer);
+    BondPositionRfqListener* bp_rfq_listen=new BondPositionRfqListener(b_rfq_pricer);
+    bposition.AddListener(bp_rfq_listen);
     //construct trade listener and link with bond position service
-    BondTradeListener* ptr_bt_listen=new BondTradeListener(bposition);
     //add trade listener to tradebooking service
-    bt_service.AddListener(ptr_bt_listen);
+    if(staticPipelines) bt_service.AddListener(MakeTradePipeline(bposition,*bnd_pos_listener,*bp_his_listener));
+    else bt_service.AddListener(new BondTradeListener(bposition));
+    //the limit engine keeps no state of its own worth saving, rebuild its counters from restored positions
+    if(b_checkpoint.IsRestored()){
+      const map<string, Position<Bond> >& restored=bposition.GetPositions();
+      for(map<string, Position<Bond> >::const_iterator it=restored.begin();it!=restored.end();++it)
+        b_limits.OnPosition(it->second);
+    }
+    //book the journaled trades the checkpoint missed, then read trades.txt after them
+    bt_connector.Skip(b_journal.Replay(bt_service));
     //flow trade data to trade book connector, no more than 60
-    for(int i=0;i<numOftrades;++i){
+    for(int i=bt_connector.GetCounter();i<numOftrades;++i){
+      if(i%checkpointEvery==0) b_checkpoint.Checkpoint();
       bt_connector.Subscribe(bt_service, m_bond);
     }
+    b_journal.Commit();//the trade feed is done, sync what is left of the last batch
+    b_checkpoint.Checkpoint();
     //construct bond price service
     BondPriceService bp_service;
     //construct price connector
     BondPriceConnector bp_connector;
+    b_checkpoint.Register(&bp_connector);
     //construct bond algo stream service
     BondAlgoStreamingService b_algo_stream;
-    //construct bond price listener and link with algo stream service
-    BondPriceListener* b_price_listener=new BondPriceListener(b_algo_stream);
-    //add bond price listener to bond price serivce
-    bp_service.AddListener(b_price_listener);
+    b_algo_stream.SetRandomSource(&b_random);
     //construct bond stream service
     BondStreamingService b_stream_service;
     //construct bond stream connector for historical data
     BondStreamHistoricalConnector b_stream_connect;
+    b_stream_connect.SetRotationPolicy(hist_rotation);
     //construct bond stream historical service and link with connector
     BondStreamHistoricalData b_stream_data(b_stream_connect);
+    b_checkpoint.Register(&b_stream_data);
     //construct bond stream listener for historical data service and link with bond stream historical service
     BondStreamHistoricalListener* b_stream_listen=new BondStreamHistoricalListener(b_stream_data);
-    //add listener to bond stream service
-    b_stream_service.AddListener(b_stream_listen);
-    //construct bond algo stream listener and link with bond stream service
-    BondAlgoStreamListener* b_algo_stream_listener=new BondAlgoStreamListener(b_stream_service);
-    //add bond algo stream listener to bond algo stream service
-    b_algo_stream.AddListener(b_algo_stream_listener);
+    if(staticPipelines){
+      //construct the price pipeline, which calls the algo stream, stream and historical services in turn
+      bp_service.AddListener(MakePricePipeline(b_algo_stream,b_stream_service,*b_stream_listen));
+    }
+    else{
+      //add listener to bond stream service
+      b_stream_service.AddListener(b_stream_listen);
+      //construct bond algo stream listener and link with bond stream service
+      BondAlgoStreamListener* b_algo_stream_listener=new BondAlgoStreamListener(b_stream_service);
+      //add bond algo stream listener to bond algo stream service
+      b_algo_stream.AddListener(b_algo_stream_listener);
+      //construct bond price listener and link with algo stream service
+      BondPriceListener* b_price_listener=new BondPriceListener(b_algo_stream);
+      //add bond price listener to bond price serivce
+      bp_service.AddListener(b_price_listener);
+    }
+    //construct analytics price listener so every price tick recomputes pv01 and flows it into risk
+    BondPriceAnalyticsListener* b_analytics_listen=new BondPriceAnalyticsListener(b_analytics,bndrisk);
+    bp_service.AddListener(b_analytics_listen);
+    //construct the yield curve, refitted incrementally as each bond ticks
+    BondCurveService b_curve(b_analytics);
+    BondPriceCurveListener* b_curve_listen=new BondPriceCurveListener(b_analytics,b_curve);
+    bp_service.AddListener(b_curve_listen);
+    //bonds the rfq pricer has no book or price for are quoted off the curve
+    b_rfq_pricer.SetCurve(&b_curve);
+    //construct pnl price listener so every tick moves unrealized pnl
+    BondPricePnLListener* b_price_pnl_listen=new BondPricePnLListener(b_pnl);
+    bp_service.AddListener(b_price_pnl_listen);
+    //construct rfq price listener, used for bonds without a book
+    BondPriceRfqListener* b_price_rfq_listen=new BondPriceRfqListener(b_rfq_pricer);
+    bp_service.AddListener(b_price_rfq_listen);
     //flow price data to bond price connector
-    for(int i=1;i<=numofprice;++i){
+    for(int i=bp_connector.GetCounter();i<numofprice;++i){
+      if(i%checkpointEvery==0) b_checkpoint.Checkpoint();
       bp_connector.Subscribe(bp_service,m_bond);
     }
-    //test the update pv01 function
-    bndrisk.UpdateBondPV01(bids[2],0.03);
+    b_checkpoint.Checkpoint();
+    //end of day refresh: recompute every bond from its last price and push all pv01s as one batch,
+    //checkpointed as done so a warm start after it does not write its risk records again
+    SnapshotStep b_eod("endofday");
+    b_checkpoint.Register(&b_eod);
+    if(!b_eod.IsDone()){
+      b_analytics.RecalculateAll();
+      bndrisk.UpdateBondPV01(b_analytics.GetPV01Map());
+      b_eod.MarkDone();
+      b_checkpoint.Checkpoint();
+    }
+    //evaluate the standard curve scenarios against the end of day positions
+    ScenarioEngine b_scenarios(bndrisk);
+    ScenarioGrid b_scenario_grid;
+    b_scenarios.Run(ScenarioEngine::StandardScenarios(),b_scenario_grid);
+    WriteScenarioGrid(b_scenario_grid,"./Output/Scenarios.txt");
     //construct bond execution service
     BondExecutionService b_exe_service;
+    b_exe_service.SetRandomSource(&b_random);
     //construct bond execution connector for historical data
     BondExecutionHistoricalConnector b_exe_connect;
+    b_exe_connect.SetRotationPolicy(hist_rotation);
     //construct bond execution historical data service and link with connector
     BondExecutionHistoricalData b_exe_data(b_exe_connect);
+    b_checkpoint.Register(&b_exe_data);
     //construct bond executionorder listener and link with bond execution historical data service
     BondExecutionHistoricalListener* b_exe_listen=new BondExecutionHistoricalListener(b_exe_data);
     //construct bond algoexecution listener and link with bond execution service
@@ -129,10 +262,16 @@ int main(){
     b_exe_service.AddListener(b_exe_listen);
     //construct market data service
     BondMarketDataService bm_ds;
+    b_checkpoint.Register(&bm_ds);
     //construct bond algo execution service
     BondAlgoExecutionService b_algo_exe;
+    b_checkpoint.Register(&b_algo_exe);
     //add algo listener to bond algo execution service
     b_algo_exe.AddListener(b_algo_listener);
+    b_algo_exe.SetOrderCheck(&b_limits);//every order passes the pre-trade limits first
+    //construct rfq market data listener ahead of the algo, which takes liquidity off the book it is given
+    BondMarketDataRfqListener* b_mkt_rfq_listen=new BondMarketDataRfqListener(b_rfq_pricer);
+    bm_ds.AddListener(b_mkt_rfq_listen);
     //construct bond market data listener and link with bond algo execution service
     BondMarketDataListeners* b_mkt_listener=new BondMarketDataListeners(b_algo_exe);
     //add bond market data listener to market data service
@@ -140,30 +279,70 @@ int main(){
 
     //construct bond market data connector
     BondMarketDataConnector bm_connect;
+    b_checkpoint.Register(&bm_connect);
     //flow market data to bond market data service
-    for(int i=0;i<numofmarket;++i){
+    for(int i=bm_connect.GetCounter();i<numofmarket;++i){
+      if(i%checkpointEvery==0) b_checkpoint.Checkpoint();
       bm_connect.Subscribe(bm_ds,m_bond);
     }
+    b_checkpoint.Checkpoint();
     //construct inquiry connector for publish
     BondPublishIqConnector b_publish;
     //construct inquiry connector for historical data
     BondIqHistoricalConnector b_iq_hist_connect;
+    b_iq_hist_connect.SetRotationPolicy(hist_rotation);
     //construct bond inquiry historical data service and link with connector
     BondIqHistoricalData b_iq_data(b_iq_hist_connect);
+    b_checkpoint.Register(&b_iq_data);
     //construct bond inquiry historical listener and link with bond inquiry historical data service
     BondIqHistoricalListener* b_iq_hist_listen=new BondIqHistoricalListener(b_iq_data);
     //construct bond inquiry service and link with connector
-    BondInquiryService b_inquire(b_publish);
+    BondInquiryService b_inquire(b_ref_data,b_publish);
+    b_inquire.SetQuoteCheck(&b_limits);//every quote passes the pre-trade limits first
     //construct bond inquiry service listener and link with bond inquiry service
-    BondInquiryListener* b_iq_listen=new BondInquiryListener(b_inquire);
+    BondInquiryListener* b_iq_listen=new BondInquiryListener(b_inquire,&b_rfq_pricer);//quotes come from the rfq pricer
     //add listeners to bond inquiry service
     b_inquire.AddListener(b_iq_hist_listen);
     b_inquire.AddListener(b_iq_listen);
     //construct bond inquiry connector
     BondInquiryConnector b_iq_connect;
+    b_checkpoint.Register(&b_iq_connect);
     //flow data into bond inquiry service, no more than 60
-    for(int i=0;i<numofiq;++i){
+    for(int i=b_iq_connect.GetCounter();i<numofiq;++i){
+      if(i%checkpointEvery==0) b_checkpoint.Checkpoint();
       b_iq_connect.Subscribe(b_inquire,m_bond);
     }
+    b_checkpoint.Checkpoint();
+    //construct list inquiry connector for publish, quoted lists go back as one response
+    BondPublishListIqConnector b_list_publish;
+    //construct list inquiry connector for historical data, one record per list with its legs
+    BondListIqHistoricalConnector b_list_hist_connect;
+    b_list_hist_connect.SetRotationPolicy(hist_rotation);
+    BondListIqHistoricalData b_list_data(b_list_hist_connect);
+    b_checkpoint.Register(&b_list_data);
+    BondListIqHistoricalListener* b_list_hist_listen=new BondListIqHistoricalListener(b_list_data);
+    //construct list inquiry service, every list quote passes the pre-trade limits on its netted legs
+    BondListInquiryService b_lists(b_list_publish);
+    b_lists.SetQuoteCheck(&b_limits);
+    //construct list inquiry listener, which prices all legs of a list in one pass of the rfq pricer
+    BondListInquiryListener* b_list_listen=new BondListInquiryListener(b_lists,b_rfq_pricer);
+    b_lists.AddListener(b_list_hist_listen);
+    b_lists.AddListener(b_list_listen);
+    //construct list inquiry connector
+    BondListInquiryConnector b_list_connect;
+    b_checkpoint.Register(&b_list_connect);
+    //flow list inquiries into the list inquiry service
+    for(int i=b_list_connect.GetCounter();i<numoflists;++i){
+      if(i%checkpointEvery==0) b_checkpoint.Checkpoint();
+      b_list_connect.Subscribe(b_lists,b_ref_data);
+    }
+    b_checkpoint.Checkpoint();
+    //report the pre-trade checks
+    cout<<"limit checks: "<<b_limits.GetAcceptedCount()<<" accepted, "<<b_limits.GetRejectedCount()<<" rejected ("
+        <<b_limits.GetRejectedCount(CUSIP_LIMIT)<<" cusip, "<<b_limits.GetRejectedCount(BOOK_LIMIT)<<" book, "
+        <<b_limits.GetRejectedCount(SECTOR_LIMIT)<<" sector)\n";
+    //report desk pnl
+    DeskPnL desk_pnl=b_pnl.GetDeskPnL();
+    cout<<"desk pnl: realized "<<desk_pnl.realized<<", unrealized "<<desk_pnl.unrealized<<"\n";
     return 0;
 }
\ No newline at end of file
@@ -10,6 +10,7 @@
 #include <string>
 #include <vector>
 #include "soa.hpp"
+#include "listenerlist.hpp"
 #include <map>
 #include <algorithm>
 #include <iostream>
@@ -18,6 +19,9 @@
 #include <cstddef>
 #include <functional>
 #include <cmath>
+#include "snapshot.hpp"
+#include "producthandle.hpp"
+#include "arena.hpp"
 
 
 using namespace std;
@@ -88,24 +92,29 @@ class OrderBook
 public:
 
   // ctor for the order book
-  OrderBook(const T &_product, const vector<Order> &_bidStack, const vector<Order> &_offerStack);
+  OrderBook(const ProductHandle<T> &_product, const vector<Order> &_bidStack, const vector<Order> &_offerStack);
 
   // Get the product
   const T& GetProduct() const;
 
+  // Get the shared handle of the product, to build further messages without interning it again
+  const ProductHandle<T>& GetProductHandle() const{return product;}
+
   // Get the bid stack
   const vector<Order>& GetBidStack() const;
+  vector<Order>& GetBidStack(){return bidStack;}
   //set the bid stack
   void SetBidStack(const vector<Order>& src){bidStack=src;}
 
   // Get the offer stack
   const vector<Order>& GetOfferStack() const;
+  vector<Order>& GetOfferStack(){return offerStack;}
   //set the offer stack
   void SetOfferStack(const vector<Order>& src){offerStack=src;}
   
 
 private:
-  T product;
+  ProductHandle<T> product;
   vector<Order> bidStack;
   vector<Order> offerStack;
 
@@ -137,7 +146,9 @@ public:
     return false;
   }
 };
-void AggregateToMap(map<double,long,Key_Less>& final_map, vector<Order>& order_stack){
+//price levels of a book being aggregated, held in the arena of the event
+typedef map<double,long,Key_Less,ArenaAllocator<pair<const double,long> > > DepthLevels;
+void AggregateToMap(DepthLevels& final_map, const vector<Order>& order_stack){
   for(int i=0;i<order_stack.size();++i){
       double price=order_stack[i].GetPrice();//get price
       long qty=order_stack[i].GetQuantity();//get quantity
@@ -149,24 +160,35 @@ void AggregateToMap(map<double,long,Key_Less>& final_map, vector<Order>& order_s
       }
     }
 }
-vector<Order> GetOrderStack(map<double, long, Key_Less>& final_map, PricingSide side_){
-  vector<Order> result;
+//fill result with the levels of the map, reusing its capacity
+void GetOrderStack(const DepthLevels& final_map, PricingSide side_, vector<Order>& result){
+  result.clear();
   //iterate the map
-   for(map<double,long,Key_Less>::iterator it=final_map.begin();it!=final_map.end();++it){
+   for(DepthLevels::const_iterator it=final_map.begin();it!=final_map.end();++it){
      double p=it->first; //get price
      long qty=it->second; //get quantity
      Order temp(p,qty,side_);//contruct temporary order
      result.push_back(temp);//push to result
    }
-   return result;
 }
 //the marketdata.txt only contains the best bid and offer
-class BondMarketDataService: public MarketDataService<Bond>
+class BondMarketDataService: public MarketDataService<Bond>, public Snapshottable
 {
 private:
   multimap<string, OrderBook<Bond> > bondMarketDataCache;
-  vector< ServiceListener<OrderBook<Bond> >* > bondOrderBookListeners;
+  ListenerList<OrderBook<Bond> > bondOrderBookListeners;
+  EventArena depthArena;//price levels of the book being aggregated, reset for every book
+  vector<Order> bidScratch;//aggregated stacks on their way into the cached book
+  vector<Order> offerScratch;
+  //add the levels of a book to the price maps
+  void AddLevels(const OrderBook<Bond>& book, DepthLevels& bids, DepthLevels& offers);
+  //write the price maps back into a cached book, its stacks keep their capacity
+  void StoreLevels(const DepthLevels& bids, const DepthLevels& offers, OrderBook<Bond>& book);
+  //aggregate the cached books of a product into one, in place
+  OrderBook<Bond>& Aggregate(const string &productId);
 public:
+  //hugePages puts the aggregation arena on huge pages when the system has them
+  explicit BondMarketDataService(bool hugePages=false):depthArena(ARENA_BLOCK_BYTES,hugePages){}
   // Aggregate the order book
   virtual const OrderBook<Bond> AggregateDepth(const string &productId);
   
@@ -175,32 +197,49 @@ public:
 
   // Get data on our service given a key
   virtual OrderBook<Bond>& GetData(string key){
-    AggregateDepth(key);//get the aggregated book
-    return bondMarketDataCache.find(key)->second;
+    return Aggregate(key);//get the aggregated book
   }
 
   // The callback that a Connector should invoke for any new or updated data
-  virtual void OnMessage(OrderBook<Bond> &data);
+  virtual void OnMessage(OrderBook<Bond> &data){OnMessage(OrderBook<Bond>(data));}
+  //take a book the connector no longer needs, its stacks are moved into the cache
+  //or, once the product has a book, merged into the one cached
+  virtual void OnMessage(OrderBook<Bond> &&data);
+  //number of times aggregation asked the system for memory, flat once the service is warm
+  size_t GetArenaAllocations() const{return depthArena.GetSystemAllocations();}
 
   // Add a listener to the Service for callbacks on add, remove, and update events
   // for data to the Service.
-  virtual void AddListener(ServiceListener<OrderBook<Bond> > *listener){bondOrderBookListeners.push_back(listener);}
+  virtual void AddListener(ServiceListener<OrderBook<Bond> > *listener){bondOrderBookListeners.Add(listener);}
+  //remove a listener, a dispatch already under way may still call it
+  virtual void RemoveListener(ServiceListener<OrderBook<Bond> > *listener){bondOrderBookListeners.Remove(listener);}
 
   // Get all listeners on the Service.
-  virtual const vector< ServiceListener<OrderBook<Bond> >* >& GetListeners() const{return bondOrderBookListeners;}
+  virtual const vector< ServiceListener<OrderBook<Bond> >* >& GetListeners() const{return bondOrderBookListeners.Snapshot();}
+
+  //checkpoint the order books
+  virtual string GetSnapshotName() const{return "marketdata";}
+  virtual void SaveSnapshot(SnapshotWriter& w) const;
+  virtual void LoadSnapshot(SnapshotReader& r);
 
 };
 //implement connector for BondMarketDataService
-class BondMarketDataConnector: public Connector<OrderBook<Bond> >
+class BondMarketDataConnector: public Connector<OrderBook<Bond> >, public Snapshottable
 {
 private:
   int counter;
 public:
   BondMarketDataConnector(){counter=0;}
+  //number of input lines consumed
+  int GetCounter() const{return counter;}
+  //checkpoint the input offset
+  virtual string GetSnapshotName() const{return "marketdata.offset";}
+  virtual void SaveSnapshot(SnapshotWriter& w) const{w.Put(counter);}
+  virtual void LoadSnapshot(SnapshotReader& r){counter=r.Get<int>();}
   // Publish data to the Connector
   virtual void Publish(OrderBook<Bond> &data){} //do nothing
   //subscribe and return subscribed data
-  virtual void Subscribe(BondMarketDataService& bmkt_data_service, map<string, Bond> m_bond);
+  virtual void Subscribe(BondMarketDataService& bmkt_data_service, map<string, Bond>& m_bond);
 };
 
 
@@ -242,7 +281,7 @@ const Order& BidOffer::GetOfferOrder() const
 }
 
 template<typename T>
-OrderBook<T>::OrderBook(const T &_product, const vector<Order> &_bidStack, const vector<Order> &_offerStack) :
+OrderBook<T>::OrderBook(const ProductHandle<T> &_product, const vector<Order> &_bidStack, const vector<Order> &_offerStack) :
   product(_product), bidStack(_bidStack), offerStack(_offerStack)
 {
 }
@@ -250,7 +289,7 @@ OrderBook<T>::OrderBook(const T &_product, const vector<Order> &_bidStack, const
 template<typename T>
 const T& OrderBook<T>::GetProduct() const
 {
-  return product;
+  return product.Get();
 }
 
 template<typename T>
@@ -266,46 +305,44 @@ const vector<Order>& OrderBook<T>::GetOfferStack() const
 }
 
 
-const OrderBook<Bond> BondMarketDataService::AggregateDepth(const string &productId){
+void BondMarketDataService::AddLevels(const OrderBook<Bond>& book, DepthLevels& bids, DepthLevels& offers){
+  AggregateToMap(bids,book.GetBidStack());
+  AggregateToMap(offers,book.GetOfferStack());
+}
+
+void BondMarketDataService::StoreLevels(const DepthLevels& bids, const DepthLevels& offers, OrderBook<Bond>& book){
+  GetOrderStack(bids,BID,bidScratch);
+  GetOrderStack(offers,OFFER,offerScratch);
+  book.SetBidStack(bidScratch);
+  book.SetOfferStack(offerScratch);
+}
+
+OrderBook<Bond>& BondMarketDataService::Aggregate(const string &productId){
     //get the pair of iterators for bondmarketdata cache given productId
     pair<multimap<string, OrderBook<Bond> >::iterator, multimap<string, OrderBook<Bond> >::iterator> pairs=bondMarketDataCache.equal_range(productId);
-    int count=0;
-    //get the first orderbook
-    OrderBook<Bond> orderBook1=pairs.first->second;
-    Bond bnd=orderBook1.GetProduct();//get bond of the orderbook
-    map<double, long, Key_Less> final_bid_price_q;//the map of bid price and quantity
-    map<double, long, Key_Less> final_offer_price_q;//the map of offer price and quantity
-    vector<Order> bid_stack_base=orderBook1.GetBidStack();//get bid stack of orderbook1
-    vector<Order> offer_stack_base=orderBook1.GetOfferStack();//get offer stack of orderbook1
-    //aggregate price and quantity pairs in maps
-    AggregateToMap(final_bid_price_q,bid_stack_base);
-    AggregateToMap(final_offer_price_q,offer_stack_base);
-    //iterate throughout the range
-    for(multimap<string, OrderBook<Bond> >::iterator it=pairs.first;it!=pairs.second;++it){
-      if(count==0) {
-        ++count;
-      }
-      else{
-        OrderBook<Bond> order_book_temp=it->second;//get the current orderbook
-        vector<Order> bid_stack_temp=order_book_temp.GetBidStack();//get bid stack of current orderbook
-        vector<Order> offer_stack_temp=order_book_temp.GetOfferStack();//get offer stack of current orderbook
-        AggregateToMap(final_bid_price_q,bid_stack_temp);//aggregate to map
-        AggregateToMap(final_offer_price_q,offer_stack_temp);//aggregate to map
-      }
-    }
-    vector<Order> bids_stack=GetOrderStack(final_bid_price_q,BID);
-    vector<Order> offers_stack=GetOrderStack(final_offer_price_q,OFFER);
-    //construct orderbook
-    OrderBook<Bond> aggregate_book(bnd,bids_stack,offers_stack);
-    bondMarketDataCache.erase(pairs.first,pairs.second);//erase previous records
-    bondMarketDataCache.insert(make_pair(productId,aggregate_book));
+    //the levels of the last book aggregated are no longer needed
+    depthArena.Reset();
+    ArenaAllocator<pair<const double,long> > alloc(&depthArena);
+    DepthLevels final_bid_price_q(Key_Less(),alloc);//the map of bid price and quantity
+    DepthLevels final_offer_price_q(Key_Less(),alloc);//the map of offer price and quantity
+    //aggregate price and quantity pairs of every book in the range
+    for(multimap<string, OrderBook<Bond> >::iterator it=pairs.first;it!=pairs.second;++it)
+      AddLevels(it->second,final_bid_price_q,final_offer_price_q);
+    //the first book of the range holds the aggregate, the others are dropped
+    OrderBook<Bond>& aggregate_book=pairs.first->second;
+    StoreLevels(final_bid_price_q,final_offer_price_q,aggregate_book);
+    bondMarketDataCache.erase(next(pairs.first),pairs.second);
     return aggregate_book;
   }
 
+const OrderBook<Bond> BondMarketDataService::AggregateDepth(const string &productId){
+    return Aggregate(productId);
+  }
+
   const BidOffer BondMarketDataService::GetBestBidOffer(const string &productId){
-    OrderBook<Bond> o_book=AggregateDepth(productId);//get the aggregate orderbook
-    vector<Order> bids=o_book.GetBidStack();//get bidstack
-    vector<Order> offers=o_book.GetOfferStack();//get offerstack
+    const OrderBook<Bond>& o_book=Aggregate(productId);//get the aggregate orderbook
+    const vector<Order>& bids=o_book.GetBidStack();//get bidstack
+    const vector<Order>& offers=o_book.GetOfferStack();//get offerstack
     double bestbid=bids[0].GetPrice();//get price of bids[0]
     double bestoffer=offers[0].GetPrice();//get price of offers[0]
     int bidindex=0, offerindex=0;
@@ -327,17 +364,65 @@ const OrderBook<Bond> BondMarketDataService::AggregateDepth(const string &produc
     return best;
   }
 
-  void BondMarketDataService::OnMessage(OrderBook<Bond> &data){
-    Bond bnd=data.GetProduct();//get the bond of the data
-    string bid=bnd.GetProductId();//get product id of bnd
-    bondMarketDataCache.insert(make_pair(bid,data));
+void SaveOrderStack(SnapshotWriter& w, const vector<Order>& stack){
+  w.Put(uint32_t(stack.size()));
+  for(size_t i=0;i<stack.size();++i){
+    w.Put(stack[i].GetPrice());
+    w.Put(stack[i].GetQuantity());
+  }
+}
+
+vector<Order> LoadOrderStack(SnapshotReader& r, PricingSide side_){
+  vector<Order> stack;
+  uint32_t n=r.Get<uint32_t>();
+  for(uint32_t i=0;i<n && r.IsGood();++i){
+    double p=r.Get<double>();
+    long qty=r.Get<long>();
+    stack.push_back(Order(p,qty,side_));
+  }
+  return stack;
+}
+
+void BondMarketDataService::SaveSnapshot(SnapshotWriter& w) const{
+  w.Put(uint32_t(bondMarketDataCache.size()));
+  for(multimap<string, OrderBook<Bond> >::const_iterator it=bondMarketDataCache.begin();it!=bondMarketDataCache.end();++it){
+    w.PutString(it->first);
+    SaveOrderStack(w,it->second.GetBidStack());
+    SaveOrderStack(w,it->second.GetOfferStack());
+  }
+}
+
+void BondMarketDataService::LoadSnapshot(SnapshotReader& r){
+  bondMarketDataCache.clear();
+  uint32_t n=r.Get<uint32_t>();
+  for(uint32_t i=0;i<n && r.IsGood();++i){
+    string pid=r.GetString();
+    vector<Order> bids=LoadOrderStack(r,BID);
+    vector<Order> offers=LoadOrderStack(r,OFFER);
+    const Bond* bnd=r.GetBond(pid);
+    if(bnd) bondMarketDataCache.insert(make_pair(pid,OrderBook<Bond>(*bnd,bids,offers)));
+  }
+}
+
+  void BondMarketDataService::OnMessage(OrderBook<Bond> &&data){
+    const Bond& bnd=data.GetProduct();//get the bond of the data
+    const string& bid=bnd.GetProductId();//get product id of bnd
+    multimap<string, OrderBook<Bond> >::iterator it=bondMarketDataCache.find(bid);
+    bool cached=it!=bondMarketDataCache.end();
+    if(!cached) it=bondMarketDataCache.insert(make_pair(bid,std::move(data)));
+    //aggregate into the cached book, merging the new one rather than caching another, so no node
+    //is allocated and the book the listeners get is aggregated once
+    depthArena.Reset();
+    ArenaAllocator<pair<const double,long> > alloc(&depthArena);
+    DepthLevels bids(Key_Less(),alloc), offers(Key_Less(),alloc);
+    AddLevels(it->second,bids,offers);
+    if(cached) AddLevels(data,bids,offers);
+    StoreLevels(bids,offers,it->second);
     //iterate listeners
-    for(int i=0;i<bondOrderBookListeners.size();++i){
-      bondOrderBookListeners[i]->ProcessUpdate(GetData(bid));//update orderbook data
-    }
+    bondOrderBookListeners.ProcessUpdate(it->second);//update orderbook data
   }
 
-  void BondMarketDataConnector::Subscribe(BondMarketDataService& bmkt_data_service, map<string, Bond> m_bond){
+  void BondMarketDataConnector::Subscribe(BondMarketDataService& bmkt_data_service, map<string, Bond>& m_bond){
     ifstream file;
     file.open("./Input/marketdata.txt");//open file
     string line;//store one line
@@ -387,9 +472,8 @@ const OrderBook<Bond> BondMarketDataService::AggregateDepth(const string &produc
       bidStack.push_back(bidOrder1);
       offerStack.push_back(offerOrder1);
     }
-    Bond bnd=m_bond[bondId];//get bond
-    OrderBook<Bond> result(bnd,bidStack,offerStack);//construct orderbook
-    bmkt_data_service.OnMessage(result);//flow into service
+    const Bond& bnd=m_bond[bondId];//get bond
+    bmkt_data_service.OnMessage(OrderBook<Bond>(bnd,bidStack,offerStack));//construct orderbook and flow into service
   }
 
 #endif
@@ -0,0 +1,66 @@
+/*
+implement statically wired listener sets for pipelines whose topology is fixed at compile time
+author: Gaoxian Song
+*/
+#ifndef Pipeline_HPP
+#define Pipeline_HPP
+
+#include <type_traits>
+#include "soa.hpp"
+
+using namespace std;
+
+//sink of a service with nothing wired statically, what the services hand events to by default
+class NoSink
+{
+public:
+  template<typename V> void ProcessAdd(V &data){}
+  template<typename V> void ProcessUpdate(V &data){}
+};
+
+//whether listener type L takes events of type V
+template<typename L, typename V>
+struct Listens: is_base_of<ServiceListener<V>, typename remove_reference<L>::type>
+{
+};
+
+/**
+ * Listeners of a service known by type rather than registered at run time, used as the sink a
+ * service hands its events to before its registered listeners.
+ * An event of type V goes to every member that is a ServiceListener<V>, in the order listed, through
+ * a call qualified with the member's class: there is no virtual dispatch and the compiler can inline
+ * the whole path down to the last service. Members listening to other types are skipped at compile time.
+ * A member listed as a reference is shared with whoever owns it; any other member is held by value,
+ * which is how a statically wired listener carries the sink of the next service.
+ */
+template<typename... Ls>
+class StaticListeners
+{
+public:
+  template<typename V> void ProcessAdd(V &data){}
+  template<typename V> void ProcessUpdate(V &data){}
+};
+
+template<typename L, typename... Ls>
+class StaticListeners<L, Ls...>: private StaticListeners<Ls...>
+{
+private:
+  typedef typename remove_reference<L>::type Listener;
+  L head;
+  template<typename V> void Add(V &data, true_type){head.Listener::ProcessAdd(data);}
+  template<typename V> void Add(V &data, false_type){}
+  template<typename V> void Update(V &data, true_type){head.Listener::ProcessUpdate(data);}
+  template<typename V> void Update(V &data, false_type){}
+public:
+  StaticListeners(L head_, Ls... rest):StaticListeners<Ls...>(rest...),head(head_){}
+  template<typename V> void ProcessAdd(V &data){
+    Add(data,typename Listens<L,V>::type());
+    StaticListeners<Ls...>::ProcessAdd(data);
+  }
+  template<typename V> void ProcessUpdate(V &data){
+    Update(data,typename Listens<L,V>::type());
+    StaticListeners<Ls...>::ProcessUpdate(data);
+  }
+};
+
+#endif
@@ -0,0 +1,294 @@
+/*
+implement real-time profit and loss from positions and live prices
+author: Gaoxian Song
+*/
+#ifndef PnLService_HPP
+#define PnLService_HPP
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include "soa.hpp"
+#include "listenerlist.hpp"
+#include "bookregistry.hpp"
+#include "referencedataservice.hpp"
+#include "positionservice.hpp"
+#include "pricingservice.hpp"
+#include "seqlock.hpp"
+
+using namespace std;
+
+/**
+ * PnL of a product: realized from closed quantity and unrealized on the open position.
+ * Amounts are quantity times price change per 100 face, divided by 100.
+ * Type T is the product type.
+ */
+template<typename T>
+class PnL
+{
+public:
+  PnL(const ProductHandle<T>& _product):product(_product),realized(0),unrealized(0){}
+  const T& GetProduct() const{return product.Get();}
+  //shared handle of the product, builds further messages without interning the product again
+  const ProductHandle<T>& GetProductHandle() const{return product;}
+  double GetRealized() const{return realized;}
+  double GetUnrealized() const{return unrealized;}
+  double GetTotal() const{return realized+unrealized;}
+  void Add(double realizedChange, double unrealizedChange){realized+=realizedChange; unrealized+=unrealizedChange;}
+private:
+  ProductHandle<T> product;
+  double realized;
+  double unrealized;
+};
+
+//desk wide totals published to reporting threads
+struct DeskPnL
+{
+  double realized;
+  double unrealized;
+  long trades;//position changes taken so far
+  long ticks;//price ticks taken so far
+};
+
+/**
+ * PnL per CUSIP, per book and for the desk, kept up to date incrementally.
+ * Each book and product holds a position and an average cost. A position change is treated
+ * as a fill at the prevailing mid (par before the first price), realizing against the average
+ * cost whatever it closes. A price tick moves unrealized PnL by position times the change in mid
+ * for that product's books only, so neither a trade nor a tick revalues the portfolio.
+ * Desk totals are republished through a sequence lock after every change.
+ */
+class BondPnLService: public Service<string, PnL<Bond> >, public Snapshottable
+{
+private:
+  BondReferenceDataService& refData;
+  vector<PnL<Bond> > productPnL;//by dense id
+  vector<double> mids;//last mid by dense id
+  //per book and product, indexed [book*products+dense id]
+  vector<long> bookQuantity;
+  vector<double> bookCost;//average cost of the open position
+  //per book totals
+  double bookRealizedTotal[MAX_BOOKS];
+  double bookUnrealizedTotal[MAX_BOOKS];
+  DeskPnL desk;
+  SeqLocked<DeskPnL> published;
+  ListenerList<PnL<Bond> > pnlListeners;
+  //take a fill of dq in book b of product d at price px
+  void Fill(int b, int d, long dq, double px);
+  void Notify(int d);
+public:
+  BondPnLService(BondReferenceDataService& refData_);
+
+  // Get data on our service given a key
+  // throws out_of_range for a product that is not in reference data
+  virtual PnL<Bond>& GetData(string key){
+    int d=refData.GetDenseId(key);
+    if(d<0) throw out_of_range("no pnl for "+key);
+    return productPnL[d];
+  }
+
+  // The callback that a Connector should invoke for any new or updated data
+  virtual void OnMessage(PnL<Bond> &data){}//do nothing as no need for connector
+
+  // Add a listener to the Service for callbacks on add, remove, and update events
+  // for data to the Service.
+  virtual void AddListener(ServiceListener<PnL<Bond> > *listener){pnlListeners.Add(listener);}
+  //remove a listener, a dispatch already under way may still call it
+  virtual void RemoveListener(ServiceListener<PnL<Bond> > *listener){pnlListeners.Remove(listener);}
+
+  // Get all listeners on the Service.
+  virtual const vector< ServiceListener<PnL<Bond> >* >& GetListeners() const{return pnlListeners.Snapshot();}
+
+  //take the full position of a product after a trade
+  void OnPosition(const Position<Bond>& position);
+  //take a new mid for a product
+  void OnPrice(const InlineId& productId, double mid);
+
+  double GetBookRealized(const string& book) const;
+  double GetBookUnrealized(const string& book) const;
+  //desk totals, safe to call from any thread
+  DeskPnL GetDeskPnL() const{return published.Load();}
+
+  //checkpoint positions, costs and accumulated pnl so a warm start continues the same totals
+  virtual string GetSnapshotName() const{return "pnl";}
+  virtual void SaveSnapshot(SnapshotWriter& w) const;
+  virtual void LoadSnapshot(SnapshotReader& r);
+};
+
+//feed positions into the pnl service
+class BondPositionPnLListener: public ServiceListener<Position<Bond> >
+{
+private:
+  BondPnLService& pnl;
+public:
+  BondPositionPnLListener(BondPnLService& src):pnl(src){}
+  // Listener callback to process an add event to the Service
+  virtual void ProcessAdd(Position<Bond> &data){pnl.OnPosition(data);}
+
+  // Listener callback to process a remove event to the Service
+  virtual void ProcessRemove(Position<Bond> &data){}
+
+  // Listener callback to process an update event to the Service
+  virtual void ProcessUpdate(Position<Bond> &data){pnl.OnPosition(data);}
+};
+
+//feed mids into the pnl service
+class BondPricePnLListener: public ServiceListener<Price<Bond> >
+{
+private:
+  BondPnLService& pnl;
+public:
+  BondPricePnLListener(BondPnLService& src):pnl(src){}
+  // Listener callback to process an add event to the Service
+  virtual void ProcessAdd(Price<Bond> &data){pnl.OnPrice(data.GetProduct().GetId(),data.GetMid());}
+
+  // Listener callback to process a remove event to the Service
+  virtual void ProcessRemove(Price<Bond> &data){}
+
+  // Listener callback to process an update event to the Service
+  virtual void ProcessUpdate(Price<Bond> &data){ProcessAdd(data);}
+};
+
+BondPnLService::BondPnLService(BondReferenceDataService& refData_):refData(refData_)
+{
+  int n=refData.Size();
+  for(int d=0;d<n;++d) productPnL.push_back(PnL<Bond>(refData.GetHandle(d)));
+  mids.assign(n,100.0);//par until the first price
+  bookQuantity.assign(MAX_BOOKS*n,0);
+  bookCost.assign(MAX_BOOKS*n,0);
+  for(int b=0;b<MAX_BOOKS;++b){bookRealizedTotal[b]=0; bookUnrealizedTotal[b]=0;}
+  desk.realized=0; desk.unrealized=0; desk.trades=0; desk.ticks=0;
+  published.Store(desk);
+}
+
+void BondPnLService::Fill(int b, int d, long dq, double px){
+  int i=b*refData.Size()+d;
+  long q=bookQuantity[i];
+  double cost=bookCost[i];
+  double oldUnrealized=double(q)*(mids[d]-cost)/100.0;
+  double realized=0;
+  if(q==0 || (q>0)==(dq>0)){
+    //opening or adding, average the cost
+    bookCost[i]=(double(q)*cost+double(dq)*px)/double(q+dq);
+  }
+  else{
+    //closing part or all of the position, possibly flipping it
+    long closed=labs(dq)<labs(q)?-dq:q;
+    realized=double(closed)*(px-cost)/100.0;
+    if(labs(dq)>labs(q)) bookCost[i]=px;//the remainder opens at the fill price
+    else if(q+dq==0) bookCost[i]=0;
+  }
+  bookQuantity[i]=q+dq;
+  double unrealizedChange=double(q+dq)*(mids[d]-bookCost[i])/100.0-oldUnrealized;
+  bookRealizedTotal[b]+=realized;
+  bookUnrealizedTotal[b]+=unrealizedChange;
+  productPnL[d].Add(realized,unrealizedChange);
+  desk.realized+=realized;
+  desk.unrealized+=unrealizedChange;
+}
+
+void BondPnLService::Notify(int d){
+  pnlListeners.ProcessUpdate(productPnL[d]);
+}
+
+void BondPnLService::OnPosition(const Position<Bond>& position){
+  int d=refData.GetDenseId(position.GetProduct().GetId());
+  if(d<0) return;
+  int n=refData.Size();
+  //only books that exist can have moved
+  for(int b=0;b<BookRegistry::Size();++b){
+    long dq=position.GetPosition(b)-bookQuantity[b*n+d];
+    if(dq!=0) Fill(b,d,dq,mids[d]);
+  }
+  ++desk.trades;
+  published.Store(desk);
+  Notify(d);
+}
+
+void BondPnLService::OnPrice(const InlineId& productId, double mid){
+  int d=refData.GetDenseId(productId);
+  if(d<0) return;
+  int n=refData.Size();
+  double change=mid-mids[d];
+  mids[d]=mid;
+  double total=0;
+  for(int b=0;b<BookRegistry::Size();++b){
+    double u=double(bookQuantity[b*n+d])*change/100.0;
+    bookUnrealizedTotal[b]+=u;
+    total+=u;
+  }
+  productPnL[d].Add(0,total);
+  desk.unrealized+=total;
+  ++desk.ticks;
+  published.Store(desk);
+  Notify(d);
+}
+
+void BondPnLService::SaveSnapshot(SnapshotWriter& w) const{
+  int n=refData.Size();
+  w.Put(uint32_t(n));
+  for(int d=0;d<n;++d){
+    w.PutString(refData.GetBond(d).GetProductId());
+    w.Put(mids[d]);
+    w.Put(productPnL[d].GetRealized());
+    w.Put(productPnL[d].GetUnrealized());
+  }
+  //books by name, their ids depend on the order books were first seen
+  w.Put(uint32_t(BookRegistry::Size()));
+  for(int b=0;b<BookRegistry::Size();++b){
+    w.PutString(BookRegistry::Name(b));
+    w.Put(bookRealizedTotal[b]);
+    w.Put(bookUnrealizedTotal[b]);
+    for(int d=0;d<n;++d){
+      w.Put(bookQuantity[b*n+d]);
+      w.Put(bookCost[b*n+d]);
+    }
+  }
+  w.Put(desk);
+}
+
+void BondPnLService::LoadSnapshot(SnapshotReader& r){
+  int n=refData.Size();
+  //products are matched by id; a bond missing from today's reference data is dropped
+  uint32_t products=r.Get<uint32_t>();
+  vector<int> dense;
+  for(uint32_t i=0;i<products && r.IsGood();++i){
+    int d=refData.GetDenseId(r.GetString());
+    dense.push_back(d);
+    double mid=r.Get<double>();
+    double realized=r.Get<double>();
+    double unrealized=r.Get<double>();
+    if(d<0) continue;
+    mids[d]=mid;
+    productPnL[d]=PnL<Bond>(refData.GetHandle(d));
+    productPnL[d].Add(realized,unrealized);
+  }
+  uint32_t books=r.Get<uint32_t>();
+  for(uint32_t i=0;i<books && r.IsGood();++i){
+    int b=BookRegistry::Intern(r.GetString());
+    double realized=r.Get<double>();
+    double unrealized=r.Get<double>();
+    if(b>=0){bookRealizedTotal[b]=realized; bookUnrealizedTotal[b]=unrealized;}
+    for(size_t k=0;k<dense.size();++k){
+      long q=r.Get<long>();
+      double cost=r.Get<double>();
+      if(b<0 || dense[k]<0) continue;
+      bookQuantity[b*n+dense[k]]=q;
+      bookCost[b*n+dense[k]]=cost;
+    }
+  }
+  desk=r.Get<DeskPnL>();
+  published.Store(desk);
+}
+
+double BondPnLService::GetBookRealized(const string& book) const{
+  int b=BookRegistry::Find(book);
+  return b<0?0:bookRealizedTotal[b];
+}
+
+double BondPnLService::GetBookUnrealized(const string& book) const{
+  int b=BookRegistry::Find(book);
+  return b<0?0:bookUnrealizedTotal[b];
+}
+
+#endif
@@ -10,7 +10,9 @@
 #include <string>
 #include <map>
 #include "soa.hpp"
+#include "listenerlist.hpp"
 #include "tradebookingservice.hpp"
+#include "pipeline.hpp"
 
 using namespace std;
 
@@ -25,22 +27,31 @@ class Position
 public:
 
   // ctor for a position
-  Position(const T &_product);
+  Position(const ProductHandle<T> &_product);
 
   // Get the product
   const T& GetProduct() const;
 
+  // Get the shared handle of the product, to build further messages without interning it again
+  const ProductHandle<T>& GetProductHandle() const{return product;}
+
   // Get the position quantity
-  long GetPosition(string &book);
+  long GetPosition(const string &book) const;
+
+  // Get the position quantity of an interned book id
+  long GetPosition(int bookId) const{return positions[bookId];}
 
   // Get the aggregate position
-  long GetAggregatePosition();
+  long GetAggregatePosition() const{return aggregate;}
   //Add to positions
   void AddToPosition(long quantity, string book);
+  //Add to the position of an interned book id
+  void AddToPosition(long quantity, int bookId);
 
 private:
-  T product;
-  map<string,long> positions;
+  ProductHandle<T> product;
+  long positions[MAX_BOOKS];//indexed by book id from BookRegistry
+  long aggregate;//sum over books, kept up to date on every add
 
 };
 
@@ -60,7 +71,7 @@ public:
 
 };
 //implement bond position service
-class BondPositionService: public PositionService<Bond>
+class BondPositionService: public PositionService<Bond>, public Snapshottable
 {
 public:
    // Get data on our service given a key
@@ -71,16 +82,29 @@ public:
 
   // Add a listener to the Service for callbacks on add, remove, and update events
   // for data to the Service.
-  virtual void AddListener(ServiceListener<Position<Bond> > *listener){bondPositionListeners.push_back(listener);}
+  virtual void AddListener(ServiceListener<Position<Bond> > *listener){bondPositionListeners.Add(listener);}
+  //remove a listener, a dispatch already under way may still call it
+  virtual void RemoveListener(ServiceListener<Position<Bond> > *listener){bondPositionListeners.Remove(listener);}
 
   // Get all listeners on the Service.
-  virtual const vector< ServiceListener<Position<Bond> >* >& GetListeners() const {return bondPositionListeners;}
+  virtual const vector< ServiceListener<Position<Bond> >* >& GetListeners() const {return bondPositionListeners.Snapshot();}
   //Add a trade to the service
-  virtual void AddTrade(const Trade<Bond> &trade);
+  virtual void AddTrade(const Trade<Bond> &trade){NoSink none; AddTrade(trade,none);}
+  //add a trade, the position goes to the statically wired sink before the registered listeners
+  template<typename Sink>
+  void AddTrade(const Trade<Bond> &trade, Sink &sink);
+
+  //get every position keyed on product id
+  const map<string, Position<Bond> >& GetPositions() const{return bondPositionCache;}
+
+  //checkpoint the positions, books are stored by name
+  virtual string GetSnapshotName() const{return "positions";}
+  virtual void SaveSnapshot(SnapshotWriter& w) const;
+  virtual void LoadSnapshot(SnapshotReader& r);
 
 private:
   map<string, Position<Bond> > bondPositionCache; //store position info
-  vector<ServiceListener<Position<Bond> >* > bondPositionListeners;//store listeners
+  ListenerList<Position<Bond> > bondPositionListeners;//store listeners
 };
 
 //implement BondTradeBookingServiceListener
@@ -104,79 +128,130 @@ public:
   }
 };
 
+//the trade that undoes a booked one
+Trade<Bond> ReverseTrade(const Trade<Bond> &data);
+
+//trade listener of a statically wired pipeline, positions go straight to the listeners in Sink
+template<typename Sink>
+class BondTradeStaticListener: public ServiceListener<Trade<Bond> >
+{
+private:
+  BondPositionService& bp_service;
+  Sink sink;
+public:
+  BondTradeStaticListener(BondPositionService& service, const Sink& sink_):bp_service(service),sink(sink_){}
+  // Listener callback to process adding a trade
+  virtual void ProcessAdd(Trade<Bond> &data){bp_service.AddTrade(data,sink);}
+
+  // Listener callback to process a remove event to the Service
+  virtual void ProcessRemove(Trade<Bond> &data){bp_service.AddTrade(ReverseTrade(data),sink);}
+
+  // Listener callback to process an update event to the Service
+  virtual void ProcessUpdate(Trade<Bond> &data){}
+};
 
 
-template<typename T>
-Position<T>::Position(const T &_product) : product(_product){}
 
 template<typename T>
-const T& Position<T>::GetProduct() const { return product;}
+Position<T>::Position(const ProductHandle<T> &_product) : product(_product), aggregate(0)
+{
+  for(int i=0;i<MAX_BOOKS;++i) positions[i]=0;
+}
 
 template<typename T>
-long Position<T>::GetPosition(string &book) { return positions[book];}
+const T& Position<T>::GetProduct() const { return product.Get();}
 
 template<typename T>
-long Position<T>::GetAggregatePosition()
+long Position<T>::GetPosition(const string &book) const
 {
-  // No-op implementation - should be filled out for implementations
-  long pos=0;//initialize aggregate position
-  for(map<string,long>::iterator it=positions.begin();it!=positions.end();++it)
-    pos+=it->second; //get aggregate position
-  return pos;
+  int id=BookRegistry::Find(book);//do not register books that were never traded
+  return id<0?0:positions[id];
 }
 
 template<typename T>
 void Position<T>::AddToPosition(long quantity, string book){
-    if(positions.find(book)==positions.end()){
-      //add quantity to positions
-      positions.insert(make_pair(book, quantity));
-    }
-    else{
-      positions[book]+=quantity;//update book
-    }
+    AddToPosition(quantity,BookRegistry::Intern(book));
   }
 
-void BondPositionService::AddTrade(const Trade<Bond> &trade){
-    Bond bnd=trade.GetProduct();//get bond
-    string bid=bnd.GetProductId();//get bond id
-    string book=trade.GetBook();
+template<typename T>
+void Position<T>::AddToPosition(long quantity, int bookId){
+    if(bookId<0) return;//the book could not be registered, the trade book rejects such trades
+    positions[bookId]+=quantity;//update book
+    aggregate+=quantity;//update aggregate
+  }
+
+
+template<typename Sink>
+void BondPositionService::AddTrade(const Trade<Bond> &trade, Sink &sink){
+    const Bond& bnd=trade.GetProduct();//get bond
     long quantity=trade.GetQuantity();
-    Side side1=trade.GetSide();
-    if(side1==SELL)
+    if(trade.GetSide()==SELL)
       quantity=-quantity;
-     Position<Bond> pos(bnd);//construct position
-     pos.AddToPosition(quantity,book);//update position
-     map<string, Position<Bond> >::iterator thepos=bondPositionCache.find(bid);//get the position that already exists
+    map<string, Position<Bond> >::iterator thepos=bondPositionCache.find(bnd.GetProductId());//get the position that already exists
     if(thepos==bondPositionCache.end()){
       //the product has not been registered with a position
-      bondPositionCache.insert(make_pair(bid,pos));//insert position
-      for(int i=0;i<bondPositionListeners.size();++i){
-        //iterate listeners to add position
-        bondPositionListeners[i]->ProcessAdd(pos);
-        bondPositionListeners[i]->ProcessUpdate(pos);
-      }
+      thepos=bondPositionCache.insert(make_pair(bnd.GetProductId(),Position<Bond>(trade.GetProductHandle()))).first;//insert position
+      thepos->second.AddToPosition(quantity,trade.GetBookId());//update position
+      sink.ProcessAdd(thepos->second);
+      bondPositionListeners.ProcessAdd(thepos->second);
     }
     else{
       //the product has a position already
-      thepos->second.AddToPosition(quantity,book);//update position
-      for(int i=0;i<bondPositionListeners.size();++i){
-        //iterate listeners to update position
-        bondPositionListeners[i]->ProcessAdd(pos);
-        bondPositionListeners[i]->ProcessUpdate(thepos->second);
+      thepos->second.AddToPosition(quantity,trade.GetBookId());//update position
+      sink.ProcessUpdate(thepos->second);
+      bondPositionListeners.ProcessUpdate(thepos->second);
+    }
+  }
+
+void BondPositionService::SaveSnapshot(SnapshotWriter& w) const{
+  w.Put(uint32_t(bondPositionCache.size()));
+  for(map<string, Position<Bond> >::const_iterator it=bondPositionCache.begin();it!=bondPositionCache.end();++it){
+    w.PutString(it->first);
+    w.Put(uint32_t(BookRegistry::Size()));
+    for(int b=0;b<BookRegistry::Size();++b){
+      w.PutString(BookRegistry::Name(b));
+      w.Put(it->second.GetPosition(b));
+    }
+  }
+}
+
+void BondPositionService::LoadSnapshot(SnapshotReader& r){
+  bondPositionCache.clear();
+  uint32_t n=r.Get<uint32_t>();
+  for(uint32_t i=0;i<n && r.IsGood();++i){
+    string pid=r.GetString();
+    const Bond* bnd=r.GetBond(pid);
+    uint32_t books=r.Get<uint32_t>();
+    if(!bnd){
+      //no longer in reference data, read past its books without building a position
+      for(uint32_t b=0;b<books && r.IsGood();++b){
+        r.GetString();
+        r.Get<long>();
       }
+      continue;
     }
+    Position<Bond> pos(*bnd);
+    for(uint32_t b=0;b<books && r.IsGood();++b){
+      string book=r.GetString();
+      long quantity=r.Get<long>();
+      if(quantity!=0) pos.AddToPosition(quantity,book);
+    }
+    bondPositionCache.insert(make_pair(pid,pos));
   }
+}
 
- void BondTradeListener::ProcessRemove(Trade<Bond> &data){
+Trade<Bond> ReverseTrade(const Trade<Bond> &data){
     Side side1=data.GetSide();//get side of trade to remove
     if(side1==BUY) side1=SELL;
     else side1=BUY; //flip side
-    Bond bnd=data.GetProduct();//get bond
     string tid=data.GetTradeId();//get bond id
     string book=data.GetBook();
     long quantity=data.GetQuantity();
-    Trade<Bond> reverseTrade(bnd,tid,book,quantity,side1);//construct reverse trade
-    bp_service.AddTrade(reverseTrade);
+    return Trade<Bond>(data.GetProductHandle(),tid,book,quantity,side1);//construct reverse trade
+  }
+
+ void BondTradeListener::ProcessRemove(Trade<Bond> &data){
+    bp_service.AddTrade(ReverseTrade(data));
   }
 
 
@@ -9,7 +9,9 @@
 
 #include <string>
 #include "soa.hpp"
+#include "listenerlist.hpp"
 #include "products.hpp"
+#include "producthandle.hpp"
 #include <map>
 #include "tradebookingservice.hpp"
 #include <algorithm>
@@ -25,11 +27,14 @@ class Price
 
 public:
   // ctor for a price
-  Price(const T &_product, double _mid, double _bidOfferSpread);
+  Price(const ProductHandle<T> &_product, double _mid, double _bidOfferSpread);
 
   // Get the product
   const T& GetProduct() const;
 
+  // Get the shared handle of the product, to build further messages without interning it again
+  const ProductHandle<T>& GetProductHandle() const{return product;}
+
   // Get the mid price
   double GetMid() const;
 
@@ -37,7 +42,7 @@ public:
   double GetBidOfferSpread() const;
 
 private:
-  const T& product;
+  ProductHandle<T> product;
   double mid;
   double bidOfferSpread;
 };
@@ -63,32 +68,40 @@ public:
   virtual void OnMessage(Price<Bond> &data);
   // Add a listener to the Service for callbacks on add, remove, and update events
   // for data to the Service.
-  virtual void AddListener(ServiceListener<Price<Bond> > *listener){bondPriceListeners.push_back(listener);}
+  virtual void AddListener(ServiceListener<Price<Bond> > *listener){bondPriceListeners.Add(listener);}
+  //remove a listener, a dispatch already under way may still call it
+  virtual void RemoveListener(ServiceListener<Price<Bond> > *listener){bondPriceListeners.Remove(listener);}
 
   // Get all listeners on the Service.
-  virtual const vector< ServiceListener<Price<Bond> >* >& GetListeners() const{return bondPriceListeners;}
+  virtual const vector< ServiceListener<Price<Bond> >* >& GetListeners() const{return bondPriceListeners.Snapshot();}
 
 private:
   map<string, Price<Bond> > bondPriceCache;//store price records
-  vector<ServiceListener<Price<Bond> >* > bondPriceListeners;  
+  ListenerList<Price<Bond> > bondPriceListeners;  
 };
 
 //specify connector for pricing service
-class BondPriceConnector: public Connector<Price<Bond> >
+class BondPriceConnector: public Connector<Price<Bond> >, public Snapshottable
 {
 private:
   int counter;//get counter
 public:
   //constructor
   BondPriceConnector(){counter=0;}
+  //number of input lines consumed
+  int GetCounter() const{return counter;}
+  //checkpoint the input offset
+  virtual string GetSnapshotName() const{return "prices.offset";}
+  virtual void SaveSnapshot(SnapshotWriter& w) const{w.Put(counter);}
+  virtual void LoadSnapshot(SnapshotReader& r){counter=r.Get<int>();}
   // Publish data to the Connector
   virtual void Publish(Price<Bond> &data){}//do nothing
   //subscribe and return subscribed data
-  virtual void Subscribe(BondPriceService& bprice_service, map<string, Bond> m_bond);
+  virtual void Subscribe(BondPriceService& bprice_service, map<string, Bond>& m_bond);
 };
 
 template<typename T>
-Price<T>::Price(const T &_product, double _mid, double _bidOfferSpread) :
+Price<T>::Price(const ProductHandle<T> &_product, double _mid, double _bidOfferSpread) :
   product(_product)
 {
   mid = _mid;
@@ -98,7 +111,7 @@ Price<T>::Price(const T &_product, double _mid, double _bidOfferSpread) :
 template<typename T>
 const T& Price<T>::GetProduct() const
 {
-  return product;
+  return product.Get();
 }
 
 template<typename T>
@@ -115,27 +128,24 @@ double Price<T>::GetBidOfferSpread() const
 
 void BondPriceService::OnMessage(Price<Bond> &data){
     //get bond
-    Bond bnd=data.GetProduct();
+    const Bond& bnd=data.GetProduct();
     //get bond id
-    string bndid=bnd.GetProductId();
-    if(bondPriceCache.find(bndid)==bondPriceCache.end()){
+    const string& bndid=bnd.GetProductId();
+    map<string, Price<Bond> >::iterator it=bondPriceCache.find(bndid);
+    if(it==bondPriceCache.end()){
       //insert data to cache
       bondPriceCache.insert(make_pair(bndid,data));
       //use listeners to add
-      for(int i=0;i<bondPriceListeners.size();++i)
-        bondPriceListeners[i]->ProcessAdd(data);
+      bondPriceListeners.ProcessAdd(data);
     }
     else{
-      bondPriceCache.erase(bndid);//erase bndid
-      //update data
-      bondPriceCache.insert(make_pair(bndid,data));
+      it->second=data;//update data in place
       //use listeners to update
-      for(int i=0;i<bondPriceListeners.size();++i)
-        bondPriceListeners[i]->ProcessAdd(data);
+      bondPriceListeners.ProcessAdd(data);
     }
   }
 
-void BondPriceConnector::Subscribe(BondPriceService& bprice_service, map<string, Bond> m_bond){
+void BondPriceConnector::Subscribe(BondPriceService& bprice_service, map<string, Bond>& m_bond){
     ifstream file;
     file.open("./Input/prices.txt");//open file
     string line;//store one line
@@ -173,7 +183,7 @@ void BondPriceConnector::Subscribe(BondPriceService& bprice_service, map<string,
     double bid3num=int(bid2[2]-'0')/256.0;//get part 3 of bid
     double bidtotal=bid1num+bid2num+bid3num;//sum up bid
     double mid=bidtotal+0.5*spd; //get mid price
-    Bond bnd=m_bond[bondId];//get bond
+    const Bond& bnd=m_bond[bondId];//get bond
     Price<Bond> p_bond(bnd,mid,spd);//construct price
     bprice_service.OnMessage(p_bond);//flow data to service
   }
@@ -0,0 +1,93 @@
+/*
+implement shared immutable product instances referenced by handle from every message
+author: Gaoxian Song
+*/
+#ifndef ProductHandle_HPP
+#define ProductHandle_HPP
+
+#include <string>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include "identifiers.hpp"
+
+using namespace std;
+
+/**
+ * Process wide table of products, one shared instance per version of a product.
+ * Instances are never changed or freed once registered, so a pointer to one stays valid and
+ * reads the same for the life of the process. Amended static data, such as a bond after a date
+ * roll, is registered as a new version; messages built before keep the version they were built with.
+ * Lookups and registrations are serialized by a mutex, so any thread may build a message from a
+ * product it holds by value. Messages built from another message or from reference data carry
+ * the handle across instead and never come here.
+ * Type T is the product type and needs GetId.
+ */
+template<typename T>
+class ProductRegistry
+{
+private:
+  deque<T> instances;//every version registered, addresses stay valid as versions are added
+  unordered_map<InlineId, const T*> current;//latest version of each product id
+  unordered_set<const T*> owned;//addresses of the instances, to recognize a product that is already shared
+  mutex lock;//guards everything above
+  static ProductRegistry& Instance(){
+    static ProductRegistry registry;
+    return registry;
+  }
+  const T* Add(const T& product){
+    instances.push_back(product);
+    const T* p=&instances.back();
+    owned.insert(p);
+    current[product.GetId()]=p;
+    return p;
+  }
+public:
+  //shared instance of a product: the product itself if it is already shared, otherwise the
+  //latest version registered for its id, registering a copy if the id is new
+  static const T* Intern(const T& product){
+    ProductRegistry& r=Instance();
+    lock_guard<mutex> guard(r.lock);
+    if(r.owned.count(&product)) return &product;
+    typename unordered_map<InlineId, const T*>::const_iterator it=r.current.find(product.GetId());
+    return it!=r.current.end()?it->second:r.Add(product);
+  }
+  //register a new version of a product, returned by Intern for its id from now on
+  static const T* Update(const T& product){
+    ProductRegistry& r=Instance();
+    lock_guard<mutex> guard(r.lock);
+    return r.Add(product);
+  }
+  //number of versions registered so far
+  static int Size(){
+    ProductRegistry& r=Instance();
+    lock_guard<mutex> guard(r.lock);
+    return r.instances.size();
+  }
+};
+
+/**
+ * What a message holds for its product: a pointer to the shared instance in ProductRegistry,
+ * so copying a message copies a pointer rather than the product.
+ * Message constructors take a handle. Passing one from another message's GetProductHandle or from
+ * BondReferenceDataService::GetHandle copies the pointer; passing a product by value converts
+ * through Intern, which takes the registry lock and a hash lookup, so hot paths pass handles.
+ * This covers the product only: trades and inquiries still carry their ids as strings, and an
+ * inquiry rebuilt from the inquiry pool formats its numeric id with to_string.
+ * Types that are not registered products specialize this to hold their own copy.
+ * Type T is the product type.
+ */
+template<typename T>
+class ProductHandle
+{
+private:
+  const T* product;
+public:
+  ProductHandle(const T& _product):product(ProductRegistry<T>::Intern(_product)){}
+  //handle of an instance already returned by ProductRegistry, taken as is
+  explicit ProductHandle(const T* shared):product(shared){}
+  const T& Get() const{return *product;}
+};
+
+#endif
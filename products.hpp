@@ -10,6 +10,7 @@
 #include <iostream>
 #include <string>
 #include <cmath>
+#include "identifiers.hpp"
 
 #include "boost/date_time/gregorian/gregorian.hpp"
 
@@ -33,11 +34,15 @@ public:
   // Get the product identifier
   const string& GetProductId() const;
 
+  //Get the product identifier in its inline form, for lookups on the hot path
+  const InlineId& GetId() const{return id;}
+
   // Ge the product type
   ProductType GetProductType() const;
 
 private:
   string productId;
+  InlineId id;
   ProductType productType;
 
 };
@@ -67,8 +72,26 @@ public:
   // Get the maturity date
   const date& GetMaturityDate() const;
 
-  //Get sector type
-  BondSectorType GetSectorType() const;
+  //Get sector type as of the current as-of date
+  BondSectorType GetSectorType() const{return sector;}
+
+  //Get the date the cached attributes below were computed for
+  const date& GetAsOfDate() const{return asOfDate;}
+
+  //Get the whole number of calendar years between the as-of date and maturity
+  int GetYearsToMaturity() const{return yearsToMaturity;}
+
+  //Get the time to maturity in years (act/365.25)
+  double GetYearFraction() const{return yearFraction;}
+
+  //Get the days between the as-of date and maturity, 0 once matured
+  long GetDaysToMaturity() const{return daysToMaturity;}
+
+  //recompute the date dependent attributes for a new as-of date
+  void SetAsOfDate(const date& _asOfDate);
+
+  //whether the attributes derived from the as-of date match those of other
+  bool SameDateAttributes(const Bond& other) const;
 
   // Get the bond identifier type
   BondIdType GetBondIdType() const;
@@ -82,6 +105,12 @@ private:
   string ticker;
   float coupon;
   date maturityDate;
+  //attributes derived from the as-of date, refreshed by SetAsOfDate
+  date asOfDate;
+  int yearsToMaturity;
+  double yearFraction;
+  long daysToMaturity;
+  BondSectorType sector;
 
 };
 
@@ -170,6 +199,7 @@ private:
 Product::Product(string _productId, ProductType _productType)
 {
   productId = _productId;
+  id = InlineId(_productId);
   productType = _productType;
 }
 
@@ -189,9 +219,10 @@ Bond::Bond(string _productId, BondIdType _bondIdType, string _ticker, float _cou
   ticker = _ticker;
   coupon = _coupon;
   maturityDate =_maturityDate;
+  SetAsOfDate(day_clock::local_day());//default to today, reference data sets an explicit date
 }
 
-Bond::Bond() : Product(0, BOND)
+Bond::Bond() : Product("", BOND), bondIdType(CUSIP), coupon(0), yearsToMaturity(0), yearFraction(0), daysToMaturity(0), sector(FrontEnd)
 {
 }
 
@@ -376,14 +407,20 @@ string IRSwap::ToString(SwapLegType swapLegType) const
   }
 }
 
-BondSectorType Bond::GetSectorType() const{
-  //current date
-  date current(day_clock::local_day());
-  int year1=abs(current.year()-maturityDate.year());//get years to maturity
-  //return sector type bsed on year
-  if(year1<4) return FrontEnd;
-  if(year1<12) return Belly;
-  return LongEnd;
+void Bond::SetAsOfDate(const date& _asOfDate){
+  asOfDate=_asOfDate;
+  //a matured bond stays at zero rather than counting the years since it matured
+  daysToMaturity=max(0L,long((maturityDate-asOfDate).days()));
+  yearsToMaturity=daysToMaturity>0?abs(asOfDate.year()-maturityDate.year()):0;//get years to maturity
+  yearFraction=double(daysToMaturity)/365.25;
+  //sector type based on year
+  if(yearsToMaturity<4) sector=FrontEnd;
+  else if(yearsToMaturity<12) sector=Belly;
+  else sector=LongEnd;
+}
+
+bool Bond::SameDateAttributes(const Bond& other) const{
+  return yearsToMaturity==other.yearsToMaturity && daysToMaturity==other.daysToMaturity && sector==other.sector;
 }
 
 #endif
@@ -0,0 +1,67 @@
+/*
+implement a random source whose state is saved with each checkpoint
+author: Gaoxian Song
+*/
+#ifndef RandomSource_HPP
+#define RandomSource_HPP
+
+#include <stdint.h>
+#include "snapshot.hpp"
+
+using namespace std;
+
+/**
+ * Random draws of the simulated desk, such as the sizes of price streams and the venue of an
+ * execution, shared by the services in the order the feeds run.
+ * It is the additive feedback generator behind glibc's rand(), seeded the same way, so a run draws
+ * what rand() drew; unlike rand() its state is part of a checkpoint, so a warm start goes on with
+ * the draws the checkpoint left off at and writes what the uninterrupted run wrote.
+ */
+class RandomSource: public Snapshottable
+{
+private:
+  uint32_t state[31];//the last 31 values, oldest at next
+  uint32_t next;
+public:
+  explicit RandomSource(uint32_t seed=1);
+  //a value in [0, RAND_MAX]
+  int Next();
+  virtual string GetSnapshotName() const{return "random";}
+  virtual void SaveSnapshot(SnapshotWriter& w) const;
+  virtual void LoadSnapshot(SnapshotReader& r);
+};
+
+RandomSource::RandomSource(uint32_t seed):next(0)
+{
+  int32_t r[34];//r[31..33] repeat r[0..2]
+  r[0]=seed==0?1:seed;
+  for(int i=1;i<31;++i){
+    //16807*r mod 2^31-1 without overflow, as glibc seeds it
+    int32_t hi=r[i-1]/127773, lo=r[i-1]%127773;
+    r[i]=16807*lo-2836*hi;
+    if(r[i]<0) r[i]+=2147483647;
+  }
+  for(int i=31;i<34;++i) r[i]=r[i-31];
+  for(int i=0;i<31;++i) state[i]=r[i+3];
+  //rand() throws away the first 310 values
+  for(int i=0;i<310;++i) Next();
+}
+
+int RandomSource::Next(){
+  uint32_t value=state[next]+state[(next+28)%31];//r[i-31]+r[i-3]
+  state[next]=value;
+  next=(next+1)%31;
+  return int(value>>1);
+}
+
+void RandomSource::SaveSnapshot(SnapshotWriter& w) const{
+  for(int i=0;i<31;++i) w.Put(state[i]);
+  w.Put(next);
+}
+
+void RandomSource::LoadSnapshot(SnapshotReader& r){
+  for(int i=0;i<31;++i) state[i]=r.Get<uint32_t>();
+  next=r.Get<uint32_t>()%31;
+}
+
+#endif
@@ -0,0 +1,322 @@
+/*
+implement compile-time record serialization for historical data
+author: Gaoxian Song
+*/
+#ifndef RecordFormat_HPP
+#define RecordFormat_HPP
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <stdint.h>
+#include "positionservice.hpp"
+#include "executionservice.hpp"
+#include "inquiryservice.hpp"
+#include "streamingservice.hpp"
+
+using namespace std;
+
+/**
+ * Field description of a record type, resolved entirely at compile time.
+ * Each specialization lists the fields of T in output order:
+ *   template<typename W> static void Write(const T &data, W &w){ w.Field(...); ... }
+ * W is a record writer, CsvRecordWriter or BinaryRecordWriter, or a BinaryRecordReader checking
+ * a binary record against the record it was written from.
+ */
+template<typename T>
+struct RecordFields;
+
+//preallocated output buffer reused across records
+class RecordBuffer
+{
+private:
+  vector<char> storage;//grows only if a record exceeds the capacity
+  size_t used;//bytes written since the last reset
+public:
+  RecordBuffer(size_t capacity=1024):storage(capacity),used(0){}
+  void Reset(){used=0;}
+  const char* Data() const{return &storage[0];}
+  size_t Size() const{return used;}
+  //reserve len bytes at the end of the buffer and return where to write them
+  char* Extend(size_t len){
+    if(used+len>storage.size()) storage.resize(2*(used+len));
+    char* p=&storage[used];
+    used+=len;
+    return p;
+  }
+  void Append(const char* src, size_t len){memcpy(Extend(len),src,len);}
+  void Append(char c){*Extend(1)=c;}
+};
+
+//price written in treasury fractional notation (e.g. 99-160) in text records
+//and as a plain double in binary records
+class FractionalPrice
+{
+public:
+  double price;
+  explicit FractionalPrice(double p):price(p){}
+};
+
+//enum names shared by every writer
+const char* EnumName(PricingSide side){return side==BID?"BID":"OFFER";}
+const char* EnumName(Side side){return side==BUY?"BUY":"SELL";}
+const char* EnumName(OrderType type){
+  switch(type){
+    case FOK: return "FOK";
+    case IOC: return "IOC";
+    case MARKET: return "MARKET";
+    case LIMIT: return "LIMIT";
+    case STOP: return "STOP";
+  }
+  return "";
+}
+const char* EnumName(Market market){
+  switch(market){
+    case BROKERTEC: return "BROKERTEC";
+    case ESPEED: return "ESPEED";
+    case CME: return "CME";
+  }
+  return "";
+}
+const char* EnumName(InquiryState state){
+  switch(state){
+    case RECEIVED: return "RECEIVED";
+    case QUOTED: return "QUOTED";
+    case DONE: return "DONE";
+    case REJECTED: return "REJECTED";
+    case CUSTOMER_REJECTED: return "CUSTOMER_REJECTED";
+  }
+  return "";
+}
+
+//writes comma separated fields and a trailing newline
+//numbers use the same formatting as to_string so files keep their layout
+class CsvRecordWriter
+{
+private:
+  RecordBuffer& buffer;
+  bool first;//no separator before the first field
+  void Separator(){if(first) first=false; else buffer.Append(',');}
+  //write an integer without going through a stream
+  void Integer(long v){
+    char tmp[24];
+    int n=0;
+    unsigned long u=v<0?0UL-(unsigned long)v:(unsigned long)v;
+    do{tmp[n++]=char('0'+u%10); u/=10;}while(u>0);
+    if(v<0) tmp[n++]='-';
+    char* p=buffer.Extend(n);
+    for(int i=0;i<n;++i) p[i]=tmp[n-1-i];
+  }
+public:
+  CsvRecordWriter(RecordBuffer& buffer_):buffer(buffer_),first(true){}
+  void Field(const string& s){Separator(); buffer.Append(s.data(),s.size());}
+  void Field(const char* s){Separator(); buffer.Append(s,strlen(s));}
+  void Field(long v){Separator(); Integer(v);}
+  void Field(int v){Field(long(v));}
+  void Field(double v){
+    Separator();
+    char tmp[64];
+    int n=snprintf(tmp,sizeof(tmp),"%f",v);//same as to_string(double)
+    buffer.Append(tmp,n);
+  }
+  void Field(const FractionalPrice& p){
+    Separator();
+    int part1=int(p.price);//get the integer part of price
+    double p2=p.price-double(part1);//get the decimal part of price
+    int part2=int(p2*32);//get part2 of price
+    double p3=p2-double(part2)/32;//get last part of price
+    int part3=round(p3*256);//get part3 of price
+    Integer(part1);
+    buffer.Append('-');
+    if(part2<10) buffer.Append('0');
+    Integer(part2);
+    Integer(part3);
+  }
+  template<typename E>
+  void Field(E e){Field(EnumName(e));}
+  //terminate the record
+  void End(){buffer.Append('\n');}
+};
+
+//writes fields in native byte order: strings as uint32 length and bytes,
+//integers as int64, doubles as 8 bytes and enums as a single byte
+class BinaryRecordWriter
+{
+private:
+  RecordBuffer& buffer;
+  template<typename V>
+  void Raw(V v){memcpy(buffer.Extend(sizeof(V)),&v,sizeof(V));}
+  void Bytes(const char* s, size_t len){Raw(uint32_t(len)); buffer.Append(s,len);}
+public:
+  BinaryRecordWriter(RecordBuffer& buffer_):buffer(buffer_){}
+  void Field(const string& s){Bytes(s.data(),s.size());}
+  void Field(const char* s){Bytes(s,strlen(s));}
+  void Field(long v){Raw(int64_t(v));}
+  void Field(int v){Raw(int64_t(v));}
+  void Field(double v){Raw(v);}
+  void Field(const FractionalPrice& p){Raw(p.price);}
+  template<typename E>
+  void Field(E e){Raw(uint8_t(e));}
+  //records are not delimited, the field list of the type says where each ends
+  void End(){}
+};
+
+//reads binary records back in the order they were written: walked through RecordFields like a
+//writer, each field decodes the next value and compares it with the field of the record given,
+//so a record read back from a buffer is checked against the one it was written from
+//reads past the end or values that differ mark the reader bad
+class BinaryRecordReader
+{
+private:
+  const char* p;
+  const char* end;
+  bool ok;
+  template<typename V>
+  V Raw(){
+    V v=V();
+    if(size_t(end-p)<sizeof(V)){ok=false; p=end; return v;}
+    memcpy(&v,p,sizeof(V));
+    p+=sizeof(V);
+    return v;
+  }
+  void Bytes(const char* s, size_t len){
+    uint32_t n=Raw<uint32_t>();
+    if(size_t(end-p)<n){ok=false; p=end; return;}
+    if(n!=len || memcmp(p,s,n)!=0) ok=false;
+    p+=n;
+  }
+  template<typename V>
+  void Expect(V v){
+    V read=Raw<V>();
+    if(memcmp(&read,&v,sizeof(V))!=0) ok=false;//bitwise, so doubles must round trip exactly
+  }
+public:
+  BinaryRecordReader(const char* data, size_t len):p(data),end(data+len),ok(true){}
+  void Field(const string& s){Bytes(s.data(),s.size());}
+  void Field(const char* s){Bytes(s,strlen(s));}
+  void Field(long v){Expect(int64_t(v));}
+  void Field(int v){Expect(int64_t(v));}
+  void Field(double v){Expect(v);}
+  void Field(const FractionalPrice& p){Expect(p.price);}
+  template<typename E>
+  void Field(E e){Expect(uint8_t(e));}
+  void End(){}
+  //whether every field read so far matched
+  bool IsGood() const{return ok;}
+  //whether every record written has been read
+  bool AtEnd() const{return p==end;}
+};
+
+//serialize one record with the writer W into buffer
+template<typename W, typename T>
+void WriteRecord(RecordBuffer& buffer, const T& data){
+  W w(buffer);
+  RecordFields<T>::Write(data,w);
+  w.End();
+}
+
+//serialize a record prefixed with its persist key
+template<typename W, typename T>
+void WriteRecord(RecordBuffer& buffer, const string& persistKey, const T& data){
+  W w(buffer);
+  w.Field(persistKey);
+  RecordFields<T>::Write(data,w);
+  w.End();
+}
+
+//read one binary record back and check it against data; false once any field so far differed
+template<typename T>
+bool ReadRecord(BinaryRecordReader& r, const T& data){
+  RecordFields<T>::Write(data,r);
+  r.End();
+  return r.IsGood();
+}
+
+//read back a binary record that was written with its persist key
+template<typename T>
+bool ReadRecord(BinaryRecordReader& r, const string& persistKey, const T& data){
+  r.Field(persistKey);
+  RecordFields<T>::Write(data,r);
+  r.End();
+  return r.IsGood();
+}
+
+template<>
+struct RecordFields<Position<Bond> >
+{
+  template<typename W>
+  static void Write(const Position<Bond>& data, W& w){
+    w.Field(data.GetProduct().GetProductId());
+    w.Field(data.GetAggregatePosition());
+    w.Field(data.GetPosition("TRSY1"));
+    w.Field(data.GetPosition("TRSY2"));
+    w.Field(data.GetPosition("TRSY3"));
+  }
+};
+
+template<>
+struct RecordFields<ExecutionOrder<Bond> >
+{
+  template<typename W>
+  static void Write(const ExecutionOrder<Bond>& data, W& w){
+    w.Field(data.GetOrderId());
+    w.Field(data.GetProduct().GetProductId());
+    w.Field(data.GetSide());
+    w.Field(data.GetOrderType());
+    w.Field(data.GetVisibleQuantity());
+    w.Field(data.GetHiddenQuantity());
+    w.Field(FractionalPrice(data.GetPrice()));
+  }
+};
+
+template<>
+struct RecordFields<PriceStream<Bond> >
+{
+  template<typename W>
+  static void Write(const PriceStream<Bond>& data, W& w){
+    w.Field(data.GetProduct().GetProductId());
+    w.Field(FractionalPrice(data.GetBidOrder().GetPrice()));
+    w.Field(data.GetBidOrder().GetVisibleQuantity());
+    w.Field(data.GetBidOrder().GetHiddenQuantity());
+    w.Field(FractionalPrice(data.GetOfferOrder().GetPrice()));
+    w.Field(data.GetOfferOrder().GetVisibleQuantity());
+    w.Field(data.GetOfferOrder().GetHiddenQuantity());
+  }
+};
+
+template<>
+struct RecordFields<Inquiry<Bond> >
+{
+  template<typename W>
+  static void Write(const Inquiry<Bond>& data, W& w){
+    w.Field(data.GetInquiryId());
+    w.Field(data.GetProduct().GetProductId());
+    w.Field(data.GetSide());
+    w.Field(data.GetQuantity());
+    w.Field(FractionalPrice(data.GetPrice()));
+    w.Field(data.GetState());
+  }
+};
+
+//one record per list, the legs follow the list fields in leg order
+template<>
+struct RecordFields<ListInquiry<Bond> >
+{
+  template<typename W>
+  static void Write(const ListInquiry<Bond>& data, W& w){
+    w.Field(data.GetListId());
+    w.Field(data.GetState());
+    w.Field(data.GetLegCount());
+    for(int i=0;i<data.GetLegCount();++i){
+      const ListInquiryLeg<Bond>& leg=data.GetLeg(i);
+      w.Field(leg.product.Get().GetProductId());
+      w.Field(leg.side);
+      w.Field(leg.quantity);
+      w.Field(FractionalPrice(leg.price));
+    }
+  }
+};
+
+#endif
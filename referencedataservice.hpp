@@ -0,0 +1,139 @@
+/*
+implement reference data service holding the bond universe and its as-of date attributes
+author: Gaoxian Song
+*/
+#ifndef ReferenceDataService_HPP
+#define ReferenceDataService_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include "soa.hpp"
+#include "listenerlist.hpp"
+#include "products.hpp"
+#include "producthandle.hpp"
+
+using namespace std;
+
+//reference data for bonds keyed on product identifier
+//sector, years to maturity and other date dependent attributes are computed once per
+//business date and read from the cached fields of each Bond on the hot path
+class BondReferenceDataService: public Service<string, Bond>
+{
+private:
+  deque<Bond> bonds;//the bond universe, addresses stay valid as bonds are added
+  vector<const Bond*> shared;//the version of each bond in ProductRegistry, by dense id
+  vector<int> idIndex;//dense id by inline product id, open addressing with -1 for an empty slot
+  //add bond d to the index, doubling it first if it would be over half full
+  void IndexBond(int d);
+  date asOfDate;//business date the attributes are computed for
+  ListenerList<Bond> bondRefListeners;
+public:
+  BondReferenceDataService(const map<string, Bond>& m_bond, const date& asOfDate_);
+
+  // Get data on our service given a key
+  virtual Bond& GetData(string key){return bonds[GetDenseId(key)];}
+
+  // The callback that a Connector should invoke for any new or updated data
+  virtual void OnMessage(Bond &data);
+
+  // Add a listener to the Service for callbacks on add, remove, and update events
+  // for data to the Service.
+  virtual void AddListener(ServiceListener<Bond> *listener){bondRefListeners.Add(listener);}
+  //remove a listener, a dispatch already under way may still call it
+  virtual void RemoveListener(ServiceListener<Bond> *listener){bondRefListeners.Remove(listener);}
+
+  // Get all listeners on the Service.
+  virtual const vector< ServiceListener<Bond>* >& GetListeners() const{return bondRefListeners.Snapshot();}
+
+  //move to a new business date, refresh every bond and notify listeners of the changes;
+  //a bond whose date attributes did not move, such as a matured one, keeps its shared version
+  void RollDate(const date& newAsOfDate);
+
+  //get the business date the attributes are computed for
+  const date& GetAsOfDate() const{return asOfDate;}
+
+  //get the dense id of a bond, -1 if unknown
+  //pass product.GetId() where a product is at hand, its hash is already computed
+  int GetDenseId(const InlineId& productId) const;
+  int GetDenseId(const string& productId) const{return GetDenseId(InlineId(productId));}
+
+  //get a bond by dense id, the shared instance messages are built from
+  const Bond& GetBond(int denseId) const{return *shared[denseId];}
+  //get the handle of a bond by dense id, to build messages without interning the bond
+  ProductHandle<Bond> GetHandle(int denseId) const{return ProductHandle<Bond>(shared[denseId]);}
+
+  //number of bonds in the universe
+  int Size() const{return bonds.size();}
+
+  //get a copy of the universe keyed on product id, as the connectors expect
+  map<string, Bond> GetBondMap() const;
+};
+
+BondReferenceDataService::BondReferenceDataService(const map<string, Bond>& m_bond, const date& asOfDate_):idIndex(64,-1),asOfDate(asOfDate_){
+  for(map<string, Bond>::const_iterator it=m_bond.begin();it!=m_bond.end();++it){
+    bonds.push_back(it->second);//the next dense id
+    bonds.back().SetAsOfDate(asOfDate);//compute attributes once for the business date
+    shared.push_back(ProductRegistry<Bond>::Update(bonds.back()));
+    IndexBond(bonds.size()-1);
+  }
+}
+
+int BondReferenceDataService::GetDenseId(const InlineId& productId) const{
+  size_t mask=idIndex.size()-1;
+  for(size_t i=productId.GetHash()&mask;;i=(i+1)&mask){
+    int d=idIndex[i];
+    if(d<0 || bonds[d].GetId()==productId) return d;
+  }
+}
+
+void BondReferenceDataService::IndexBond(int d){
+  if(size_t(2*(d+1))>idIndex.size()){
+    idIndex.assign(2*idIndex.size(),-1);
+    for(int k=0;k<d;++k) IndexBond(k);
+  }
+  size_t mask=idIndex.size()-1;
+  size_t i=bonds[d].GetId().GetHash()&mask;
+  while(idIndex[i]>=0) i=(i+1)&mask;
+  idIndex[i]=d;
+}
+
+void BondReferenceDataService::OnMessage(Bond &data){
+  int d=GetDenseId(data.GetId());
+  if(d<0){
+    //new bond
+    bonds.push_back(data);
+    bonds.back().SetAsOfDate(asOfDate);
+    shared.push_back(ProductRegistry<Bond>::Update(bonds.back()));
+    IndexBond(bonds.size()-1);
+    bondRefListeners.ProcessAdd(bonds.back());
+  }
+  else{
+    //amended static data
+    bonds[d]=data;
+    bonds[d].SetAsOfDate(asOfDate);
+    shared[d]=ProductRegistry<Bond>::Update(bonds[d]);//messages already built keep the old version
+    bondRefListeners.ProcessUpdate(bonds[d]);
+  }
+}
+
+void BondReferenceDataService::RollDate(const date& newAsOfDate){
+  if(newAsOfDate==asOfDate) return;//nothing to refresh
+  asOfDate=newAsOfDate;
+  for(size_t i=0;i<bonds.size();++i){
+    bonds[i].SetAsOfDate(asOfDate);//refresh cached attributes
+    if(bonds[i].SameDateAttributes(*shared[i])) continue;//nothing a message reads has moved
+    shared[i]=ProductRegistry<Bond>::Update(bonds[i]);
+    bondRefListeners.ProcessUpdate(bonds[i]);
+  }
+}
+
+map<string, Bond> BondReferenceDataService::GetBondMap() const{
+  map<string, Bond> m_bond;
+  for(size_t d=0;d<shared.size();++d)
+    m_bond.insert(make_pair(shared[d]->GetProductId(),*shared[d]));
+  return m_bond;
+}
+
+#endif
@@ -0,0 +1,260 @@
+/*
+implement rfq quoting from the live top of book, skewed by size and position
+author: Gaoxian Song
+*/
+#ifndef RfqPricer_HPP
+#define RfqPricer_HPP
+
+#include <vector>
+#include <atomic>
+#include <cmath>
+#include "referencedataservice.hpp"
+#include "marketdataservice.hpp"
+#include "pricingservice.hpp"
+#include "positionservice.hpp"
+#include "inquiryservice.hpp"
+#include "curveservice.hpp"
+#include "seqlock.hpp"
+#include "snapshot.hpp"
+
+using namespace std;
+
+//smallest price increment of a quote, 1/256 of a point
+const double RFQ_TICK=1.0/256.0;
+
+//best bid and offer of a bond as the pricer last saw them
+struct TopOfBook
+{
+  double bid;
+  double offer;
+  long bidQuantity;//0 when the price came from the pricing service rather than a book
+  long offerQuantity;
+  bool valid;
+};
+
+//how far a quote is moved off the top of book, in points per 100 face
+class RfqSkewParams
+{
+public:
+  double sizeSkew;//per million of quantity beyond what the top of book shows
+  double positionSkew;//per million of current position, towards reducing it
+  double maxSkew;//cap on the total skew
+  double curveHalfSpread;//distance of bid and offer from the fair price when quoting off the curve
+  RfqSkewParams(double sizeSkew_=1.0/128, double positionSkew_=1.0/256, double maxSkew_=0.5, double curveHalfSpread_=1.0/64):
+    sizeSkew(sizeSkew_),positionSkew(positionSkew_),maxSkew(maxSkew_),curveHalfSpread(curveHalfSpread_){}
+};
+
+/**
+ * Quotes inquiries from the latest top of book of each bond, falling back to the pricing
+ * service's bid and offer for bonds without a book or whose book is crossed, and to the fitted
+ * curve's fair price for bonds with neither. A client buy is quoted at our offer and a
+ * client sell at our bid, moved away from the client for size beyond the displayed quantity and
+ * towards flattening our position, then rounded to the nearest tick.
+ * Market data and positions are written by the feed thread; tops are published through a
+ * sequence lock and positions through atomics, so Quote can run on any thread without locks.
+ * Tops, composite prices and positions are checkpointed, so a warm start quotes straight away.
+ */
+class BondRfqPricer: public InquiryPricer<Bond>, public Snapshottable
+{
+private:
+  const BondReferenceDataService& refData;
+  RfqSkewParams params;
+  vector<SeqLocked<TopOfBook> > tops;//by dense id
+  vector<atomic<long> > positions;//aggregate position by dense id
+  vector<TopOfBook> composite;//last bid and offer from the pricing service, only touched by the writer
+  const BondCurveService* curve;//fair prices for bonds without a book or price, null for none
+  //top of book of bond d, taken off the curve if the bond has no price yet; false if there is none
+  bool Touch(int d, TopOfBook& top) const;
+public:
+  BondRfqPricer(const BondReferenceDataService& refData_, const RfqSkewParams& params_=RfqSkewParams());
+  //take the aggregated book of a bond
+  void OnBook(const OrderBook<Bond>& book);
+  //take a price of a bond, used until the bond has a book
+  void OnPrice(const Price<Bond>& price);
+  //take the full position of a bond
+  void OnPosition(const Position<Bond>& position);
+  //quote bonds with no book or price around the fair price of a fitted curve
+  void SetCurve(const BondCurveService* curve_){curve=curve_;}
+  //quote for an inquiry, 0 if the bond has no price yet and there is no curve
+  virtual double Quote(const Inquiry<Bond>& inquiry);
+  //quote every leg of a list in one pass, 0 for a leg whose bond has no price yet and there is no curve
+  virtual void QuoteList(const ListInquiry<Bond>& list, vector<double>& prices);
+  //checkpoint the tops, composite prices and positions, keyed on product id
+  virtual string GetSnapshotName() const{return "rfqpricer";}
+  virtual void SaveSnapshot(SnapshotWriter& w) const;
+  virtual void LoadSnapshot(SnapshotReader& r);
+};
+
+//feed books into the rfq pricer
+class BondMarketDataRfqListener: public ServiceListener<OrderBook<Bond> >
+{
+private:
+  BondRfqPricer& pricer;
+public:
+  BondMarketDataRfqListener(BondRfqPricer& src):pricer(src){}
+  // Listener callback to process an add event to the Service
+  virtual void ProcessAdd(OrderBook<Bond> &data){pricer.OnBook(data);}
+
+  // Listener callback to process a remove event to the Service
+  virtual void ProcessRemove(OrderBook<Bond> &data){}
+
+  // Listener callback to process an update event to the Service
+  virtual void ProcessUpdate(OrderBook<Bond> &data){pricer.OnBook(data);}
+};
+
+//feed prices into the rfq pricer
+class BondPriceRfqListener: public ServiceListener<Price<Bond> >
+{
+private:
+  BondRfqPricer& pricer;
+public:
+  BondPriceRfqListener(BondRfqPricer& src):pricer(src){}
+  // Listener callback to process an add event to the Service
+  virtual void ProcessAdd(Price<Bond> &data){pricer.OnPrice(data);}
+
+  // Listener callback to process a remove event to the Service
+  virtual void ProcessRemove(Price<Bond> &data){}
+
+  // Listener callback to process an update event to the Service
+  virtual void ProcessUpdate(Price<Bond> &data){pricer.OnPrice(data);}
+};
+
+//feed positions into the rfq pricer
+class BondPositionRfqListener: public ServiceListener<Position<Bond> >
+{
+private:
+  BondRfqPricer& pricer;
+public:
+  BondPositionRfqListener(BondRfqPricer& src):pricer(src){}
+  // Listener callback to process an add event to the Service
+  virtual void ProcessAdd(Position<Bond> &data){pricer.OnPosition(data);}
+
+  // Listener callback to process a remove event to the Service
+  virtual void ProcessRemove(Position<Bond> &data){}
+
+  // Listener callback to process an update event to the Service
+  virtual void ProcessUpdate(Position<Bond> &data){pricer.OnPosition(data);}
+};
+
+BondRfqPricer::BondRfqPricer(const BondReferenceDataService& refData_, const RfqSkewParams& params_):
+  refData(refData_),params(params_),tops(refData_.Size()),positions(refData_.Size()),composite(refData_.Size(),TopOfBook()),curve(nullptr)
+{
+  for(size_t d=0;d<positions.size();++d) positions[d].store(0,memory_order_relaxed);
+}
+
+void BondRfqPricer::OnBook(const OrderBook<Bond>& book){
+  int d=refData.GetDenseId(book.GetProduct().GetId());
+  const vector<Order>& bids=book.GetBidStack();
+  const vector<Order>& offers=book.GetOfferStack();
+  if(d<0 || bids.empty() || offers.empty()) return;
+  TopOfBook top;
+  top.bid=bids[0].GetPrice(); top.bidQuantity=bids[0].GetQuantity();
+  top.offer=offers[0].GetPrice(); top.offerQuantity=offers[0].GetQuantity();
+  for(size_t i=1;i<bids.size();++i)
+    if(bids[i].GetPrice()>top.bid){top.bid=bids[i].GetPrice(); top.bidQuantity=bids[i].GetQuantity();}
+  for(size_t i=1;i<offers.size();++i)
+    if(offers[i].GetPrice()<top.offer){top.offer=offers[i].GetPrice(); top.offerQuantity=offers[i].GetQuantity();}
+  top.valid=true;
+  //a crossed book cannot be dealt on, quote from the composite price instead
+  tops[d].Store(top.bid<top.offer?top:composite[d]);
+}
+
+void BondRfqPricer::OnPrice(const Price<Bond>& price){
+  int d=refData.GetDenseId(price.GetProduct().GetId());
+  if(d<0) return;
+  TopOfBook& top=composite[d];
+  top.bid=price.GetMid()-0.5*price.GetBidOfferSpread();
+  top.offer=price.GetMid()+0.5*price.GetBidOfferSpread();
+  top.bidQuantity=0; top.offerQuantity=0;
+  top.valid=true;
+  if(tops[d].Load().bidQuantity==0) tops[d].Store(top);//a book is better than a composite price
+}
+
+void BondRfqPricer::OnPosition(const Position<Bond>& position){
+  int d=refData.GetDenseId(position.GetProduct().GetId());
+  if(d>=0) positions[d].store(position.GetAggregatePosition(),memory_order_relaxed);
+}
+
+bool BondRfqPricer::Touch(int d, TopOfBook& top) const{
+  top=tops[d].Load();
+  if(top.valid) return true;
+  if(!curve || d>=curve->Size()) return false;
+  double fair=curve->GetFairPrice(d);
+  if(!(fair>0)) return false;//matured, or the fit has broken down
+  top.bid=fair-params.curveHalfSpread;
+  top.offer=fair+params.curveHalfSpread;
+  top.bidQuantity=0; top.offerQuantity=0;
+  top.valid=true;
+  return true;
+}
+
+double BondRfqPricer::Quote(const Inquiry<Bond>& inquiry){
+  int d=refData.GetDenseId(inquiry.GetProduct().GetId());
+  if(d<0) return 0;
+  TopOfBook top;
+  if(!Touch(d,top)) return 0;
+  bool clientBuys=inquiry.GetSide()==BUY;
+  long q=inquiry.GetQuantity();
+  long shown=clientBuys?top.offerQuantity:top.bidQuantity;
+  //size beyond the top of book costs the client, a position we want to shed helps them
+  double sizeSkew=shown>0?params.sizeSkew*max(0L,q-shown)/1e6:0.0;
+  double positionSkew=-params.positionSkew*positions[d].load(memory_order_relaxed)/1e6;
+  double skew=(clientBuys?sizeSkew:-sizeSkew)+positionSkew;
+  skew=max(-params.maxSkew,min(params.maxSkew,skew));
+  double price=(clientBuys?top.offer:top.bid)+skew;
+  return floor(price/RFQ_TICK+0.5)*RFQ_TICK;
+}
+
+void BondRfqPricer::SaveSnapshot(SnapshotWriter& w) const{
+  w.Put(uint32_t(tops.size()));
+  for(size_t d=0;d<tops.size();++d){
+    w.PutString(refData.GetBond(d).GetProductId());
+    w.Put(tops[d].Load());
+    w.Put(composite[d]);
+    w.Put(positions[d].load(memory_order_relaxed));
+  }
+}
+
+void BondRfqPricer::LoadSnapshot(SnapshotReader& r){
+  uint32_t n=r.Get<uint32_t>();
+  for(uint32_t i=0;i<n && r.IsGood();++i){
+    string id=r.GetString();
+    TopOfBook top=r.Get<TopOfBook>();
+    TopOfBook comp=r.Get<TopOfBook>();
+    long position=r.Get<long>();
+    int d=refData.GetDenseId(id);
+    if(d<0) continue;//no longer in reference data
+    tops[d].Store(top);
+    composite[d]=comp;
+    positions[d].store(position,memory_order_relaxed);
+  }
+}
+
+void BondRfqPricer::QuoteList(const ListInquiry<Bond>& list, vector<double>& prices){
+  int n=list.GetLegCount();
+  prices.assign(n,0);
+  //gather the side of the book each leg deals on and the position of its bond into flat arrays,
+  //one snapshot of each top, then price all legs in a single branch-free loop
+  vector<double> touch(n,0), sign(n,0), excess(n,0), position(n,0), valid(n,0);
+  for(int i=0;i<n;++i){
+    const ListInquiryLeg<Bond>& leg=list.GetLeg(i);
+    int d=refData.GetDenseId(leg.product.Get().GetId());
+    if(d<0) continue;
+    TopOfBook top;
+    if(!Touch(d,top)) continue;
+    bool clientBuys=leg.side==BUY;
+    long shown=clientBuys?top.offerQuantity:top.bidQuantity;
+    touch[i]=clientBuys?top.offer:top.bid;
+    sign[i]=clientBuys?1:-1;
+    excess[i]=shown>0?double(max(0L,leg.quantity-shown)):0.0;
+    position[i]=double(positions[d].load(memory_order_relaxed));
+    valid[i]=1;
+  }
+  for(int i=0;i<n;++i){
+    double skew=sign[i]*params.sizeSkew*excess[i]/1e6-params.positionSkew*position[i]/1e6;
+    skew=max(-params.maxSkew,min(params.maxSkew,skew));
+    prices[i]=valid[i]*floor((touch[i]+skew)/RFQ_TICK+0.5)*RFQ_TICK;
+  }
+}
+
+#endif
@@ -8,8 +8,12 @@
 #define RISK_SERVICE_HPP
 
 #include "soa.hpp"
+#include "listenerlist.hpp"
 #include "positionservice.hpp"
+#include "referencedataservice.hpp"
 #include <tuple>
+#include <algorithm>
+#include <stdint.h>
 
 /**
  * PV01 risk.
@@ -21,10 +25,13 @@ class PV01
 
 public:
   // ctor for a PV01 value
-  PV01(const T &_product, double _pv01, long _quantity);
+  PV01(const ProductHandle<T> &_product, double _pv01, long _quantity);
 
   // Get the product on this PV01 value
-  const T& GetProduct() const{return product;}
+  const T& GetProduct() const{return product.Get();}
+
+  // Get the shared handle of the product, to build further messages without interning it again
+  const ProductHandle<T>& GetProductHandle() const{return product;}
 
   // Get the PV01 value
   double GetPV01() const{return pv01;}
@@ -38,7 +45,7 @@ public:
   void AddQuantity(long q){quantity+=q;}
 
 private:
-  T product;
+  ProductHandle<T> product;
   double pv01;
   long quantity;
 
@@ -47,6 +54,7 @@ private:
 /**
  * A bucket sector to bucket a group of securities.
  * We can then aggregate bucketed risk to this bucket.
+ * Membership is a bitset over the dense product ids of reference data.
  * Type T is the product type.
  */
 template<typename T>
@@ -56,20 +64,37 @@ class BucketedSector
 public:
   BucketedSector():name("sector"){}//constructor
   // ctor for a bucket sector
-  BucketedSector(const vector<T> &_products, string _name);
+  BucketedSector(const vector<uint64_t> &_members, string _name);
+
+  // Get the membership bitset of this bucket
+  const vector<uint64_t>& GetMembers() const;
+
+  // Is the product with this dense id in the bucket?
+  bool Contains(int denseId) const;
 
-  // Get the products associated with this bucket
-  const vector<T>& GetProducts() const;
+  // Add the product with this dense id to the bucket or take it out
+  void Set(int denseId, bool member);
 
   // Get the name of the bucket
   const string& GetName() const;
 
 private:
-  vector<T> products;
+  vector<uint64_t> members;
   string name;
 
 };
 
+//a bucket is not a registered product, the PV01 of a bucket keeps its own copy
+template<typename T>
+class ProductHandle<BucketedSector<T> >
+{
+private:
+  BucketedSector<T> product;
+public:
+  ProductHandle(const BucketedSector<T>& _product):product(_product){}
+  const BucketedSector<T>& Get() const{return product;}
+};
+
 /**
  * Risk Service to vend out risk for a particular security and across a risk bucketed sector.
  * Keyed on product identifier.
@@ -90,47 +115,186 @@ public:
 
 };
 using SectorsRisk=tuple<PV01<BucketedSector<Bond> >, PV01<BucketedSector<Bond> >, PV01<BucketedSector<Bond> > >;
+
+//kinds of rule a bucket can be defined by
+enum BucketRule { MATURITY_RANGE, TICKER, BOOK, PRODUCT_LIST };
+
+//a bucket as defined by the risk managers
+class BucketDefinition
+{
+public:
+  string name;
+  BucketRule rule;
+  int minYears, maxYears;//MATURITY_RANGE: whole years to maturity in [minYears, maxYears), maxYears<0 for no bound
+  string key;//TICKER: the ticker, BOOK: the book
+  vector<string> productIds;//PRODUCT_LIST: the bonds in the bucket
+  BucketDefinition(const string& name_, BucketRule rule_):name(name_),rule(rule_),minYears(0),maxYears(-1){}
+};
+
+//number of buckets every registry starts with: FrontEnd, Belly and LongEnd
+const int STANDARD_SECTORS=3;
+
+/**
+ * Registry of bucketed sectors defined at startup.
+ * Membership is compiled into one bitset per bucket over the dense product ids of reference data,
+ * and into one bitset per product over the buckets, so the buckets a product feeds are a few words.
+ * Book buckets hold the bonds that have had a position in that book.
+ */
+class BucketedSectorRegistry
+{
+private:
+  BondReferenceDataService& refData;
+  vector<BucketDefinition> definitions;
+  vector<BucketedSector<Bond> > buckets;//compiled membership of each bucket
+  vector<uint64_t> productMasks;//for each product, maskWords words with a bit per bucket
+  int maskWords;//words per product mask
+  int productCount;//products covered by the compiled masks
+  int version;//number of compiles so far, moves whenever the masks are rebuilt
+  vector<int> bookBuckets;//indices of the BOOK buckets
+  //does the bond belong to the bucket by its static rule?
+  bool Matches(const BucketDefinition& def, const Bond& bnd) const;
+  //set or clear the membership of product denseId in bucket b
+  void SetMember(int b, int denseId, bool member);
+  int Define(const BucketDefinition& def);
+public:
+  //construct with the three standard sectors already defined
+  BucketedSectorRegistry(BondReferenceDataService& refData_);
+
+  //define a bucket of bonds with whole years to maturity in [minYears, maxYears), maxYears<0 for no bound
+  int DefineMaturityBucket(const string& name, int minYears, int maxYears);
+  //define a bucket of the bonds with this ticker
+  int DefineTickerBucket(const string& name, const string& ticker);
+  //define a bucket of the bonds that have had a position in this book
+  int DefineBookBucket(const string& name, const string& book);
+  //define a bucket from an explicit list of bonds
+  int DefineListBucket(const string& name, const vector<string>& productIds);
+
+  //compile membership for every bond in reference data, if a bucket or a bond was added since the last compile
+  void Compile();
+  //changes whenever Compile rebuilds the masks, so totals kept over them know to be rebuilt too
+  int GetVersion() const{return version;}
+  //re-evaluate the static rules for one bond, e.g. after a date roll; returns whether membership changed
+  bool RefreshProduct(int denseId);
+  //record that a bond has a position in the book of BOOK bucket b; returns whether it just joined
+  bool AddBookMember(int b, int denseId);
+
+  int GetBucketCount() const{return buckets.size();}
+  const BucketedSector<Bond>& GetBucket(int b) const{return buckets[b];}
+  const BucketDefinition& GetDefinition(int b) const{return definitions[b];}
+  //index of the bucket with this name, -1 if none
+  int FindBucket(const string& name) const;
+  //bucket bitset of a product, GetMaskWords() words long
+  const uint64_t* GetProductMask(int denseId) const{return &productMasks[denseId*maskWords];}
+  int GetMaskWords() const{return maskWords;}
+  const vector<int>& GetBookBuckets() const{return bookBuckets;}
+};
+
+//risk cache entry: the pv01 of a bond and its dense id in reference data
+class BondRiskEntry
+{
+public:
+  PV01<Bond> pv01;
+  int denseId;
+  BondRiskEntry(const PV01<Bond>& pv01_, int denseId_):pv01(pv01_),denseId(denseId_){}
+};
+
 //implement risk service for bond
-class BondRiskService: public RiskService<Bond>
+class BondRiskService: public RiskService<Bond>, public Snapshottable
 {
 private:
-  map<string, PV01<Bond> > bondRiskCache; //keep a local record for pv01
-  vector<ServiceListener<PV01<Bond> >* > bondRiskListeners;
-  vector<ServiceListener<SectorsRisk>* > bondSectorRiskListeners;
+  BondReferenceDataService& refData;
+  BucketedSectorRegistry& registry;
+  map<string, BondRiskEntry> bondRiskCache; //keep a local record for pv01
+  vector<BondRiskEntry*> entriesByDenseId;//the cache entries indexed by dense id, null if not risked
+  ListenerList<PV01<Bond> > bondRiskListeners;
+  ListenerList<SectorsRisk> bondSectorRiskListeners;
   map<string, double> bondPV01;//map each bond to one pv01 value
+  //running totals per bucket, kept up to date as quantities and pv01s change
+  vector<double> bucketRisk;//sum of |q|*pv01 over the bonds of each bucket
+  vector<long> bucketQuantity;//sum of |q| over the bonds of each bucket
+  SectorsRisk sectorsRisk;//last published risk of the standard sectors
+  //add a bond to the cache and to the buckets it belongs to
+  map<string, BondRiskEntry>::iterator AddToCache(const PV01<Bond>& pv01, int denseId);
+  //move the contribution of a bond from (oldq, oldpv01) to (newq, newpv01) in every bucket it belongs to
+  void UpdateBucketTotals(int denseId, long oldq, double oldpv01, long newq, double newpv01);
+  //add bonds to the book buckets of the books they have a position in
+  void UpdateBookBuckets(int denseId, const Position<Bond>& position);
+  //take the membership of the standard sectors from the registry
+  void SyncSectors();
+  //refresh sectorsRisk from the running totals and notify listeners
+  void PublishSectorsRisk();
+  //store a new pv01 and move the running totals, returns the risked entry or null if the bond has no position
+  BondRiskEntry* ApplyPV01(const string& bondid, double newpv01);
+  int bucketsVersion;//registry version the running totals were built over
+  //rebuild the running totals of every bucket from the cache, after the registry recompiled
+  void RecomputeBucketTotals();
+  //compile buckets defined since the last compile, rebuilding the totals if the masks changed
+  void CompileBuckets();
 public:
-  //bondPV01_ must contain all 6 bonds pv01 info
-  BondRiskService(map<string,double>& bondPV01_, map<string,Bond> m_bond):bondPV01(bondPV01_){
-    for(map<string, Bond>::iterator it=m_bond.begin();it!=m_bond.end();++it){
-      Bond bnd=it->second;//get second
-      string bondid=it->first;//get first
-      double pv=bondPV01.find(bondid)->second;//get pv
-      PV01<Bond> thepv01(bnd,pv,0);//construct one
-      bondRiskCache.insert(make_pair(bondid,thepv01));
-    }
-  }
+  //bondPV01_ must contain the pv01 of every bond in reference data
+  BondRiskService(map<string,double>& bondPV01_, BondReferenceDataService& refData_, BucketedSectorRegistry& registry_);
   void UpdateBondPV01(string bondid, double newpv01);
+  //apply many pv01 changes at once, e.g. an end of day refresh of the whole universe
+  //pv01 listeners see each changed bond, sector listeners get a single update for the batch
+  void UpdateBondPV01(const map<string, double>& newPV01s);
 
    // Get data on our service given a key
-  virtual PV01<Bond>& GetData(string key){return bondRiskCache.find(key)->second;}
+  virtual PV01<Bond>& GetData(string key){return bondRiskCache.find(key)->second.pv01;}
 
   // The callback that a Connector should invoke for any new or updated data
   virtual void OnMessage(PV01<Bond> &data){}//do nothing as no need for connector
 
   // Add a listener to the Service for callbacks on add, remove, and update events
   // for data to the Service.
-  virtual void AddListener(ServiceListener<PV01<Bond> > *listener){bondRiskListeners.push_back(listener);}
+  virtual void AddListener(ServiceListener<PV01<Bond> > *listener){bondRiskListeners.Add(listener);}
+  //remove a listener, a dispatch already under way may still call it
+  virtual void RemoveListener(ServiceListener<PV01<Bond> > *listener){bondRiskListeners.Remove(listener);}
   virtual void AddListener(ServiceListener<SectorsRisk>* listener){
-    bondSectorRiskListeners.push_back(listener);
+    bondSectorRiskListeners.Add(listener);
   }
+  virtual void RemoveListener(ServiceListener<SectorsRisk>* listener){bondSectorRiskListeners.Remove(listener);}
 
   // Get all listeners on the Service.
-  virtual const vector< ServiceListener<PV01<Bond> >* >& GetListeners() const{return bondRiskListeners;}
+  virtual const vector< ServiceListener<PV01<Bond> >* >& GetListeners() const{return bondRiskListeners.Snapshot();}
   // Add a position that the service will risk
   virtual void AddPosition(Position<Bond> &position);
 
   // Get the bucketed risk for the bucket sector
   virtual const PV01<BucketedSector<Bond> > GetBucketedRisk(const BucketedSector<Bond> &sector) const;
+
+  //get the current risk of bucket b of the registry from the running totals
+  const PV01<BucketedSector<Bond> > GetBucketRisk(int b) const;
+
+  //get every risked bond keyed on product id
+  const map<string, BondRiskEntry>& GetRiskEntries() const{return bondRiskCache;}
+
+  //get the current risk of the three sectors
+  const SectorsRisk& GetSectorsRisk() const{return sectorsRisk;}
+
+  //take the refreshed attributes of a bond after a date roll, moving it to its new buckets
+  void RefreshBond(const Bond& bnd);
+
+  //checkpoint pv01s, risked quantities and book bucket membership
+  virtual string GetSnapshotName() const{return "risk";}
+  virtual void SaveSnapshot(SnapshotWriter& w) const;
+  virtual void LoadSnapshot(SnapshotReader& r);
+};
+
+//listen to reference data and refresh the bonds held by the risk service
+class BondRefDataRiskListener: public ServiceListener<Bond>
+{
+private:
+  BondRiskService& bnd_risk_service;
+public:
+  BondRefDataRiskListener(BondRiskService& bnd_risk): bnd_risk_service(bnd_risk){}
+  // Listener callback to process an add event to the Service
+  virtual void ProcessAdd(Bond &data){}
+
+  // Listener callback to process a remove event to the Service
+  virtual void ProcessRemove(Bond &data){}
+
+  // Listener callback to process an update event to the Service
+  virtual void ProcessUpdate(Bond &data){bnd_risk_service.RefreshBond(data);}
 };
 
 class BondPositionServiceListener: public ServiceListener<Position<Bond> >
@@ -148,14 +312,16 @@ public:
   virtual void ProcessRemove(Position<Bond> &data){}
 
   // Listener callback to process an update event to the Service
-  virtual void ProcessUpdate(Position<Bond> &data){}
+  virtual void ProcessUpdate(Position<Bond> &data){
+    bnd_risk_service.AddPosition(data);
+  }
 
 };
 
 
 
 template<typename T>
-PV01<T>::PV01(const T &_product, double _pv01, long _quantity) :
+PV01<T>::PV01(const ProductHandle<T> &_product, double _pv01, long _quantity) :
   product(_product)
 {
   pv01 = _pv01;
@@ -163,16 +329,33 @@ PV01<T>::PV01(const T &_product, double _pv01, long _quantity) :
 }
 
 template<typename T>
-BucketedSector<T>::BucketedSector(const vector<T>& _products, string _name) :
-  products(_products)
+BucketedSector<T>::BucketedSector(const vector<uint64_t>& _members, string _name) :
+  members(_members)
 {
   name = _name;
 }
 
 template<typename T>
-const vector<T>& BucketedSector<T>::GetProducts() const
+const vector<uint64_t>& BucketedSector<T>::GetMembers() const
 {
-  return products;
+  return members;
+}
+
+template<typename T>
+bool BucketedSector<T>::Contains(int denseId) const
+{
+  size_t word=denseId/64;
+  return word<members.size() && (members[word]>>(denseId%64)&1);
+}
+
+template<typename T>
+void BucketedSector<T>::Set(int denseId, bool member)
+{
+  size_t word=denseId/64;
+  if(word>=members.size()) members.resize(word+1,0);
+  uint64_t bit=uint64_t(1)<<(denseId%64);
+  if(member) members[word]|=bit;
+  else members[word]&=~bit;
 }
 
 template<typename T>
@@ -181,64 +364,326 @@ const string& BucketedSector<T>::GetName() const
   return name;
 }
 
+BucketedSectorRegistry::BucketedSectorRegistry(BondReferenceDataService& refData_):refData(refData_),maskWords(0),productCount(0),version(0){
+  //the standard sectors, same boundaries as Bond::GetSectorType
+  DefineMaturityBucket("FrontEnd",0,4);
+  DefineMaturityBucket("Belly",4,12);
+  DefineMaturityBucket("LongEnd",12,-1);
+}
+
+int BucketedSectorRegistry::Define(const BucketDefinition& def){
+  definitions.push_back(def);
+  if(def.rule==BOOK) bookBuckets.push_back(definitions.size()-1);
+  productCount=0;//force a recompile
+  return definitions.size()-1;
+}
+
+int BucketedSectorRegistry::DefineMaturityBucket(const string& name, int minYears, int maxYears){
+  BucketDefinition def(name,MATURITY_RANGE);
+  def.minYears=minYears; def.maxYears=maxYears;
+  return Define(def);
+}
+
+int BucketedSectorRegistry::DefineTickerBucket(const string& name, const string& ticker){
+  BucketDefinition def(name,TICKER);
+  def.key=ticker;
+  return Define(def);
+}
+
+int BucketedSectorRegistry::DefineBookBucket(const string& name, const string& book){
+  BucketDefinition def(name,BOOK);
+  def.key=book;
+  return Define(def);
+}
+
+int BucketedSectorRegistry::DefineListBucket(const string& name, const vector<string>& productIds){
+  BucketDefinition def(name,PRODUCT_LIST);
+  def.productIds=productIds;
+  return Define(def);
+}
+
+bool BucketedSectorRegistry::Matches(const BucketDefinition& def, const Bond& bnd) const{
+  switch(def.rule){
+    case MATURITY_RANGE:{
+      int years=bnd.GetYearsToMaturity();
+      return years>=def.minYears && (def.maxYears<0 || years<def.maxYears);
+    }
+    case TICKER: return bnd.GetTicker()==def.key;
+    case PRODUCT_LIST: return find(def.productIds.begin(),def.productIds.end(),bnd.GetProductId())!=def.productIds.end();
+    case BOOK: return false;//joined as positions arrive
+  }
+  return false;
+}
+
+void BucketedSectorRegistry::SetMember(int b, int denseId, bool member){
+  uint64_t bucketBit=uint64_t(1)<<(b%64);
+  uint64_t& productMask=productMasks[denseId*maskWords+b/64];
+  if(member) productMask|=bucketBit;
+  else productMask&=~bucketBit;
+  buckets[b].Set(denseId,member);
+}
+
+void BucketedSectorRegistry::Compile(){
+  if(productCount==refData.Size() && buckets.size()==definitions.size()) return;//already compiled
+  ++version;
+  //keep book memberships gathered so far
+  vector<BucketedSector<Bond> > old=buckets;
+  productCount=refData.Size();
+  maskWords=(definitions.size()+63)/64;
+  int productWords=(productCount+63)/64;
+  productMasks.assign(productCount*maskWords,0);
+  buckets.clear();
+  for(size_t b=0;b<definitions.size();++b)
+    buckets.push_back(BucketedSector<Bond>(vector<uint64_t>(productWords,0),definitions[b].name));
+  for(int d=0;d<productCount;++d){
+    const Bond& bnd=refData.GetBond(d);
+    for(size_t b=0;b<definitions.size();++b){
+      bool member=definitions[b].rule==BOOK?(b<old.size() && old[b].Contains(d)):Matches(definitions[b],bnd);
+      if(member) SetMember(b,d,true);
+    }
+  }
+}
+
+bool BucketedSectorRegistry::RefreshProduct(int denseId){
+  if(denseId>=productCount){Compile(); return true;}//a new bond, compile it in
+  bool changed=false;
+  const Bond& bnd=refData.GetBond(denseId);
+  for(size_t b=0;b<definitions.size();++b){
+    if(definitions[b].rule==BOOK) continue;
+    bool member=Matches(definitions[b],bnd);
+    if(member!=buckets[b].Contains(denseId)){SetMember(b,denseId,member); changed=true;}
+  }
+  return changed;
+}
+
+bool BucketedSectorRegistry::AddBookMember(int b, int denseId){
+  if(buckets[b].Contains(denseId)) return false;
+  SetMember(b,denseId,true);
+  return true;
+}
+
+int BucketedSectorRegistry::FindBucket(const string& name) const{
+  for(size_t b=0;b<definitions.size();++b)
+    if(definitions[b].name==name) return b;
+  return -1;
+}
+
+BondRiskService::BondRiskService(map<string,double>& bondPV01_, BondReferenceDataService& refData_, BucketedSectorRegistry& registry_):
+  refData(refData_),registry(registry_),bondPV01(bondPV01_),
+  sectorsRisk(PV01<BucketedSector<Bond> >(BucketedSector<Bond>(),0,0),PV01<BucketedSector<Bond> >(BucketedSector<Bond>(),0,0),PV01<BucketedSector<Bond> >(BucketedSector<Bond>(),0,0))
+{
+  registry.Compile();
+  bucketsVersion=registry.GetVersion();
+  bucketRisk.assign(registry.GetBucketCount(),0);
+  bucketQuantity.assign(registry.GetBucketCount(),0);
+  for(int d=0;d<refData.Size();++d){
+    const Bond& bnd=refData.GetBond(d);
+    double pv=bondPV01.find(bnd.GetProductId())->second;//get pv
+    AddToCache(PV01<Bond>(refData.GetHandle(d),pv,0),d);//construct one
+  }
+  SyncSectors();
+}
+
+map<string, BondRiskEntry>::iterator BondRiskService::AddToCache(const PV01<Bond>& pv01, int denseId){
+  string bondid=pv01.GetProduct().GetProductId();//get bond id
+  map<string, BondRiskEntry>::iterator it=bondRiskCache.insert(make_pair(bondid,BondRiskEntry(pv01,denseId))).first;
+  if(entriesByDenseId.size()<=size_t(denseId)) entriesByDenseId.resize(denseId+1,nullptr);
+  entriesByDenseId[denseId]=&it->second;
+  UpdateBucketTotals(denseId,0,0,pv01.GetQuantity(),pv01.GetPV01());//add its contribution
+  return it;
+}
+
+void BondRiskService::UpdateBucketTotals(int denseId, long oldq, double oldpv01, long newq, double newpv01){
+  oldq=abs(oldq); newq=abs(newq);//always set q to be positive in calculation of pv01
+  double risk=double(newq)*newpv01-double(oldq)*oldpv01;
+  long qty=newq-oldq;
+  const uint64_t* mask=registry.GetProductMask(denseId);
+  for(int w=0;w<registry.GetMaskWords();++w){
+    //visit the buckets of the product one set bit at a time
+    for(uint64_t bits=mask[w];bits!=0;bits&=bits-1){
+      int b=w*64+__builtin_ctzll(bits);
+      bucketRisk[b]+=risk;
+      bucketQuantity[b]+=qty;
+    }
+  }
+}
+
+void BondRiskService::UpdateBookBuckets(int denseId, const Position<Bond>& position){
+  const vector<int>& books=registry.GetBookBuckets();
+  for(size_t i=0;i<books.size();++i){
+    int b=books[i];
+    if(position.GetPosition(registry.GetDefinition(b).key)==0) continue;
+    if(registry.AddBookMember(b,denseId)){
+      //the bond just joined the bucket, bring its whole contribution
+      const PV01<Bond>& entry=entriesByDenseId[denseId]->pv01;
+      long q=abs(entry.GetQuantity());
+      bucketRisk[b]+=double(q)*entry.GetPV01();
+      bucketQuantity[b]+=q;
+    }
+  }
+}
+
+void BondRiskService::SyncSectors(){
+  get<0>(sectorsRisk)=GetBucketRisk(FrontEnd);
+  get<1>(sectorsRisk)=GetBucketRisk(Belly);
+  get<2>(sectorsRisk)=GetBucketRisk(LongEnd);
+}
+
+const PV01<BucketedSector<Bond> > BondRiskService::GetBucketRisk(int b) const{
+  //pv01 of a bucket is the quantity weighted pv01 of its bonds
+  double pv01=bucketQuantity[b]>0?bucketRisk[b]/double(bucketQuantity[b]):0;
+  return PV01<BucketedSector<Bond> >(registry.GetBucket(b),pv01,bucketQuantity[b]);
+}
+
+void BondRiskService::PublishSectorsRisk(){
+  PV01<BucketedSector<Bond> >* sectors[STANDARD_SECTORS]={&get<0>(sectorsRisk),&get<1>(sectorsRisk),&get<2>(sectorsRisk)};
+  for(int i=0;i<STANDARD_SECTORS;++i){
+    sectors[i]->SetPV01(bucketQuantity[i]>0?bucketRisk[i]/double(bucketQuantity[i]):0);
+    sectors[i]->AddQuantity(bucketQuantity[i]-sectors[i]->GetQuantity());
+  }
+  //update through listeners
+  bondSectorRiskListeners.ProcessUpdate(sectorsRisk);
+}
+
+BondRiskEntry* BondRiskService::ApplyPV01(const string& bondid, double newpv01){
+  //assume bondPV01 always contain all bonds'pv01 info
+  bondPV01[bondid]=newpv01;
+  //get the corresponding record in cache
+  map<string, BondRiskEntry>::iterator the_pv01=bondRiskCache.find(bondid);
+  if(the_pv01==bondRiskCache.end()) return nullptr;//only bonds in the cache carry risk
+  PV01<Bond>& entry=the_pv01->second.pv01;
+  UpdateBucketTotals(the_pv01->second.denseId,entry.GetQuantity(),entry.GetPV01(),entry.GetQuantity(),newpv01);
+  entry.SetPV01(newpv01);
+  return &the_pv01->second;
+}
+
 void BondRiskService::UpdateBondPV01(string bondid, double newpv01){
-    //assume bondPV01 always contain all bonds'pv01 info
-    bondPV01[bondid]=newpv01;
-    //get the corresponding record in cache
-    map<string,PV01<Bond> >::iterator the_pv01=bondRiskCache.find(bondid);
-    if(the_pv01!=bondRiskCache.end()){
+    BondRiskEntry* the_pv01=ApplyPV01(bondid,newpv01);
+    if(the_pv01){
       //only when the corresponding cache exists for the bond, it is necessary to update
-      the_pv01->second.SetPV01(newpv01);
-      for(int i=0;i<bondRiskListeners.size();++i){
-        //update
-        bondRiskListeners[i]->ProcessAdd(the_pv01->second);//use update when value of pv01 changes
-      }
-      
-       //three vectors for three sectors
-      vector<Bond> v_front, v_belly, v_longend;
-      //iterate the cache
-      for(map<string, PV01<Bond> >::iterator it1=bondRiskCache.begin();it1!=bondRiskCache.end();++it1){
-      Bond currentBnd=it1->second.GetProduct();
-      if(currentBnd.GetSectorType()==FrontEnd){
-        //push to v_front
-        v_front.push_back(currentBnd);
-      }
-      else if(currentBnd.GetSectorType()==Belly){
-        v_belly.push_back(currentBnd);//push to v_belly
-      }
-      else{
-        v_longend.push_back(currentBnd);//push to longend
-      }
-     }
-     BucketedSector<Bond> b_fend(v_front,"FrontEnd"), b_belly(v_belly,"Belly"),b_longend(v_longend,"LongEnd");
-      //get updated sector pv01
-     PV01<BucketedSector<Bond> > pv01_fend=GetBucketedRisk(b_fend), pv01_belly=GetBucketedRisk(b_belly);
-     PV01<BucketedSector<Bond> > pv01_longend=GetBucketedRisk(b_longend);
-     SectorsRisk s_risks(pv01_fend,pv01_belly,pv01_longend);//construct sectors risk
-    //update through listeners
-     for(int i=0;i<bondSectorRiskListeners.size();++i){
-       bondSectorRiskListeners[i]->ProcessUpdate(s_risks);
-     }
-
+      //update
+      bondRiskListeners.ProcessAdd(the_pv01->pv01);//use update when value of pv01 changes
+      PublishSectorsRisk();
     }
 
   }
 
+void BondRiskService::UpdateBondPV01(const map<string, double>& newPV01s){
+  bool changed=false;
+  for(map<string, double>::const_iterator it=newPV01s.begin();it!=newPV01s.end();++it){
+    BondRiskEntry* the_pv01=ApplyPV01(it->first,it->second);
+    if(!the_pv01) continue;
+    changed=true;
+    bondRiskListeners.ProcessAdd(the_pv01->pv01);
+  }
+  //the running totals already hold every change, publish the sectors once
+  if(changed) PublishSectorsRisk();
+}
+
+void BondRiskService::RecomputeBucketTotals(){
+  bucketsVersion=registry.GetVersion();
+  bucketRisk.assign(registry.GetBucketCount(),0);
+  bucketQuantity.assign(registry.GetBucketCount(),0);
+  for(map<string, BondRiskEntry>::const_iterator it=bondRiskCache.begin();it!=bondRiskCache.end();++it){
+    const PV01<Bond>& entry=it->second.pv01;
+    UpdateBucketTotals(it->second.denseId,0,entry.GetPV01(),entry.GetQuantity(),entry.GetPV01());
+  }
+}
+
+void BondRiskService::CompileBuckets(){
+  registry.Compile();
+  if(registry.GetVersion()!=bucketsVersion){
+    RecomputeBucketTotals();
+    SyncSectors();
+  }
+}
+
+void BondRiskService::RefreshBond(const Bond& bnd){
+  map<string, BondRiskEntry>::iterator it=bondRiskCache.find(bnd.GetProductId());
+  if(it==bondRiskCache.end()) return;//not risked yet, the position will bring the new attributes
+  PV01<Bond>& entry=it->second.pv01;
+  entry=PV01<Bond>(bnd,entry.GetPV01(),entry.GetQuantity());//keep pv01 and quantity, take the new bond
+  int d=it->second.denseId;
+  //take the contribution out of the old buckets and put it back into the new ones
+  UpdateBucketTotals(d,entry.GetQuantity(),entry.GetPV01(),0,entry.GetPV01());
+  bool changed=registry.RefreshProduct(d);
+  if(registry.GetVersion()!=bucketsVersion){
+    //the bond was compiled in with every other bond, rebuild the totals over the new masks
+    RecomputeBucketTotals();
+    changed=true;
+  }
+  else UpdateBucketTotals(d,0,entry.GetPV01(),entry.GetQuantity(),entry.GetPV01());
+  if(!changed) return;
+  SyncSectors();
+  PublishSectorsRisk();
+}
+
+void BondRiskService::SaveSnapshot(SnapshotWriter& w) const{
+  w.Put(uint32_t(bondPV01.size()));
+  for(map<string, double>::const_iterator it=bondPV01.begin();it!=bondPV01.end();++it){
+    w.PutString(it->first);
+    w.Put(it->second);
+  }
+  const vector<int>& books=registry.GetBookBuckets();
+  w.Put(uint32_t(bondRiskCache.size()));
+  for(map<string, BondRiskEntry>::const_iterator it=bondRiskCache.begin();it!=bondRiskCache.end();++it){
+    w.PutString(it->first);
+    w.Put(it->second.pv01.GetPV01());
+    w.Put(it->second.pv01.GetQuantity());
+    //book buckets are the only membership that depends on trading history
+    vector<string> member;
+    for(size_t i=0;i<books.size();++i)
+      if(registry.GetBucket(books[i]).Contains(it->second.denseId)) member.push_back(registry.GetDefinition(books[i]).name);
+    w.Put(uint32_t(member.size()));
+    for(size_t i=0;i<member.size();++i) w.PutString(member[i]);
+  }
+}
+
+void BondRiskService::LoadSnapshot(SnapshotReader& r){
+  uint32_t n=r.Get<uint32_t>();
+  for(uint32_t i=0;i<n && r.IsGood();++i){
+    string id=r.GetString();
+    bondPV01[id]=r.Get<double>();
+  }
+  n=r.Get<uint32_t>();
+  for(uint32_t i=0;i<n && r.IsGood();++i){
+    string id=r.GetString();
+    double pv=r.Get<double>();
+    long q=r.Get<long>();
+    uint32_t members=r.Get<uint32_t>();
+    vector<string> bucketNames;
+    for(uint32_t j=0;j<members && r.IsGood();++j) bucketNames.push_back(r.GetString());
+    map<string, BondRiskEntry>::iterator it=bondRiskCache.find(id);
+    if(it==bondRiskCache.end()) continue;//no longer in reference data
+    PV01<Bond>& entry=it->second.pv01;
+    int d=it->second.denseId;
+    //take the current contribution out, join the book buckets, then put the restored one in
+    UpdateBucketTotals(d,entry.GetQuantity(),entry.GetPV01(),0,entry.GetPV01());
+    for(size_t j=0;j<bucketNames.size();++j){
+      int b=registry.FindBucket(bucketNames[j]);
+      if(b>=0) registry.AddBookMember(b,d);
+    }
+    UpdateBucketTotals(d,0,pv,q,pv);
+    entry.SetPV01(pv);
+    entry.AddQuantity(q-entry.GetQuantity());
+  }
+  SyncSectors();
+}
+
 const PV01<BucketedSector<Bond> > BondRiskService::GetBucketedRisk(const BucketedSector<Bond> &sector) const{
-    //assume all bonds in sector has pv01 record in cache
-    vector<Bond> bonds=sector.GetProducts();
+    const vector<uint64_t>& members=sector.GetMembers();
     double risk_bucket=0;
     long sum_quantity=0;
-    for(int i=0;i<bonds.size();++i){
-      //iterate bonds
-      Bond bnd=bonds[i];//get bond
-      string bid=bnd.GetProductId();//get bond id
-      long q;
-      PV01<Bond>  thepv01(bondRiskCache.find(bid)->second);//get the pv01 of this bond
-      q=thepv01.GetQuantity();//get quantity of the associated pv01
-      q=abs(q);//always set q to be positive in calculation of pv01
-      risk_bucket+=double(q)*thepv01.GetPV01();//get accumulate risk of the bucket
-      sum_quantity+=q;//get the sum of associated products
+    for(size_t w=0;w<members.size();++w){
+      //iterate the bonds of the bucket
+      for(uint64_t bits=members[w];bits!=0;bits&=bits-1){
+        int d=w*64+__builtin_ctzll(bits);
+        if(size_t(d)>=entriesByDenseId.size() || !entriesByDenseId[d]) continue;//no risk on this bond
+        const PV01<Bond>& thepv01=entriesByDenseId[d]->pv01;//get the pv01 of this bond
+        long q=abs(thepv01.GetQuantity());//always set q to be positive in calculation of pv01
+        risk_bucket+=double(q)*thepv01.GetPV01();//get accumulate risk of the bucket
+        sum_quantity+=q;//get the sum of associated products
+      }
     }
     double bucket_pv01;
     if(sum_quantity>0){
@@ -252,51 +697,31 @@ const PV01<BucketedSector<Bond> > BondRiskService::GetBucketedRisk(const Buckete
   }
 
 void BondRiskService::AddPosition(Position<Bond> &position){
-    Bond bnd=position.GetProduct();//get bond of the position
-    //three vectors for three sectors
-    vector<Bond> v_front, v_belly, v_longend;
-    //iterate the cache
-    for(map<string, PV01<Bond> >::iterator it1=bondRiskCache.begin();it1!=bondRiskCache.end();++it1){
-      Bond currentBnd=it1->second.GetProduct();
-      if(currentBnd.GetSectorType()==FrontEnd){
-        //push to v_front
-        v_front.push_back(currentBnd);
-      }
-      else if(currentBnd.GetSectorType()==Belly){
-        v_belly.push_back(currentBnd);//push to v_belly
-      }
-      else{
-        v_longend.push_back(currentBnd);//push to longend
-      }
-    }
-    BucketedSector<Bond> b_fend(v_front,"FrontEnd"), b_belly(v_belly,"Belly"),b_longend(v_longend,"LongEnd");
+    const Bond& bnd=position.GetProduct();//get bond of the position
     string rid=bnd.GetProductId();//get product id of the bond
-    double pv_01=bondPV01[rid];//get pv01 value of the bond
     long quantity=position.GetAggregatePosition();//get the
-    PV01<Bond> pv01_bnd(bnd,pv_01,quantity);//construct the pv01 to add
-    map<string, PV01<Bond> >::iterator the_pv01=bondRiskCache.find(rid);//get the pv01 already exists
+    CompileBuckets();//take in buckets defined since the last position
+    map<string, BondRiskEntry>::iterator the_pv01=bondRiskCache.find(rid);//get the pv01 already exists
     if(the_pv01==bondRiskCache.end()){
-      //new product entry
-      bondRiskCache.insert(make_pair(rid,pv01_bnd));//insert into cache
-      for(int i=0;i<bondRiskListeners.size();++i){
-        bondRiskListeners[i]->ProcessAdd(pv01_bnd);//invoke listeners for add
+      //new product entry, it must be known to reference data to be bucketed
+      int d=refData.GetDenseId(rid);
+      if(d<0){
+        cout<<"No reference data for "<<rid<<"\n";
+        return;
       }
+      double pv_01=bondPV01[rid];//get pv01 value of the bond
+      the_pv01=AddToCache(PV01<Bond>(position.GetProductHandle(),pv_01,quantity),d);//insert into cache
+      SyncSectors();
     }
     else{
-      //the pv01 already existed
-      the_pv01->second.AddQuantity(quantity);//update quantity
-      for(int i=0;i<bondRiskListeners.size();++i){
-        bondRiskListeners[i]->ProcessAdd(the_pv01->second);//invoke listeners for add
-      }
-    }
-    //get updated sector pv01
-    PV01<BucketedSector<Bond> > pv01_fend=GetBucketedRisk(b_fend), pv01_belly=GetBucketedRisk(b_belly);
-    PV01<BucketedSector<Bond> > pv01_longend=GetBucketedRisk(b_longend);
-    SectorsRisk s_risks(pv01_fend,pv01_belly,pv01_longend);//construct sectors risk
-    //update through listeners
-    for(int i=0;i<bondSectorRiskListeners.size();++i){
-      bondSectorRiskListeners[i]->ProcessUpdate(s_risks);
+      //the pv01 already existed, take the new aggregate position
+      PV01<Bond>& entry=the_pv01->second.pv01;
+      UpdateBucketTotals(the_pv01->second.denseId,entry.GetQuantity(),entry.GetPV01(),quantity,entry.GetPV01());
+      entry.AddQuantity(quantity-entry.GetQuantity());//update quantity
     }
+    UpdateBookBuckets(the_pv01->second.denseId,position);
+    bondRiskListeners.ProcessAdd(the_pv01->second.pv01);//invoke listeners for add
+    PublishSectorsRisk();
   }
 
 
@@ -0,0 +1,243 @@
+/*
+implement scenario risk: curve shocks evaluated against the current bond positions
+author: Gaoxian Song
+*/
+#ifndef ScenarioEngine_HPP
+#define ScenarioEngine_HPP
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include "riskservice.hpp"
+
+using namespace std;
+
+//tenors (in years) where the shock loadings have their knots
+const double SHOCK_SHORT_TENOR=2.0;
+const double SHOCK_BELLY_TENOR=7.0;
+const double SHOCK_LONG_TENOR=30.0;
+//scenarios handed to a worker at a time
+const int SCENARIO_CHUNK=8;
+
+//a curve shock in basis points built from three shapes:
+//parallel moves every tenor by the same amount, slope moves the short end by -slope and the
+//long end by +slope around the belly, curvature moves the belly by +curvature and both wings by -curvature
+class CurveShock
+{
+public:
+  string name;
+  double parallel;
+  double slope;
+  double curvature;
+  CurveShock(string name_="", double parallel_=0, double slope_=0, double curvature_=0):
+    name(name_),parallel(parallel_),slope(slope_),curvature(curvature_){}
+};
+
+//fixed set of worker threads that split a range of work items between them
+//the calling thread joins in, so a pool of n threads runs n-1 workers
+class WorkerPool
+{
+private:
+  vector<thread> workers;
+  mutex m;
+  condition_variable wake;//a new job is posted or the pool is stopping
+  condition_variable finished;//the last worker left the current job
+  const function<void(int, int)>* job;//current job, called with [begin, end) ranges
+  int jobSize;
+  int chunkSize;
+  atomic<int> nextBegin;//start of the next range to hand out
+  int active;//workers still on the current job
+  unsigned long generation;//bumped for every job
+  bool stopping;
+  //take ranges of the current job until none are left
+  void Work();
+  void Loop();
+public:
+  WorkerPool(int threads=thread::hardware_concurrency());
+  ~WorkerPool();
+  //call f on consecutive ranges of at most chunk items covering [0, n) and wait until all are done
+  void ParallelFor(int n, int chunk, const function<void(int, int)>& f);
+  int GetThreadCount() const{return workers.size()+1;}
+};
+
+//scenario results: P&L per scenario for the whole book, per standard sector and per bond
+//P&L is in the units of the risk service, quantity times pv01 per basis point, and positive for a gain
+class ScenarioGrid
+{
+public:
+  vector<CurveShock> scenarios;
+  vector<string> bondIds;//column order of bondPnL
+  vector<double> total;//one per scenario
+  vector<double> sectorPnL;//STANDARD_SECTORS per scenario, row major
+  vector<double> bondPnL;//bondIds.size() per scenario, row major
+  double GetBondPnL(int scenario, int bond) const{return bondPnL[scenario*bondIds.size()+bond];}
+  double GetSectorPnL(int scenario, int sector) const{return sectorPnL[scenario*STANDARD_SECTORS+sector];}
+};
+
+//evaluate curve shocks against every risked bond
+//positions and pv01s are copied from the risk service into arrays grouped by sector, then each
+//scenario is a straight loop over those arrays and scenarios are spread over a worker pool
+class ScenarioEngine
+{
+private:
+  BondRiskService& b_risk;
+  WorkerPool pool;
+  vector<string> bondIds;
+  vector<double> exposure;//signed quantity times pv01 of each bond
+  vector<double> slopeLoading;//bp moved by one bp of slope at the bond's maturity
+  vector<double> curvatureLoading;//bp moved by one bp of curvature at the bond's maturity
+  int sectorBegin[STANDARD_SECTORS+1];//bonds of sector k are [sectorBegin[k], sectorBegin[k+1])
+  //evaluate scenarios [begin, end) into grid
+  void Evaluate(const vector<CurveShock>& scenarios, int begin, int end, ScenarioGrid& grid) const;
+public:
+  ScenarioEngine(BondRiskService& b_risk_, int threads=thread::hardware_concurrency()):b_risk(b_risk_),pool(threads){Load();}
+  //take a fresh copy of positions and pv01s from the risk service
+  void Load();
+  //evaluate every scenario against the loaded positions
+  void Run(const vector<CurveShock>& scenarios, ScenarioGrid& grid);
+  int GetBondCount() const{return bondIds.size();}
+  //parallel, steepener/flattener and butterfly shocks plus their combinations
+  static vector<CurveShock> StandardScenarios();
+};
+
+//write the book and sector P&L of every scenario to a file, replacing the grid of an earlier run
+void WriteScenarioGrid(const ScenarioGrid& grid, const string& path);
+
+WorkerPool::WorkerPool(int threads):job(nullptr),jobSize(0),chunkSize(1),nextBegin(0),active(0),generation(0),stopping(false){
+  for(int i=1;i<threads;++i) workers.push_back(thread(&WorkerPool::Loop,this));
+}
+
+WorkerPool::~WorkerPool(){
+  {
+    lock_guard<mutex> lock(m);
+    stopping=true;
+  }
+  wake.notify_all();
+  for(size_t i=0;i<workers.size();++i) workers[i].join();
+}
+
+void WorkerPool::Work(){
+  for(int b=nextBegin.fetch_add(chunkSize);b<jobSize;b=nextBegin.fetch_add(chunkSize))
+    (*job)(b,min(b+chunkSize,jobSize));
+}
+
+void WorkerPool::Loop(){
+  unsigned long seen=0;
+  while(true){
+    {
+      unique_lock<mutex> lock(m);
+      while(!stopping && generation==seen) wake.wait(lock);
+      if(stopping) return;
+      seen=generation;
+    }
+    Work();
+    lock_guard<mutex> lock(m);
+    if(--active==0) finished.notify_one();
+  }
+}
+
+void WorkerPool::ParallelFor(int n, int chunk, const function<void(int, int)>& f){
+  if(workers.empty() || n<=chunk){
+    //not worth waking anyone
+    for(int b=0;b<n;b+=chunk) f(b,min(b+chunk,n));
+    return;
+  }
+  {
+    lock_guard<mutex> lock(m);
+    job=&f; jobSize=n; chunkSize=chunk; nextBegin=0;
+    active=workers.size();
+    ++generation;
+  }
+  wake.notify_all();
+  Work();
+  unique_lock<mutex> lock(m);
+  while(active>0) finished.wait(lock);
+  job=nullptr;
+}
+
+void ScenarioEngine::Load(){
+  bondIds.clear(); exposure.clear(); slopeLoading.clear(); curvatureLoading.clear();
+  const map<string, BondRiskEntry>& entries=b_risk.GetRiskEntries();
+  for(int k=0;k<STANDARD_SECTORS;++k){
+    sectorBegin[k]=bondIds.size();
+    for(map<string, BondRiskEntry>::const_iterator it=entries.begin();it!=entries.end();++it){
+      const PV01<Bond>& pv01=it->second.pv01;
+      const Bond& bnd=pv01.GetProduct();
+      if(bnd.GetSectorType()!=k) continue;
+      //piecewise linear loadings with knots at the short, belly and long tenors
+      double t=min(max(bnd.GetYearFraction(),SHOCK_SHORT_TENOR),SHOCK_LONG_TENOR);
+      double w=t<SHOCK_BELLY_TENOR?(t-SHOCK_SHORT_TENOR)/(SHOCK_BELLY_TENOR-SHOCK_SHORT_TENOR)
+                                  :(SHOCK_LONG_TENOR-t)/(SHOCK_LONG_TENOR-SHOCK_BELLY_TENOR);//1 at the belly, 0 at the wings
+      bondIds.push_back(it->first);
+      exposure.push_back(double(pv01.GetQuantity())*pv01.GetPV01());
+      slopeLoading.push_back(t<SHOCK_BELLY_TENOR?w-1.0:1.0-w);
+      curvatureLoading.push_back(2.0*w-1.0);
+    }
+  }
+  sectorBegin[STANDARD_SECTORS]=bondIds.size();
+}
+
+void ScenarioEngine::Evaluate(const vector<CurveShock>& scenarios, int begin, int end, ScenarioGrid& grid) const{
+  int n=bondIds.size();
+  const double* e=exposure.data();
+  const double* ls=slopeLoading.data();
+  const double* lc=curvatureLoading.data();
+  for(int s=begin;s<end;++s){
+    double p=scenarios[s].parallel, sl=scenarios[s].slope, cv=scenarios[s].curvature;
+    double* row=grid.bondPnL.data()+size_t(s)*n;
+    //rates up means prices down, so P&L is minus exposure times the shock
+    for(int i=0;i<n;++i) row[i]=-e[i]*(p+sl*ls[i]+cv*lc[i]);
+    double total=0;
+    for(int k=0;k<STANDARD_SECTORS;++k){
+      double sum=0;
+      for(int i=sectorBegin[k];i<sectorBegin[k+1];++i) sum+=row[i];
+      grid.sectorPnL[s*STANDARD_SECTORS+k]=sum;
+      total+=sum;
+    }
+    grid.total[s]=total;
+  }
+}
+
+void ScenarioEngine::Run(const vector<CurveShock>& scenarios, ScenarioGrid& grid){
+  int ns=scenarios.size();
+  grid.scenarios=scenarios;
+  grid.bondIds=bondIds;
+  grid.total.assign(ns,0);
+  grid.sectorPnL.assign(ns*STANDARD_SECTORS,0);
+  grid.bondPnL.resize(size_t(ns)*bondIds.size());
+  function<void(int, int)> task=[&](int begin, int end){Evaluate(scenarios,begin,end,grid);};
+  pool.ParallelFor(ns,SCENARIO_CHUNK,task);
+}
+
+vector<CurveShock> ScenarioEngine::StandardScenarios(){
+  vector<CurveShock> scenarios;
+  const double sizes[]={-100,-50,-25,-10,10,25,50,100};
+  for(int i=0;i<8;++i) scenarios.push_back(CurveShock("parallel "+to_string(int(sizes[i])),sizes[i],0,0));
+  for(int i=0;i<8;++i) scenarios.push_back(CurveShock((sizes[i]>0?"steepener ":"flattener ")+to_string(int(sizes[i])),0,sizes[i],0));
+  for(int i=0;i<8;++i) scenarios.push_back(CurveShock("butterfly "+to_string(int(sizes[i])),0,0,sizes[i]));
+  //every combination of the three shapes
+  for(int a=0;a<8;++a)
+    for(int b=0;b<8;++b)
+      for(int c=0;c<8;++c)
+        scenarios.push_back(CurveShock("combo "+to_string(int(sizes[a]))+"/"+to_string(int(sizes[b]))+"/"+to_string(int(sizes[c])),sizes[a],sizes[b],sizes[c]));
+  return scenarios;
+}
+
+void WriteScenarioGrid(const ScenarioGrid& grid, const string& path){
+  ofstream file;
+  file.open(path.c_str(),ios_base::trunc);//the grid is of the latest positions only
+  file<<"Scenario,Total,FrontEnd,Belly,LongEnd\n";
+  for(size_t s=0;s<grid.scenarios.size();++s){
+    file<<grid.scenarios[s].name<<","<<to_string(grid.total[s]);
+    for(int k=0;k<STANDARD_SECTORS;++k) file<<","<<to_string(grid.GetSectorPnL(s,k));
+    file<<"\n";
+  }
+}
+
+#endif
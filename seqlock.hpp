@@ -0,0 +1,58 @@
+/*
+implement a sequence lock for publishing small values from one writer to lock-free readers
+author: Gaoxian Song
+*/
+#ifndef SeqLock_HPP
+#define SeqLock_HPP
+
+#include <atomic>
+#include <cstring>
+#include <stdint.h>
+
+using namespace std;
+
+/**
+ * Holds a copy of a trivially copyable T that one writer thread updates and any number of
+ * reader threads read without locks. The writer makes the sequence odd, stores the value
+ * and makes it even again; a reader retries if the sequence was odd or moved while it copied.
+ * The value lives in atomic words so concurrent reads and writes are well defined.
+ */
+template<typename T>
+class SeqLocked
+{
+private:
+  static const size_t WORDS=(sizeof(T)+sizeof(uint64_t)-1)/sizeof(uint64_t);
+  atomic<unsigned long> sequence;
+  atomic<uint64_t> words[WORDS];
+public:
+  SeqLocked(const T& value=T()):sequence(0){
+    for(size_t i=0;i<WORDS;++i) words[i].store(0,memory_order_relaxed);
+    Store(value);
+  }
+  //publish a new value, only ever called from the writer thread
+  void Store(const T& value){
+    uint64_t tmp[WORDS]={0};
+    memcpy(tmp,&value,sizeof(T));
+    unsigned long s=sequence.load(memory_order_relaxed);
+    sequence.store(s+1,memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);//readers see the odd sequence before any new word
+    for(size_t i=0;i<WORDS;++i) words[i].store(tmp[i],memory_order_relaxed);
+    sequence.store(s+2,memory_order_release);
+  }
+  //read a consistent copy from any thread
+  T Load() const{
+    uint64_t tmp[WORDS];
+    unsigned long before, after;
+    do{
+      before=sequence.load(memory_order_acquire);
+      for(size_t i=0;i<WORDS;++i) tmp[i]=words[i].load(memory_order_relaxed);
+      atomic_thread_fence(memory_order_acquire);//the words are read before the sequence is checked again
+      after=sequence.load(memory_order_relaxed);
+    }while((before&1) || before!=after);
+    T value;
+    memcpy(&value,tmp,sizeof(T));
+    return value;
+  }
+};
+
+#endif
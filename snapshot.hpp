@@ -0,0 +1,220 @@
+/*
+implement binary checkpoints of service caches for warm restarts
+author: Gaoxian Song
+*/
+#ifndef Snapshot_HPP
+#define Snapshot_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "referencedataservice.hpp"
+
+using namespace std;
+
+const char SNAPSHOT_MAGIC[8]={'B','S','N','A','P','S','H','1'};
+
+//serialize values into a section of a checkpoint
+class SnapshotWriter
+{
+private:
+  vector<char> data;
+public:
+  //any trivially copyable value, in native byte order
+  template<typename V>
+  void Put(const V& v){
+    size_t n=data.size();
+    data.resize(n+sizeof(V));
+    memcpy(&data[n],&v,sizeof(V));
+  }
+  void PutBytes(const char* src, size_t len){data.insert(data.end(),src,src+len);}
+  void PutString(const string& s){
+    Put(uint32_t(s.size()));
+    PutBytes(s.data(),s.size());
+  }
+  const vector<char>& GetData() const{return data;}
+};
+
+//read values back from a section of a checkpoint
+//reads past the end return zero values and mark the reader bad
+class SnapshotReader
+{
+private:
+  const char* p;
+  const char* end;
+  bool ok;
+  const BondReferenceDataService& refData;
+public:
+  SnapshotReader(const string& section, const BondReferenceDataService& refData_):
+    p(section.data()),end(section.data()+section.size()),ok(true),refData(refData_){}
+  template<typename V>
+  V Get(){
+    V v=V();
+    if(end-p<(ptrdiff_t)sizeof(V)){ok=false; p=end; return v;}
+    memcpy(&v,p,sizeof(V));
+    p+=sizeof(V);
+    return v;
+  }
+  string GetBytes(uint64_t n){
+    if(uint64_t(end-p)<n){ok=false; p=end; return "";}
+    string s(p,n);
+    p+=n;
+    return s;
+  }
+  string GetString(){return GetBytes(Get<uint32_t>());}
+  //bond from reference data, null if the product is unknown
+  const Bond* GetBond(const string& productId) const{
+    int d=refData.GetDenseId(productId);
+    return d<0?nullptr:&refData.GetBond(d);
+  }
+  bool IsGood() const{return ok;}
+};
+
+//a service or connector whose state is part of a checkpoint
+class Snapshottable
+{
+public:
+  virtual ~Snapshottable(){}
+  //unique name of the section holding the state
+  virtual string GetSnapshotName() const=0;
+  virtual void SaveSnapshot(SnapshotWriter& w) const=0;
+  //restore the state without notifying listeners; downstream services restore their own state
+  virtual void LoadSnapshot(SnapshotReader& r)=0;
+  //called once a checkpoint holding the state saved last is safely on disk
+  virtual void OnCheckpointed(){}
+};
+
+//a step run once between feeds, such as the end of day refresh; the checkpoints taken after it
+//record it as done so a warm start restoring one of them does not run it again
+class SnapshotStep: public Snapshottable
+{
+private:
+  string name;
+  bool done;
+public:
+  explicit SnapshotStep(const string& name_):name(name_),done(false){}
+  bool IsDone() const{return done;}
+  void MarkDone(){done=true;}
+  virtual string GetSnapshotName() const{return "step."+name;}
+  virtual void SaveSnapshot(SnapshotWriter& w) const{w.Put(uint8_t(done));}
+  virtual void LoadSnapshot(SnapshotReader& r){done=r.Get<uint8_t>()!=0;}
+};
+
+/**
+ * Writes every registered participant into one checkpoint file and, on a warm start, hands each
+ * participant its section of the latest checkpoint as it registers.
+ * Layout: magic, uint32 section count, then per section its name, uint64 length and bytes.
+ * A checkpoint is written to a temporary file and renamed, so the latest one is always complete.
+ * Sections restored at startup whose participant has not registered yet are written back unchanged,
+ * so a checkpoint taken early in a warm start keeps the state of the feeds further on.
+ */
+class CheckpointManager
+{
+private:
+  string path;
+  const BondReferenceDataService& refData;
+  vector<Snapshottable*> participants;
+  map<string, string> sections;//sections of the checkpoint loaded at startup
+  bool restored;
+  void ReadCheckpoint();
+public:
+  //with warmStart set, the latest checkpoint at path is loaded if there is one
+  CheckpointManager(const string& path_, const BondReferenceDataService& refData_, bool warmStart);
+  //add a participant, restoring its state first if the checkpoint has its section
+  void Register(Snapshottable* participant);
+  //write the state of every participant; returns false if the file could not be written
+  bool Checkpoint();
+  //whether the service state came from a checkpoint
+  bool IsRestored() const{return restored;}
+};
+
+CheckpointManager::CheckpointManager(const string& path_, const BondReferenceDataService& refData_, bool warmStart):
+  path(path_),refData(refData_),restored(false)
+{
+  if(warmStart) ReadCheckpoint();
+}
+
+void CheckpointManager::ReadCheckpoint(){
+  FILE* f=fopen(path.c_str(),"rb");
+  if(!f) return;//cold start
+  string content;
+  char buf[65536];
+  size_t n;
+  while((n=fread(buf,1,sizeof(buf),f))>0) content.append(buf,n);
+  fclose(f);
+  if(content.size()<sizeof(SNAPSHOT_MAGIC)+sizeof(uint32_t) || memcmp(content.data(),SNAPSHOT_MAGIC,sizeof(SNAPSHOT_MAGIC))!=0){
+    cout<<"Ignoring malformed checkpoint "<<path<<"\n";
+    return;
+  }
+  string body=content.substr(sizeof(SNAPSHOT_MAGIC));
+  SnapshotReader r(body,refData);
+  uint32_t count=r.Get<uint32_t>();
+  map<string, string> loaded;
+  for(uint32_t i=0;i<count && r.IsGood();++i){
+    string name=r.GetString();
+    uint64_t len=r.Get<uint64_t>();
+    loaded[name]=r.GetBytes(len);
+  }
+  if(!r.IsGood()){
+    cout<<"Ignoring truncated checkpoint "<<path<<"\n";
+    return;
+  }
+  sections.swap(loaded);
+  restored=true;
+}
+
+void CheckpointManager::Register(Snapshottable* participant){
+  participants.push_back(participant);
+  map<string, string>::iterator it=sections.find(participant->GetSnapshotName());
+  if(it==sections.end()) return;
+  SnapshotReader r(it->second,refData);
+  participant->LoadSnapshot(r);
+  if(!r.IsGood()) cout<<"Checkpoint section "<<it->first<<" is incomplete\n";
+}
+
+bool CheckpointManager::Checkpoint(){
+  set<string> names;
+  for(size_t i=0;i<participants.size();++i) names.insert(participants[i]->GetSnapshotName());
+  vector<map<string, string>::const_iterator> unclaimed;
+  for(map<string, string>::const_iterator it=sections.begin();it!=sections.end();++it)
+    if(!names.count(it->first)) unclaimed.push_back(it);
+  SnapshotWriter w;
+  w.PutBytes(SNAPSHOT_MAGIC,sizeof(SNAPSHOT_MAGIC));
+  w.Put(uint32_t(participants.size()+unclaimed.size()));
+  for(size_t i=0;i<participants.size();++i){
+    SnapshotWriter section;
+    participants[i]->SaveSnapshot(section);
+    w.PutString(participants[i]->GetSnapshotName());
+    w.Put(uint64_t(section.GetData().size()));
+    w.PutBytes(section.GetData().data(),section.GetData().size());
+  }
+  for(size_t i=0;i<unclaimed.size();++i){
+    w.PutString(unclaimed[i]->first);
+    w.Put(uint64_t(unclaimed[i]->second.size()));
+    w.PutBytes(unclaimed[i]->second.data(),unclaimed[i]->second.size());
+  }
+  string tmp=path+".tmp";
+  int fd=open(tmp.c_str(),O_WRONLY|O_CREAT|O_TRUNC,0644);
+  if(fd<0) return false;
+  const char* p=w.GetData().data();
+  size_t left=w.GetData().size();
+  while(left>0){
+    ssize_t n=write(fd,p,left);
+    if(n<=0){close(fd); return false;}
+    p+=n; left-=n;
+  }
+  fsync(fd);//the checkpoint must be on disk before it replaces the previous one
+  close(fd);
+  if(rename(tmp.c_str(),path.c_str())!=0) return false;
+  for(size_t i=0;i<participants.size();++i) participants[i]->OnCheckpointed();
+  return true;
+}
+
+#endif
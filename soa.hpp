@@ -50,10 +50,17 @@ public:
   // The callback that a Connector should invoke for any new or updated data
   virtual void OnMessage(V &data) = 0;
 
+  // The callback for data the Connector no longer needs; a Service that caches the data
+  // overrides this to move it into the cache rather than copy it
+  virtual void OnMessage(V &&data){OnMessage(data);}
+
   // Add a listener to the Service for callbacks on add, remove, and update events
   // for data to the Service.
   virtual void AddListener(ServiceListener<V> *listener) = 0;
 
+  // Remove a listener added before; it may still be called by a dispatch already under way.
+  virtual void RemoveListener(ServiceListener<V> *listener) = 0;
+
   // Get all listeners on the Service.
   virtual const vector< ServiceListener<V>* >& GetListeners() const = 0;
 
@@ -8,8 +8,11 @@
 #define STREAMING_SERVICE_HPP
 
 #include "soa.hpp"
+#include "listenerlist.hpp"
 #include "marketdataservice.hpp"
 #include "pricingservice.hpp"
+#include "pipeline.hpp"
+#include "randomsource.hpp"
 #include <stdlib.h>
 
 /**
@@ -52,11 +55,14 @@ class PriceStream
 {
 public:
   // ctor
-  PriceStream(const T &_product, const PriceStreamOrder &_bidOrder, const PriceStreamOrder &_offerOrder);
+  PriceStream(const ProductHandle<T> &_product, const PriceStreamOrder &_bidOrder, const PriceStreamOrder &_offerOrder);
 
   // Get the product
   const T& GetProduct() const;
 
+  // Get the shared handle of the product, to build further messages without interning it again
+  const ProductHandle<T>& GetProductHandle() const{return product;}
+
   // Get the bid order
   const PriceStreamOrder& GetBidOrder() const;
 
@@ -64,7 +70,7 @@ public:
   const PriceStreamOrder& GetOfferOrder() const;
 
 private:
-  T product;
+  ProductHandle<T> product;
   PriceStreamOrder bidOrder;
   PriceStreamOrder offerOrder;
 
@@ -73,10 +79,12 @@ private:
 template<typename T>
 class AlgoStream{
 private:
-  PriceStream<T>& p_stream;
+  PriceStream<T> p_stream;//owned, the cached algo stream outlives the caller's stream
 public:
-  AlgoStream(PriceStream<T>& src):p_stream(src){}//constructor
+  AlgoStream(const PriceStream<T>& src):p_stream(src){}//constructor
+  AlgoStream(PriceStream<T>&& src):p_stream(std::move(src)){}
   PriceStream<T>& GetPrcieStream(){return p_stream;}//getter
+  const PriceStream<T>& GetPrcieStream() const{return p_stream;}
   void SetPriceStream(PriceStream<T>& src){p_stream=src;}//setter
 };
 
@@ -112,8 +120,14 @@ class BondAlgoStreamingService: public AlgoStreamingService<Bond>
 {
 private:
   map<string,AlgoStream<Bond> > bondAlgoStreamCache;
-  vector< ServiceListener<AlgoStream<Bond> >* > algoStreamListeners;
+  ListenerList<AlgoStream<Bond> > algoStreamListeners;
+  RandomSource ownRandom;
+  RandomSource* random;//where stream sizes are drawn from, ownRandom unless a shared one is set
 public:
+  BondAlgoStreamingService():random(&ownRandom){}
+  //draw stream sizes from a source shared with other services, such as one saved with the checkpoints
+  void SetRandomSource(RandomSource* src){random=src;}
+  RandomSource& GetRandomSource(){return *random;}
    // Get data on our service given a key
   virtual AlgoStream<Bond>& GetData(string key){
     return bondAlgoStreamCache.find(key)->second;
@@ -124,12 +138,17 @@ public:
 
   // Add a listener to the Service for callbacks on add, remove, and update events
   // for data to the Service.
-  virtual void AddListener(ServiceListener<AlgoStream<Bond> > *listener){algoStreamListeners.push_back(listener);}
+  virtual void AddListener(ServiceListener<AlgoStream<Bond> > *listener){algoStreamListeners.Add(listener);}
+  //remove a listener, a dispatch already under way may still call it
+  virtual void RemoveListener(ServiceListener<AlgoStream<Bond> > *listener){algoStreamListeners.Remove(listener);}
 
   // Get all listeners on the Service.
-  virtual const vector< ServiceListener<AlgoStream<Bond> >* >& GetListeners() const {return algoStreamListeners;}
+  virtual const vector< ServiceListener<AlgoStream<Bond> >* >& GetListeners() const {return algoStreamListeners.Snapshot();}
 
-  virtual void ExecuteAlgoStream(AlgoStream<Bond>& data);
+  virtual void ExecuteAlgoStream(AlgoStream<Bond>& data){NoSink none; ExecuteAlgoStream(data,none);}
+  //take an algo stream, it goes to the statically wired sink before the registered listeners
+  template<typename Sink>
+  void ExecuteAlgoStream(AlgoStream<Bond>& data, Sink& sink);
 };
 
 class BondPriceListener: public ServiceListener<Price<Bond> >
@@ -147,9 +166,36 @@ public:
   // Listener callback to process an update event to the Service
   virtual void ProcessAdd(Price<Bond> &data);
 };
+
+//the algo stream quoted around a price, with visible and hidden sizes drawn from random
+AlgoStream<Bond> MakeAlgoStream(const Price<Bond>& data, RandomSource& random);
+
+//price listener of a statically wired pipeline, algo streams go straight to the listeners in Sink
+template<typename Sink>
+class BondPriceStaticListener: public ServiceListener<Price<Bond> >
+{
+private:
+  BondAlgoStreamingService& b_algo_stream;
+  Sink sink;
+public:
+  BondPriceStaticListener(BondAlgoStreamingService& src, const Sink& sink_): b_algo_stream(src),sink(sink_){}
+   // Listener callback to process an add event to the Service
+  virtual void ProcessUpdate(Price<Bond> &data){}
+
+  // Listener callback to process a remove event to the Service
+  virtual void ProcessRemove(Price<Bond> &data){}
+
+  // Listener callback to process an update event to the Service
+  virtual void ProcessAdd(Price<Bond> &data){
+    AlgoStream<Bond> algo_stream=MakeAlgoStream(data,b_algo_stream.GetRandomSource());
+    b_algo_stream.ExecuteAlgoStream(algo_stream,sink);
+  }
+};
 //publish pricestream
 class BondStreamingConnector: public Connector<PriceStream<Bond> >
 {
+private:
+  ofstream file;//./Output/PriceStreams.txt, opened on the first stream and kept open
 public:
   virtual void Publish(PriceStream<Bond> &data);
 };
@@ -158,7 +204,7 @@ class BondStreamingService: public StreamingService<Bond>
 {
 private:
   map<string, PriceStream<Bond> > bondPriceStreamCache;
-  vector<ServiceListener<PriceStream<Bond> >* > priceStreamListeners;
+  ListenerList<PriceStream<Bond> > priceStreamListeners;
   BondStreamingConnector b_stream_connector;
 public:
    // Get data on our service given a key
@@ -171,13 +217,18 @@ public:
 
   // Add a listener to the Service for callbacks on add, remove, and update events
   // for data to the Service.
-  virtual void AddListener(ServiceListener<PriceStream<Bond> > *listener){priceStreamListeners.push_back(listener);}
+  virtual void AddListener(ServiceListener<PriceStream<Bond> > *listener){priceStreamListeners.Add(listener);}
+  //remove a listener, a dispatch already under way may still call it
+  virtual void RemoveListener(ServiceListener<PriceStream<Bond> > *listener){priceStreamListeners.Remove(listener);}
 
   // Get all listeners on the Service.
-  virtual const vector< ServiceListener<PriceStream<Bond> >* >& GetListeners() const {return priceStreamListeners;}
+  virtual const vector< ServiceListener<PriceStream<Bond> >* >& GetListeners() const {return priceStreamListeners.Snapshot();}
 
   // Publish two-way prices
-  void PublishPrice(const PriceStream<Bond>& priceStream);
+  void PublishPrice(const PriceStream<Bond>& priceStream){NoSink none; PublishPrice(priceStream,none);}
+  //publish, the stream goes to the statically wired sink before the registered listeners
+  template<typename Sink>
+  void PublishPrice(const PriceStream<Bond>& priceStream, Sink& sink);
 };
 
 class BondAlgoStreamListener: public ServiceListener<AlgoStream<Bond> >
@@ -194,11 +245,30 @@ public:
 
   // Listener callback to process an update event to the Service
   virtual void ProcessAdd(AlgoStream<Bond> &data){
-    PriceStream<Bond> p_stream=data.GetPrcieStream();//get the price stream
+    const PriceStream<Bond>& p_stream=data.GetPrcieStream();//get the price stream
     b_stream_service.PublishPrice(p_stream);//publish the stream
   }
 };
 
+//algo stream listener of a statically wired pipeline, price streams go straight to the listeners in Sink
+template<typename Sink>
+class BondAlgoStreamStaticListener: public ServiceListener<AlgoStream<Bond> >
+{
+private:
+  BondStreamingService& b_stream_service;
+  Sink sink;
+public:
+  BondAlgoStreamStaticListener(BondStreamingService& src, const Sink& sink_): b_stream_service(src),sink(sink_){}
+   // Listener callback to process an add event to the Service
+  virtual void ProcessUpdate(AlgoStream<Bond> &data){}
+
+  // Listener callback to process a remove event to the Service
+  virtual void ProcessRemove(AlgoStream<Bond> &data){}
+
+  // Listener callback to process an update event to the Service
+  virtual void ProcessAdd(AlgoStream<Bond> &data){b_stream_service.PublishPrice(data.GetPrcieStream(),sink);}
+};
+
 PriceStreamOrder::PriceStreamOrder(double _price, long _visibleQuantity, long _hiddenQuantity, PricingSide _side)
 {
   price = _price;
@@ -223,7 +293,7 @@ long PriceStreamOrder::GetHiddenQuantity() const
 }
 
 template<typename T>
-PriceStream<T>::PriceStream(const T &_product, const PriceStreamOrder &_bidOrder, const PriceStreamOrder &_offerOrder) :
+PriceStream<T>::PriceStream(const ProductHandle<T> &_product, const PriceStreamOrder &_bidOrder, const PriceStreamOrder &_offerOrder) :
   product(_product), bidOrder(_bidOrder), offerOrder(_offerOrder)
 {
 }
@@ -231,7 +301,7 @@ PriceStream<T>::PriceStream(const T &_product, const PriceStreamOrder &_bidOrder
 template<typename T>
 const T& PriceStream<T>::GetProduct() const
 {
-  return product;
+  return product.Get();
 }
 
 template<typename T>
@@ -246,63 +316,61 @@ const PriceStreamOrder& PriceStream<T>::GetOfferOrder() const
   return offerOrder;
 }
 
-void BondAlgoStreamingService::ExecuteAlgoStream(AlgoStream<Bond>& data){
-  PriceStream<Bond> p_stream=data.GetPrcieStream();//get the pricestream associated
-  Bond bnd=p_stream.GetProduct();//get the bond
-  string bondid=bnd.GetProductId();//get the bond id
+template<typename Sink>
+void BondAlgoStreamingService::ExecuteAlgoStream(AlgoStream<Bond>& data, Sink& sink){
+  const PriceStream<Bond>& p_stream=data.GetPrcieStream();//get the pricestream associated
+  const Bond& bnd=p_stream.GetProduct();//get the bond
+  const string& bondid=bnd.GetProductId();//get the bond id
   map<string, AlgoStream<Bond> >::iterator it=bondAlgoStreamCache.find(bondid);//locate the bond
   if(it==bondAlgoStreamCache.end()){
     //new entry
     bondAlgoStreamCache.insert(make_pair(bondid,data));
   }
   else{
-    //erase previous entry
-    bondAlgoStreamCache.erase(bondid);
-    bondAlgoStreamCache.insert(make_pair(bondid,data));//insert new entry
-  }
-  for(int i=0;i<algoStreamListeners.size();++i){
-    algoStreamListeners[i]->ProcessAdd(data);//invoke listeners for new data addition
+    it->second=data;//replace the previous entry in place
   }
+  sink.ProcessAdd(data);
+  algoStreamListeners.ProcessAdd(data);//invoke listeners for new data addition
 }
 
-void BondPriceListener::ProcessAdd(Price<Bond>& data){
- Bond bnd=data.GetProduct();//get the corresponding bond
+AlgoStream<Bond> MakeAlgoStream(const Price<Bond>& data, RandomSource& random){
+ const Bond& bnd=data.GetProduct();//get the corresponding bond
  string bondid=bnd.GetProductId();//get bond id
  double mid=data.GetMid();//get mid price
  double spread=data.GetBidOfferSpread();//get spread
  double bidprice=mid-0.5*spread;//get bid price
  double offerprice=mid+0.5*spread;//get offer price
- long visible=(rand()%10+1)*10000;//set random visible quantity
- long hidden=(rand()%20+1)*15000;//set random hidden quantity
+ long visible=(random.Next()%10+1)*10000;//set random visible quantity
+ long hidden=(random.Next()%20+1)*15000;//set random hidden quantity
  PriceStreamOrder bid_order(bidprice,visible,hidden,BID);//construct bid order
- visible=(rand()%10+1)*10000;//set random visible qty
- hidden=(rand()%20+1)*15000;//set random hidden qty
+ visible=(random.Next()%10+1)*10000;//set random visible qty
+ hidden=(random.Next()%20+1)*15000;//set random hidden qty
  PriceStreamOrder offer_order(offerprice,visible,hidden,OFFER);//construct offer order
- PriceStream<Bond> p_stream(bnd,bid_order,offer_order);//construct pricestream
- AlgoStream<Bond> algo_stream(p_stream);//construct algo stream
+ //construct the pricestream inside the algo stream
+ return AlgoStream<Bond>(PriceStream<Bond>(data.GetProductHandle(),bid_order,offer_order));
+}
+
+void BondPriceListener::ProcessAdd(Price<Bond>& data){
+ AlgoStream<Bond> algo_stream=MakeAlgoStream(data,b_algo_stream.GetRandomSource());
  b_algo_stream.ExecuteAlgoStream(algo_stream);//flow into service
 }
 
-void BondStreamingService::PublishPrice(const PriceStream<Bond>& priceStream){
-  Bond bnd=priceStream.GetProduct();//get bond
-  string bondid=bnd.GetProductId();//get bond id
-  PriceStream<Bond> copy=priceStream;
+template<typename Sink>
+void BondStreamingService::PublishPrice(const PriceStream<Bond>& priceStream, Sink& sink){
+  const Bond& bnd=priceStream.GetProduct();//get bond
+  const string& bondid=bnd.GetProductId();//get bond id
   map<string, PriceStream<Bond> >::iterator it=bondPriceStreamCache.find(bondid);//find entry
   if(it==bondPriceStreamCache.end()){
-    //new entry
-    bondPriceStreamCache.insert(make_pair(bondid,copy));
+    //new entry, the only copy of the stream
+    it=bondPriceStreamCache.insert(make_pair(bondid,priceStream)).first;
   }
   else{
-    //exist old entry
-    bondPriceStreamCache.erase(bondid);
-    bondPriceStreamCache.insert(make_pair(bondid,copy));//insert new entry
-  }
-  for(int i=0;i<priceStreamListeners.size();++i){
-    //iterate listeners to add new data
-    priceStreamListeners[i]->ProcessAdd(copy);
+    it->second=priceStream;//replace the old entry in place
   }
+  sink.ProcessAdd(it->second);
+  priceStreamListeners.ProcessAdd(it->second);
   //write to file through connector
-  b_stream_connector.Publish(copy);
+  b_stream_connector.Publish(it->second);
 }
 
 //convert double price to suitable string form
@@ -323,10 +391,9 @@ string PriceProcess(double p){
 }
 
 void BondStreamingConnector::Publish(PriceStream<Bond>& data){
-   ofstream file;
-   file.open("./Output/PriceStreams.txt",ios_base::app);//open the file to append
-   Bond bnd=data.GetProduct();//get prodcut of data
-   string bondid=bnd.GetProductId();//get bond cusip
+   if(!file.is_open()) file.open("./Output/PriceStreams.txt",ios_base::app);//open the file to append
+   const Bond& bnd=data.GetProduct();//get prodcut of data
+   const string& bondid=bnd.GetProductId();//get bond cusip
    file<<bondid<<",";//write cusip to file
    PriceStreamOrder bid_order=data.GetBidOrder();//get bid order
    double price=bid_order.GetPrice();//get bid price
@@ -344,6 +411,7 @@ void BondStreamingConnector::Publish(PriceStream<Bond>& data){
    file<<to_string(visible)<<",";
    hidden=offer_order.GetHiddenQuantity();
    file<<to_string(hidden)<<"\n";
+   file.flush();//each stream reaches the file as it is published
 }
 
 #endif
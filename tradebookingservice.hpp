@@ -10,9 +10,15 @@
 #include <string>
 #include <vector>
 #include "soa.hpp"
+#include "listenerlist.hpp"
 #include "products.hpp"
+#include "producthandle.hpp"
+#include "bookregistry.hpp"
+#include "snapshot.hpp"
+#include "tradestore.hpp"
 #include <map>
 #include <algorithm>
+#include <stdexcept>
 #include <iostream>
 #include <fstream>
 #include <boost/algorithm/string.hpp>
@@ -32,17 +38,23 @@ class Trade
 public:
 
   // ctor for a trade
-  Trade(const T &_product, string _tradeId, string _book, long _quantity, Side _side);
+  Trade(const ProductHandle<T> &_product, string _tradeId, string _book, long _quantity, Side _side);
 
   // Get the product
   const T& GetProduct() const;
 
+  // Get the shared handle of the product, to build further messages without interning it again
+  const ProductHandle<T>& GetProductHandle() const{return product;}
+
   // Get the trade ID
   const string& GetTradeId() const;
 
   // Get the book
   const string& GetBook() const;
 
+  // Get the interned id of the book
+  int GetBookId() const;
+
   // Get the quantity
   long GetQuantity() const;
   
@@ -50,9 +62,10 @@ public:
   Side GetSide() const;
 
 private:
-  T product;
+  ProductHandle<T> product;
   string tradeId;
   string book;
+  int bookId;
   long quantity;
   Side side;
 
@@ -71,14 +84,36 @@ public:
   virtual void BookTrade(const Trade<T> &trade)=0;
 };
 
+/*
+durable record of booked trades, appended before any listener sees the trade
+T is product type
+*/
+template<typename T>
+class TradeLog
+{
+public:
+  virtual void Append(const Trade<T>& trade)=0;
+  //a trade turned away without being logged, so the log can tell how many trades it was handed
+  virtual void Reject(const Trade<T>& trade)=0;
+};
+
 //implement bondtradebookservice
-class BondTradeBookService: public TradeBookingService<Bond>
+//trades are kept as compact records in a BondTradeStore, at most maxLiveTrades of them in memory
+//and the latest maxIndexedTrades of them findable by id
+class BondTradeBookService: public TradeBookingService<Bond>, public Snapshottable
 {
 public:
-  BondTradeBookService(){}
+  BondTradeBookService(const BondReferenceDataService& refData_, const string& spillPath="./Output/trades.spill", size_t maxLiveTrades=1<<16, size_t maxIndexedTrades=1<<22):
+    refData(refData_),bondBookCache(spillPath,maxLiveTrades,maxIndexedTrades){tradeLog=nullptr;}
    // Get data on our service given a key
+   // the trade is rebuilt from its record and stays valid until the next call;
+   // throws out_of_range for a trade that was never booked or has left the store's index
   virtual Trade<Bond>& GetData(string key){
-    return bondBookCache.find(key)->second;
+    int64_t seq=bondBookCache.Find(key);
+    if(seq<0) throw out_of_range("no trade "+key);
+    lookup.clear();
+    lookup.push_back(ToTrade(seq));
+    return lookup.back();
   }
 
   // The callback that a Connector should invoke for any new or updated data
@@ -86,22 +121,43 @@ public:
 
   // Add a listener to the Service for callbacks on add, remove, and update events
   // for data to the Service.
-  virtual void AddListener(ServiceListener<Trade<Bond> > *listener){bondTradeListers.push_back(listener);}
+  virtual void AddListener(ServiceListener<Trade<Bond> > *listener){bondTradeListers.Add(listener);}
+  //remove a listener, a dispatch already under way may still call it
+  virtual void RemoveListener(ServiceListener<Trade<Bond> > *listener){bondTradeListers.Remove(listener);}
 
   // Get all listeners on the Service.
-  virtual const vector<ServiceListener<Trade<Bond> >* >& GetListeners() const{return bondTradeListers;}
+  virtual const vector<ServiceListener<Trade<Bond> >* >& GetListeners() const{return bondTradeListers.Snapshot();}
 
   //book trade
   virtual void BookTrade(const Trade<Bond> &trade);
+  //set the log every trade is written to before it is booked, null to book without one
+  void SetTradeLog(TradeLog<Bond>* log){tradeLog=log;}
+  //book a trade read back from the log without writing it again
+  void RestoreTrade(const Trade<Bond> &trade);
+  //number of trades booked and how many of them were moved to disk
+  uint64_t GetTradeCount() const{return bondBookCache.Size();}
+  uint64_t GetSpilledCount() const{return bondBookCache.GetSpilledCount();}
+
+  //checkpoint the booked trades
+  virtual string GetSnapshotName() const{return "tradebook";}
+  virtual void SaveSnapshot(SnapshotWriter& w) const;
+  virtual void LoadSnapshot(SnapshotReader& r);
 
 
 private:
-  map<string, Trade<Bond> > bondBookCache; //store records of trade
-  vector<ServiceListener<Trade<Bond> >* > bondTradeListers; //store a list of listeners
+  const BondReferenceDataService& refData;
+  BondTradeStore bondBookCache; //store records of trade
+  vector<Trade<Bond> > lookup;//the trade last returned by GetData
+  ListenerList<Trade<Bond> > bondTradeListers; //store a list of listeners
+  TradeLog<Bond>* tradeLog;//write-ahead log, null if trades are not logged
+  //rebuild the trade at a sequence number of the store
+  Trade<Bond> ToTrade(uint64_t seq) const;
+  //log, store and publish a trade, handing listeners the caller's object; trades on a book past MAX_BOOKS are rejected
+  void Book(Trade<Bond> &trade);
 };
 
 //implement BondTradeBookingConnector class
-class BondTradeBookingConnector: public Connector<Trade<Bond> >
+class BondTradeBookingConnector: public Connector<Trade<Bond> >, public Snapshottable
 {
 private:
   int counter;
@@ -109,16 +165,25 @@ public:
   //it is a subscribe-only connector, so publish do nothing
   virtual void Publish(Trade<Bond> &data){}
   BondTradeBookingConnector(){counter=0;}
-  virtual void Subscribe(BondTradeBookService& bt_book_service, map<string, Bond> m_bond);
+  virtual void Subscribe(BondTradeBookService& bt_book_service, map<string, Bond>& m_bond);
+  //number of input lines consumed so far
+  int GetCounter() const{return counter;}
+  //skip input lines whose trades were already booked, e.g. from the trade journal
+  void Skip(int lines){counter+=lines;}
+  //checkpoint the input offset
+  virtual string GetSnapshotName() const{return "trades.offset";}
+  virtual void SaveSnapshot(SnapshotWriter& w) const{w.Put(counter);}
+  virtual void LoadSnapshot(SnapshotReader& r){counter=r.Get<int>();}
 };
 
 
 template<typename T>
-Trade<T>::Trade(const T &_product, string _tradeId, string _book, long _quantity, Side _side) :
+Trade<T>::Trade(const ProductHandle<T> &_product, string _tradeId, string _book, long _quantity, Side _side) :
   product(_product)
 {
   tradeId = _tradeId;
   book = _book;
+  bookId = BookRegistry::Intern(_book);
   quantity = _quantity;
   side = _side;
 }
@@ -126,7 +191,7 @@ Trade<T>::Trade(const T &_product, string _tradeId, string _book, long _quantity
 template<typename T>
 const T& Trade<T>::GetProduct() const
 {
-  return product;
+  return product.Get();
 }
 
 template<typename T>
@@ -141,6 +206,12 @@ const string& Trade<T>::GetBook() const
   return book;
 }
 
+template<typename T>
+int Trade<T>::GetBookId() const
+{
+  return bookId;
+}
+
 template<typename T>
 long Trade<T>::GetQuantity() const
 {
@@ -160,32 +231,102 @@ void TradeBookingService<T>::BookTrade(const Trade<T> &trade)
 */
 
 void BondTradeBookService::OnMessage(Trade<Bond> &data){
-    Trade<Bond> tradeCopy=data;
-    BookTrade(tradeCopy);
+    Book(data);//the connector's trade goes downstream as is
+  }
+
+void BondTradeBookService::RestoreTrade(const Trade<Bond> &trade){
+    TradeLog<Bond>* log=tradeLog;
+    tradeLog=nullptr;//the trade is already in the log
+    BookTrade(trade);
+    tradeLog=log;
   }
 
 void BondTradeBookService::BookTrade(const Trade<Bond> &trade){
-    Trade<Bond> tradeCopy=trade; //get a copy of trade
-    string tid=tradeCopy.GetTradeId();//get trade id
-    map<string, Trade<Bond> >::iterator ptr_trade=bondBookCache.find(tid);
-    if(ptr_trade==bondBookCache.end()){
+    Trade<Bond> tradeCopy=trade; //listeners take a modifiable trade
+    Book(tradeCopy);
+  }
+
+void BondTradeBookService::Book(Trade<Bond> &tradeCopy){
+    const string& tid=tradeCopy.GetTradeId();//get trade id
+    if(tradeCopy.GetBookId()<0){
+      //positions hold MAX_BOOKS books, a trade on one more would vanish from them
+      cout<<"Too many books, trade "<<tid<<" on "<<tradeCopy.GetBook()<<" not booked\n";
+      if(tradeLog) tradeLog->Reject(tradeCopy);
+      return;
+    }
+    int d=refData.GetDenseId(tradeCopy.GetProduct().GetId());
+    if(d<0){
+      cout<<"Unknown product "<<tradeCopy.GetProduct().GetProductId()<<", trade "<<tid<<" not booked\n";
+      if(tradeLog) tradeLog->Reject(tradeCopy);
+      return;
+    }
+    if(tradeLog) tradeLog->Append(tradeCopy);//durable before anything downstream sees it
+    TradeRecord record;
+    bondBookCache.SetTradeId(record,tid);
+    record.product=d;
+    record.book=tradeCopy.GetBookId();
+    record.side=tradeCopy.GetSide();
+    record.quantity=tradeCopy.GetQuantity();
+    int64_t seq=bondBookCache.Find(tid);
+    if(seq<0){
       //iterate service listeners
-      for(int i=0;i<bondTradeListers.size();++i)
-        bondTradeListers[i]->ProcessAdd(tradeCopy); //invoke listeners
-      bondBookCache.insert(std::make_pair(tid,tradeCopy));
+      bondTradeListers.ProcessAdd(tradeCopy); //invoke listeners
+      bondBookCache.Add(record);
     }
     else{
+      Trade<Bond> previous=ToTrade(seq);
       //iterate service listeners
-      for(int i=0;i<bondTradeListers.size();++i){
-        bondTradeListers[i]->ProcessRemove(ptr_trade->second); //remove old trade
-        bondTradeListers[i]->ProcessAdd(tradeCopy);//update this trade
+      ListenerList<Trade<Bond> >::Reader reader(bondTradeListers);
+      const vector<ServiceListener<Trade<Bond> >*>& listeners=reader.Get();
+      for(size_t i=0;i<listeners.size();++i){
+        listeners[i]->ProcessRemove(previous); //remove old trade
+        listeners[i]->ProcessAdd(tradeCopy);//update this trade
       }
-      bondBookCache.erase(tid);
-      bondBookCache.insert(make_pair(tid,tradeCopy));//update cache
+      bondBookCache.Set(seq,record);//amend in place
     }
   }
 
-void BondTradeBookingConnector::Subscribe(BondTradeBookService& bt_book_service, map<string, Bond> m_bond){
+Trade<Bond> BondTradeBookService::ToTrade(uint64_t seq) const{
+  TradeRecord record;
+  bondBookCache.Get(seq,record);
+  string book=record.book>=0?BookRegistry::Name(record.book):"";
+  return Trade<Bond>(refData.GetHandle(record.product),bondBookCache.GetTradeId(record),book,record.quantity,Side(record.side));
+}
+
+void BondTradeBookService::SaveSnapshot(SnapshotWriter& w) const{
+  w.Put(uint32_t(bondBookCache.Size()));
+  for(uint64_t seq=0;seq<bondBookCache.Size();++seq){
+    Trade<Bond> t=ToTrade(seq);
+    w.PutString(t.GetTradeId());
+    w.PutString(t.GetProduct().GetProductId());
+    w.PutString(t.GetBook());
+    w.Put(t.GetQuantity());
+    w.Put(t.GetSide());
+  }
+}
+
+void BondTradeBookService::LoadSnapshot(SnapshotReader& r){
+  bondBookCache.Clear();
+  uint32_t n=r.Get<uint32_t>();
+  for(uint32_t i=0;i<n && r.IsGood();++i){
+    string tid=r.GetString();
+    string pid=r.GetString();
+    string book=r.GetString();
+    long quantity=r.Get<long>();
+    Side side=r.Get<Side>();
+    int d=refData.GetDenseId(pid);
+    if(d<0) continue;
+    TradeRecord record;
+    bondBookCache.SetTradeId(record,tid);
+    record.product=d;
+    record.book=BookRegistry::Intern(book);
+    record.side=side;
+    record.quantity=quantity;
+    bondBookCache.Add(record);
+  }
+}
+
+void BondTradeBookingConnector::Subscribe(BondTradeBookService& bt_book_service, map<string, Bond>& m_bond){
     ifstream file;
     file.open("./Input/trades.txt");
     string line;//store one line
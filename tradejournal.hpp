@@ -0,0 +1,257 @@
+/*
+implement a write-ahead journal of booked trades with group commit
+author: Gaoxian Song
+*/
+#ifndef TradeJournal_HPP
+#define TradeJournal_HPP
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <ctime>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "snapshot.hpp"
+#include "tradebookingservice.hpp"
+
+using namespace std;
+
+//when written trades are made durable with one fsync
+//maxBatch=1 syncs every trade before it is booked; larger batches trade the last few
+//trades of a power loss for fewer syncs
+class JournalCommitPolicy
+{
+public:
+  size_t maxBatch;//sync once this many trades are unsynced
+  long maxDelayMicros;//sync once the oldest unsynced trade has waited this long, 0 disables
+  JournalCommitPolicy(size_t maxBatch_=64, long maxDelayMicros_=2000):
+    maxBatch(maxBatch_),maxDelayMicros(maxDelayMicros_){}
+};
+
+/**
+ * Append-only binary journal of trades, written before the trade book notifies its listeners.
+ * Layout: a sequence of records, each a uint32 payload length, a uint32 checksum of the payload
+ * and the payload: uint64 sequence number, uint32 count of trades rejected since the record before,
+ * trade id, product id, book, quantity and side.
+ * Only trades the book accepts are journaled; rejected ones are counted into the next record so
+ * replay knows how many input trades the journal covers. Rejections after the last record are not
+ * covered, their input is read again and rejected again.
+ * Each record is written before Append returns, so a crash of the process never loses a trade the
+ * book has passed on; only the sync is batched as the commit policy allows, and the delay is checked
+ * as trades arrive, so call Commit when a feed goes quiet. A record that cannot be written whole is
+ * cut off again and kept pending, to be written ahead of the next one.
+ * On recovery a torn record at the tail is cut off, and Replay books the records after the
+ * sequence number saved in the latest checkpoint. Once a checkpoint is on disk the journal is
+ * emptied, since everything in it is covered.
+ */
+class BondTradeJournal: public TradeLog<Bond>, public Snapshottable
+{
+private:
+  string path;
+  const BondReferenceDataService& refData;
+  JournalCommitPolicy policy;
+  int fd;
+  uint64_t sequence;//sequence number of the last trade appended
+  uint64_t checkpointSequence;//last trade covered by the restored checkpoint
+  uint32_t rejected;//trades rejected since the last record appended
+  vector<char> pending;//records appended but not yet written, left by a failed write
+  size_t pendingCount;
+  uint64_t end;//length of the whole records in the file
+  size_t unsyncedCount;//records written but not yet synced
+  timespec unsyncedSince;//when the oldest unsynced record was written
+  long commits;
+  //checksum of a record payload
+  static uint32_t Checksum(const char* data, size_t len);
+  //read every whole record of the file; returns the length of the valid prefix
+  uint64_t Scan(vector<string>* payloads) const;
+  long UnsyncedMicros() const;
+  //write the pending records at end; on failure cut the file back to end, keep them pending and return false
+  bool WritePending();
+public:
+  //with recover set an existing journal is kept and any torn tail is cut off, otherwise it starts empty
+  BondTradeJournal(const string& path_, const BondReferenceDataService& refData_, const JournalCommitPolicy& policy_, bool recover);
+  ~BondTradeJournal();
+  //journal a trade, syncing the batch if the policy says so
+  virtual void Append(const Trade<Bond>& trade);
+  virtual void Reject(const Trade<Bond>& trade){++rejected;}
+  //write any pending trade and sync every trade written
+  void Commit();
+  //book the journaled trades the checkpoint does not cover; returns how many input trades those
+  //records stand for, booked or rejected, so the feed can skip past them
+  int Replay(BondTradeBookService& service);
+  void SetCommitPolicy(const JournalCommitPolicy& src){policy=src;}
+  uint64_t GetSequence() const{return sequence;}
+  long GetCommitCount() const{return commits;}
+  //checkpoint the sequence number so a warm start replays only later trades
+  virtual string GetSnapshotName() const{return "journal";}
+  virtual void SaveSnapshot(SnapshotWriter& w) const{w.Put(sequence);}
+  virtual void LoadSnapshot(SnapshotReader& r);
+  //drop every record, the checkpoint just written covers them
+  virtual void OnCheckpointed();
+};
+
+BondTradeJournal::BondTradeJournal(const string& path_, const BondReferenceDataService& refData_, const JournalCommitPolicy& policy_, bool recover):
+  path(path_),refData(refData_),policy(policy_),fd(-1),sequence(0),checkpointSequence(0),rejected(0),pendingCount(0),end(0),unsyncedCount(0),commits(0)
+{
+  unsyncedSince.tv_sec=0; unsyncedSince.tv_nsec=0;
+  fd=open(path.c_str(),O_RDWR|O_CREAT|(recover?0:O_TRUNC),0644);
+  if(fd<0){
+    cout<<"Cannot open trade journal "<<path<<"\n";
+    return;
+  }
+  if(!recover) return;
+  vector<string> payloads;
+  uint64_t valid=Scan(&payloads);
+  if(ftruncate(fd,valid)!=0) cout<<"Cannot truncate trade journal "<<path<<"\n";
+  end=valid;
+  lseek(fd,end,SEEK_SET);
+  if(!payloads.empty()){
+    SnapshotReader r(payloads.back(),refData);
+    sequence=r.Get<uint64_t>();
+  }
+}
+
+BondTradeJournal::~BondTradeJournal(){
+  Commit();
+  if(fd>=0) close(fd);
+}
+
+uint32_t BondTradeJournal::Checksum(const char* data, size_t len){
+  //FNV-1a, enough to tell a torn write from a whole record
+  uint32_t h=2166136261u;
+  for(size_t i=0;i<len;++i){
+    h^=(unsigned char)data[i];
+    h*=16777619u;
+  }
+  return h;
+}
+
+uint64_t BondTradeJournal::Scan(vector<string>* payloads) const{
+  string content;
+  char buf[65536];
+  ssize_t n;
+  lseek(fd,0,SEEK_SET);
+  while((n=read(fd,buf,sizeof(buf)))>0) content.append(buf,n);
+  uint64_t offset=0;
+  while(content.size()-offset>=2*sizeof(uint32_t)){
+    uint32_t len, sum;
+    memcpy(&len,content.data()+offset,sizeof(len));
+    memcpy(&sum,content.data()+offset+sizeof(len),sizeof(sum));
+    uint64_t begin=offset+2*sizeof(uint32_t);
+    if(content.size()-begin<len || Checksum(content.data()+begin,len)!=sum) break;//torn or corrupt
+    if(payloads) payloads->push_back(content.substr(begin,len));
+    offset=begin+len;
+  }
+  return offset;
+}
+
+long BondTradeJournal::UnsyncedMicros() const{
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC,&now);
+  return (now.tv_sec-unsyncedSince.tv_sec)*1000000L+(now.tv_nsec-unsyncedSince.tv_nsec)/1000;
+}
+
+bool BondTradeJournal::WritePending(){
+  if(pending.empty()) return true;
+  if(fd<0) return false;
+  lseek(fd,end,SEEK_SET);
+  const char* p=pending.data();
+  size_t left=pending.size();
+  while(left>0){
+    ssize_t n=write(fd,p,left);
+    if(n<=0){
+      //disk full or closed descriptor; a torn record would hide every later one from recovery
+      cout<<"Cannot write trade journal "<<path<<"\n";
+      if(ftruncate(fd,end)!=0) cout<<"Cannot truncate trade journal "<<path<<"\n";
+      lseek(fd,end,SEEK_SET);
+      return false;
+    }
+    p+=n; left-=n;
+  }
+  end+=pending.size();
+  pending.clear();
+  if(unsyncedCount==0) clock_gettime(CLOCK_MONOTONIC,&unsyncedSince);
+  unsyncedCount+=pendingCount;
+  pendingCount=0;
+  return true;
+}
+
+void BondTradeJournal::Append(const Trade<Bond>& trade){
+  SnapshotWriter payload;
+  payload.Put(++sequence);
+  payload.Put(rejected);
+  payload.PutString(trade.GetTradeId());
+  payload.PutString(trade.GetProduct().GetProductId());
+  payload.PutString(trade.GetBook());
+  payload.Put(trade.GetQuantity());
+  payload.Put(trade.GetSide());
+  const vector<char>& data=payload.GetData();
+  uint32_t len=data.size();
+  uint32_t sum=Checksum(data.data(),data.size());
+  pending.insert(pending.end(),(const char*)&len,(const char*)&len+sizeof(len));
+  pending.insert(pending.end(),(const char*)&sum,(const char*)&sum+sizeof(sum));
+  pending.insert(pending.end(),data.begin(),data.end());
+  rejected=0;
+  ++pendingCount;
+  if(!WritePending()) return;
+  if(unsyncedCount>=policy.maxBatch || (policy.maxDelayMicros>0 && UnsyncedMicros()>=policy.maxDelayMicros)) Commit();
+}
+
+void BondTradeJournal::Commit(){
+  if(fd<0) return;
+  WritePending();
+  if(unsyncedCount==0) return;
+  fdatasync(fd);//one sync for the whole batch
+  unsyncedCount=0;
+  ++commits;
+}
+
+int BondTradeJournal::Replay(BondTradeBookService& service){
+  if(fd<0) return 0;
+  Commit();
+  vector<string> payloads;
+  Scan(&payloads);
+  lseek(fd,0,SEEK_END);
+  int count=0;
+  for(size_t i=0;i<payloads.size();++i){
+    SnapshotReader r(payloads[i],refData);
+    uint64_t seq=r.Get<uint64_t>();
+    uint32_t before=r.Get<uint32_t>();
+    if(seq<=checkpointSequence) continue;//already in the restored trade book
+    count+=before+1;//the input trade of this record and the ones rejected ahead of it
+    string tid=r.GetString();
+    string pid=r.GetString();
+    string book=r.GetString();
+    long quantity=r.Get<long>();
+    Side side=r.Get<Side>();
+    const Bond* bnd=r.GetBond(pid);
+    if(!r.IsGood() || !bnd) continue;
+    service.RestoreTrade(Trade<Bond>(*bnd,tid,book,quantity,side));
+  }
+  return count;
+}
+
+void BondTradeJournal::LoadSnapshot(SnapshotReader& r){
+  checkpointSequence=r.Get<uint64_t>();
+  //the journal may have been emptied by that checkpoint, keep numbering after it
+  if(sequence<checkpointSequence) sequence=checkpointSequence;
+}
+
+void BondTradeJournal::OnCheckpointed(){
+  //rejections so far are behind the checkpoint's input offset as well
+  rejected=0;
+  pending.clear();
+  pendingCount=0;
+  unsyncedCount=0;
+  end=0;
+  if(fd<0) return;
+  if(ftruncate(fd,0)!=0){
+    cout<<"Cannot truncate trade journal "<<path<<"\n";
+    return;
+  }
+  lseek(fd,0,SEEK_SET);
+  fdatasync(fd);
+}
+
+#endif
@@ -0,0 +1,337 @@
+/*
+implement a compact, memory-bounded store of booked trades with a hash index and spill to disk
+author: Gaoxian Song
+*/
+#ifndef TradeStore_HPP
+#define TradeStore_HPP
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <iostream>
+
+using namespace std;
+
+//trade ids shorter than this are held inline in the record
+const int TRADE_ID_CHARS=24;
+//trades moved to disk at a time once the in-memory window is full
+const size_t TRADE_SPILL_BLOCK=1024;
+//bits of an index entry holding the sequence number, the rest hold a tag from the hash
+const int TRADE_SEQ_BITS=40;
+//bits of the tag, the index never has more than 2^TRADE_TAG_BITS slots so a slot's home follows from its tag
+const int TRADE_TAG_BITS=64-TRADE_SEQ_BITS;
+//bytes of pooled long trade ids kept in memory before they are appended to the id file
+const size_t TRADE_ID_FLUSH_BYTES=TRADE_SPILL_BLOCK*TRADE_ID_CHARS;
+
+//fixed-size trade with the product and book as dense ids
+struct TradeRecord
+{
+  char tradeId[TRADE_ID_CHARS];//nul terminated; a longer id starts with a nul, its uint64 pool offset at byte 4 and uint32 length at byte 12
+  int32_t product;//dense id from BondReferenceDataService
+  int16_t book;//id from BookRegistry
+  int16_t side;
+  int64_t quantity;
+};
+
+/**
+ * Trades in booking order, addressed by sequence number. The newest trades live in a ring in
+ * memory; once it is full the oldest block is written to the spill file, where trade s sits at
+ * offset s*sizeof(TradeRecord), so a spilled trade is one positioned read or write away.
+ * Ids too long for a record are pooled in a second file next to it, the newest few kilobytes
+ * in memory until they are appended.
+ * An open-addressing table maps a trade id to its sequence number in 8 bytes per entry: the
+ * sequence number plus a tag from the id's hash, which is confirmed against the record itself.
+ * Only the latest maxIndexedTrades trades are indexed; older ones drop out a block at a time, so
+ * Find no longer sees them and an amendment to one is booked as a new trade.
+ * Memory is the ring, the index window and the id pool tail, whatever the number of trades.
+ * Without a spill file everything stays in memory.
+ */
+class BondTradeStore
+{
+private:
+  string spillPath;
+  int fd;//spill file, -1 if it could not be opened
+  int idFd;//pool of long ids, -1 if it could not be opened
+  vector<TradeRecord> ring;//trades [spilled, count) at sequence % ring size
+  uint64_t spilled;//trades before this sequence number are on disk
+  uint64_t count;//trades stored
+  vector<uint64_t> index;//open addressing with linear probing, 0 is an empty slot
+  int indexBits;//the index has 2^indexBits slots
+  uint64_t maxIndexed;//trades kept in the index, a whole number of blocks
+  uint64_t indexedFrom;//trades before this sequence number have left the index
+  string idTail;//pooled ids from idFlushed on, not yet in the id file
+  uint64_t idFlushed;//bytes of the pool already in the id file
+  static uint64_t Hash(const char* data, size_t len);
+  //read len bytes at offset of a file, retrying short reads; false if they are not all there
+  bool ReadFully(int file, void* buf, size_t len, uint64_t offset) const;
+  //whether record r carries trade id
+  bool Matches(const TradeRecord& r, const string& tradeId) const;
+  //slot an entry with this tag probes from
+  size_t Home(uint64_t tag) const{return tag>>(TRADE_TAG_BITS-indexBits);}
+  //slot holding trade id, or the empty slot where it would go
+  size_t Probe(const string& tradeId, uint64_t h) const;
+  void Insert(uint64_t h, uint64_t seq);
+  //take the entry of trade seq out of the index
+  void Erase(uint64_t h, uint64_t seq);
+  //double the index and re-insert every indexed trade
+  void Grow();
+  //read the records of the block starting at seq; false if it could not be read
+  bool ReadBlock(uint64_t seq, vector<TradeRecord>& block) const;
+  //drop the oldest indexed block from the index
+  void Evict();
+  //write the oldest block of the ring to disk
+  void Spill();
+  //hold the index with one more trade, growing it or letting the oldest block go
+  void Reserve();
+public:
+  //maxLiveTrades and maxIndexedTrades are rounded up to a whole number of spill blocks
+  BondTradeStore(const string& spillPath_, size_t maxLiveTrades, size_t maxIndexedTrades=1<<22);
+  ~BondTradeStore();
+  //sequence number of a trade, -1 if unknown or no longer indexed
+  int64_t Find(const string& tradeId) const;
+  //store a new trade; returns its sequence number
+  uint64_t Add(const TradeRecord& record);
+  //read and overwrite the trade at a sequence number
+  void Get(uint64_t seq, TradeRecord& record) const;
+  void Set(uint64_t seq, const TradeRecord& record);
+  //fill in the id of a record, pooling it if it does not fit
+  void SetTradeId(TradeRecord& record, const string& tradeId);
+  string GetTradeId(const TradeRecord& record) const;
+  //drop every trade
+  void Clear();
+  uint64_t Size() const{return count;}
+  uint64_t GetSpilledCount() const{return spilled;}
+  //oldest trade still in the index
+  uint64_t GetIndexedFrom() const{return indexedFrom;}
+};
+
+BondTradeStore::BondTradeStore(const string& spillPath_, size_t maxLiveTrades, size_t maxIndexedTrades):
+  spillPath(spillPath_),spilled(0),count(0),indexBits(10),indexedFrom(0),idFlushed(0)
+{
+  size_t blocks=(maxLiveTrades+TRADE_SPILL_BLOCK-1)/TRADE_SPILL_BLOCK;
+  ring.resize(max(blocks,size_t(1))*TRADE_SPILL_BLOCK);
+  //at a load factor under 0.7 the window has to fit in the largest index
+  uint64_t cap=uint64_t(7)*(1ULL<<TRADE_TAG_BITS)/10-2*TRADE_SPILL_BLOCK;
+  uint64_t window=min<uint64_t>(max<uint64_t>(maxIndexedTrades,1),cap);
+  maxIndexed=(window+TRADE_SPILL_BLOCK-1)/TRADE_SPILL_BLOCK*TRADE_SPILL_BLOCK;
+  index.assign(size_t(1)<<indexBits,0);
+  fd=open(spillPath.c_str(),O_RDWR|O_CREAT|O_TRUNC,0644);
+  if(fd<0) cout<<"Cannot open trade spill file "<<spillPath<<", trades stay in memory\n";
+  string idPath=spillPath+".ids";
+  idFd=open(idPath.c_str(),O_RDWR|O_CREAT|O_TRUNC,0644);
+  if(idFd<0) cout<<"Cannot open trade id file "<<idPath<<", long ids stay in memory\n";
+}
+
+BondTradeStore::~BondTradeStore(){
+  if(fd>=0) close(fd);
+  if(idFd>=0) close(idFd);
+}
+
+uint64_t BondTradeStore::Hash(const char* data, size_t len){
+  //FNV-1a
+  uint64_t h=14695981039346656037ULL;
+  for(size_t i=0;i<len;++i){
+    h^=(unsigned char)data[i];
+    h*=1099511628211ULL;
+  }
+  return h;
+}
+
+bool BondTradeStore::ReadFully(int file, void* buf, size_t len, uint64_t offset) const{
+  char* p=static_cast<char*>(buf);
+  while(len>0){
+    ssize_t n=pread(file,p,len,offset);
+    if(n<=0) return false;//an error, or the file ends early
+    p+=n; len-=n; offset+=n;
+  }
+  return true;
+}
+
+void BondTradeStore::SetTradeId(TradeRecord& record, const string& tradeId){
+  memset(record.tradeId,0,TRADE_ID_CHARS);
+  if(tradeId.size()<TRADE_ID_CHARS && tradeId.find('\0')==string::npos){
+    memcpy(record.tradeId,tradeId.data(),tradeId.size());
+    return;
+  }
+  uint64_t offset=idFlushed+idTail.size();
+  uint32_t len=tradeId.size();
+  idTail.append(tradeId);
+  memcpy(record.tradeId+4,&offset,sizeof(offset));
+  memcpy(record.tradeId+12,&len,sizeof(len));
+  if(idFd>=0 && idTail.size()>=TRADE_ID_FLUSH_BYTES){
+    if(pwrite(idFd,idTail.data(),idTail.size(),idFlushed)!=(ssize_t)idTail.size()){
+      cout<<"Cannot write trade id file "<<spillPath<<".ids\n";
+      return;//keep the tail in memory and try again with the next id
+    }
+    idFlushed+=idTail.size();
+    idTail.clear();
+  }
+}
+
+string BondTradeStore::GetTradeId(const TradeRecord& record) const{
+  if(record.tradeId[0]!='\0') return string(record.tradeId,strnlen(record.tradeId,TRADE_ID_CHARS));
+  uint64_t offset;
+  uint32_t len;
+  memcpy(&offset,record.tradeId+4,sizeof(offset));
+  memcpy(&len,record.tradeId+12,sizeof(len));
+  if(offset>=idFlushed) return offset+len<=idFlushed+idTail.size()?idTail.substr(offset-idFlushed,len):"";
+  string id(len,'\0');
+  if(len>0 && !ReadFully(idFd,&id[0],len,offset)){
+    cout<<"Cannot read trade id file "<<spillPath<<".ids\n";
+    return "";
+  }
+  return id;
+}
+
+bool BondTradeStore::Matches(const TradeRecord& r, const string& tradeId) const{
+  if(r.tradeId[0]=='\0') return GetTradeId(r)==tradeId;
+  return tradeId.size()<TRADE_ID_CHARS && strncmp(r.tradeId,tradeId.c_str(),TRADE_ID_CHARS)==0;
+}
+
+size_t BondTradeStore::Probe(const string& tradeId, uint64_t h) const{
+  size_t mask=index.size()-1;
+  uint64_t tag=h>>TRADE_SEQ_BITS;
+  for(size_t i=Home(tag);;i=(i+1)&mask){
+    uint64_t e=index[i];
+    if(e==0) return i;
+    if((e>>TRADE_SEQ_BITS)!=tag) continue;
+    TradeRecord r;
+    Get((e&((1ULL<<TRADE_SEQ_BITS)-1))-1,r);
+    if(Matches(r,tradeId)) return i;
+  }
+}
+
+int64_t BondTradeStore::Find(const string& tradeId) const{
+  uint64_t e=index[Probe(tradeId,Hash(tradeId.data(),tradeId.size()))];
+  return e==0?-1:int64_t(e&((1ULL<<TRADE_SEQ_BITS)-1))-1;
+}
+
+void BondTradeStore::Insert(uint64_t h, uint64_t seq){
+  size_t mask=index.size()-1;
+  size_t i=Home(h>>TRADE_SEQ_BITS);
+  while(index[i]!=0) i=(i+1)&mask;
+  index[i]=((h>>TRADE_SEQ_BITS)<<TRADE_SEQ_BITS)|(seq+1);
+}
+
+void BondTradeStore::Erase(uint64_t h, uint64_t seq){
+  size_t mask=index.size()-1;
+  uint64_t entry=((h>>TRADE_SEQ_BITS)<<TRADE_SEQ_BITS)|(seq+1);
+  size_t i=Home(h>>TRADE_SEQ_BITS);
+  while(index[i]!=entry){
+    if(index[i]==0) return;//not indexed
+    i=(i+1)&mask;
+  }
+  //shift later entries of the probe run back so no tombstone is needed
+  for(size_t j=(i+1)&mask;index[j]!=0;j=(j+1)&mask){
+    size_t home=Home(index[j]>>TRADE_SEQ_BITS);
+    //move j into the hole at i unless its home lies cyclically in (i, j]
+    if(((j-home)&mask)>=((j-i)&mask)){index[i]=index[j]; i=j;}
+  }
+  index[i]=0;
+}
+
+bool BondTradeStore::ReadBlock(uint64_t seq, vector<TradeRecord>& block) const{
+  size_t n=min<uint64_t>(TRADE_SPILL_BLOCK,count-seq);
+  block.resize(n);
+  if(seq>=spilled){
+    for(size_t k=0;k<n;++k) block[k]=ring[(seq+k)%ring.size()];
+    return true;
+  }
+  //spilled is a multiple of the block size, so a block is either all on disk or all in the ring
+  return ReadFully(fd,&block[0],n*sizeof(TradeRecord),seq*sizeof(TradeRecord));
+}
+
+void BondTradeStore::Grow(){
+  //rehash from the records in sequence order, spilled trades are read back a block at a time
+  ++indexBits;
+  index.assign(size_t(1)<<indexBits,0);
+  vector<TradeRecord> block;
+  for(uint64_t s=indexedFrom;s<count;s+=TRADE_SPILL_BLOCK){
+    if(!ReadBlock(s,block)){
+      cout<<"Cannot read trade spill file "<<spillPath<<", trades "<<s<<" on are not indexed\n";
+      continue;
+    }
+    for(size_t k=0;k<block.size();++k){
+      string id=GetTradeId(block[k]);
+      Insert(Hash(id.data(),id.size()),s+k);
+    }
+  }
+}
+
+void BondTradeStore::Evict(){
+  vector<TradeRecord> block;
+  if(!ReadBlock(indexedFrom,block)) cout<<"Cannot read trade spill file "<<spillPath<<", trades "<<indexedFrom<<" on cannot leave the index\n";
+  else{
+    for(size_t k=0;k<block.size();++k){
+      string id=GetTradeId(block[k]);
+      Erase(Hash(id.data(),id.size()),indexedFrom+k);
+    }
+  }
+  indexedFrom+=TRADE_SPILL_BLOCK;
+}
+
+void BondTradeStore::Spill(){
+  //spilled is a multiple of the block size and the ring of the block count, so the block is contiguous
+  const TradeRecord* first=&ring[spilled%ring.size()];
+  size_t len=TRADE_SPILL_BLOCK*sizeof(TradeRecord);
+  if(pwrite(fd,first,len,spilled*sizeof(TradeRecord))!=(ssize_t)len)
+    cout<<"Cannot write trade spill file "<<spillPath<<"\n";
+  spilled+=TRADE_SPILL_BLOCK;
+}
+
+void BondTradeStore::Reserve(){
+  //indexedFrom is a multiple of the block size, so only whole blocks leave the index
+  if(count-indexedFrom>=maxIndexed+TRADE_SPILL_BLOCK) Evict();
+  //keep the load factor under 0.7
+  if(10*(count-indexedFrom+1)>7*index.size() && indexBits<TRADE_TAG_BITS) Grow();
+}
+
+uint64_t BondTradeStore::Add(const TradeRecord& record){
+  if(count-spilled==ring.size()){
+    if(fd>=0) Spill();
+    else ring.resize(ring.size()*2);//nowhere to spill, keep everything in memory
+  }
+  Reserve();
+  uint64_t seq=count++;
+  ring[seq%ring.size()]=record;
+  string id=GetTradeId(record);
+  Insert(Hash(id.data(),id.size()),seq);
+  return seq;
+}
+
+void BondTradeStore::Get(uint64_t seq, TradeRecord& record) const{
+  if(seq>=spilled){
+    record=ring[seq%ring.size()];
+    return;
+  }
+  if(!ReadFully(fd,&record,sizeof(record),seq*sizeof(TradeRecord))){
+    cout<<"Cannot read trade spill file "<<spillPath<<"\n";
+    memset(&record,0,sizeof(record));
+  }
+}
+
+void BondTradeStore::Set(uint64_t seq, const TradeRecord& record){
+  if(seq>=spilled){
+    ring[seq%ring.size()]=record;
+    return;
+  }
+  if(pwrite(fd,&record,sizeof(record),seq*sizeof(TradeRecord))!=(ssize_t)sizeof(record))
+    cout<<"Cannot write trade spill file "<<spillPath<<"\n";
+}
+
+void BondTradeStore::Clear(){
+  spilled=0;
+  count=0;
+  indexedFrom=0;
+  indexBits=10;
+  index.assign(size_t(1)<<indexBits,0);
+  idTail.clear();
+  idFlushed=0;
+  if(fd>=0 && ftruncate(fd,0)!=0) cout<<"Cannot truncate trade spill file "<<spillPath<<"\n";
+  if(idFd>=0 && ftruncate(idFd,0)!=0) cout<<"Cannot truncate trade id file "<<spillPath<<".ids\n";
+}
+
+#endif